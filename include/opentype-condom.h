@@ -6,15 +6,31 @@
 #include <string.h>
 
 #include <arpa/inet.h>  // For htons/ntohs
+#include <sys/uio.h>  // For struct iovec
 #include <algorithm>  // For stl::min
+#include <vector>
+
+// -----------------------------------------------------------------------------
+// Return the sum, modulo 2^32, of |num_words| big-endian 32-bit words starting
+// at |data|, which needn't be aligned. This is the OpenType table checksum
+// and is vectorised where the CPU allows.
+// -----------------------------------------------------------------------------
+uint32_t otc_checksum_words(const uint8_t *data, size_t num_words);
 
 // -----------------------------------------------------------------------------
 // This is an interface for an abstract stream class which is used for writing
 // the serialised results out.
+//
+// Small writes (which is most of them: the serialisers write one field at a
+// time) are gathered in an internal buffer and only checksummed and passed to
+// WriteRaw in bulk. Thus Flush must be called before Tell or Seek, and once
+// everything has been written. otc_process does this itself.
 // -----------------------------------------------------------------------------
 class OTCStream {
  public:
-  OTCStream() {
+  OTCStream()
+      : staged_(0),
+        staged_chksummed_(0) {
     ResetChecksum();
   }
 
@@ -24,36 +40,46 @@ class OTCStream {
   virtual bool WriteRaw(const void *data, size_t length) = 0;
 
   bool Write(const void *data, size_t length) {
-    const size_t orig_length = length;
-
-    size_t offset = 0;
-    if (chksum_buffer_offset_) {
-      const size_t l =
-        std::min(length, static_cast<size_t>(4) - chksum_buffer_offset_);
-      memcpy(chksum_buffer_ + chksum_buffer_offset_, data, l);
-      chksum_buffer_offset_ += l;
-      offset += l;
-      length -= l;
+    if (length < kMaxStagedWrite) {
+      if (length > sizeof(staging_) - staged_ && !Flush())
+        return false;
+      memcpy(staging_ + staged_, data, length);
+      staged_ += length;
+      return true;
     }
 
-    if (chksum_buffer_offset_ == 4) {
-      chksum_ += ntohl(*reinterpret_cast<const uint32_t*>(chksum_buffer_));
-      chksum_buffer_offset_ = 0;
-    }
+    if (!Flush())
+      return false;
+    UpdateChecksum(reinterpret_cast<const uint8_t*>(data), length);
+    return WriteRaw(data, length);
+  }
 
-    while (length >= 4) {
-      chksum_ += ntohl(*reinterpret_cast<const uint32_t*>(reinterpret_cast<const uint8_t*>(data) + offset));
-      length -= 4;
-      offset += 4;
-    }
+  // As Write, but |words_chksum| is already known to be the sum of the whole
+  // big-endian words of |data|, so they aren't summed again. It's only used
+  // when the checksum is word aligned, which it is at the start of a table.
+  bool WriteWithChecksum(const void *data, size_t length,
+                         uint32_t words_chksum) {
+    if (length < kMaxStagedWrite)
+      return Write(data, length);
+    if (!Flush())
+      return false;
+    if (chksum_buffer_offset_)
+      return Write(data, length);
 
-    if (length) {
-      assert(chksum_buffer_offset_ == 0);
-      memcpy(chksum_buffer_, reinterpret_cast<const uint8_t*>(data) + offset, length);
-      chksum_buffer_offset_ = length;
-    }
+    chksum_ += words_chksum;
+    const size_t tail = length & 3;
+    memcpy(chksum_buffer_,
+           reinterpret_cast<const uint8_t*>(data) + length - tail, tail);
+    chksum_buffer_offset_ = tail;
+    return WriteRaw(data, length);
+  }
 
-    return WriteRaw(data, orig_length);
+  // Pass any buffered writes to WriteRaw.
+  bool Flush() {
+    ChecksumStaged();
+    const size_t length = staged_;
+    staged_ = staged_chksummed_ = 0;
+    return !length || WriteRaw(staging_, length);
   }
 
   virtual void Seek(off_t position) = 0;
@@ -96,11 +122,15 @@ class OTCStream {
   }
 
   void ResetChecksum() {
+    // Anything still in the buffer was written before the reset and so
+    // doesn't contribute to the new checksum.
+    staged_chksummed_ = staged_;
     chksum_ = 0;
     chksum_buffer_offset_ = 0;
   }
 
   uint32_t chksum() const {
+    ChecksumStaged();
     assert(chksum_buffer_offset_ == 0);
     return chksum_;
   }
@@ -112,6 +142,7 @@ class OTCStream {
   };
 
   ChecksumState SaveChecksumState() const {
+    ChecksumStaged();
     ChecksumState s;
     s.chksum = chksum_;
     s.chksum_buffer_offset = chksum_buffer_offset_;
@@ -121,6 +152,7 @@ class OTCStream {
   }
 
   void RestoreChecksum(const ChecksumState &s) {
+    ChecksumStaged();
     assert(chksum_buffer_offset_ == 0);
     chksum_ += s.chksum;
     chksum_buffer_offset_ = s.chksum_buffer_offset;
@@ -128,9 +160,118 @@ class OTCStream {
   }
 
  protected:
-  uint32_t chksum_;
-  uint8_t chksum_buffer_[4];
-  unsigned chksum_buffer_offset_;
+  // Writes shorter than this are buffered.
+  static const size_t kMaxStagedWrite = 64;
+  static const size_t kMinChecksumKernelWords = 8;
+
+  // Read a big-endian 32-bit value, which needn't be aligned.
+  static uint32_t LoadU32(const uint8_t *data) {
+    uint32_t v;
+    memcpy(&v, data, sizeof(v));
+    return ntohl(v);
+  }
+
+  void UpdateChecksum(const uint8_t *data, size_t length) const {
+    size_t offset = 0;
+    if (chksum_buffer_offset_) {
+      const size_t l =
+        std::min(length, static_cast<size_t>(4) - chksum_buffer_offset_);
+      memcpy(chksum_buffer_ + chksum_buffer_offset_, data, l);
+      chksum_buffer_offset_ += l;
+      offset += l;
+      length -= l;
+    }
+
+    if (chksum_buffer_offset_ == 4) {
+      chksum_ += LoadU32(chksum_buffer_);
+      chksum_buffer_offset_ = 0;
+    }
+
+    // Short runs aren't worth the call to the vectorised code.
+    const size_t num_words = length / 4;
+    if (num_words >= kMinChecksumKernelWords) {
+      chksum_ += otc_checksum_words(data + offset, num_words);
+    } else {
+      for (size_t i = 0; i < num_words; ++i)
+        chksum_ += LoadU32(data + offset + i * 4);
+    }
+    offset += num_words * 4;
+    length -= num_words * 4;
+
+    if (length) {
+      assert(chksum_buffer_offset_ == 0);
+      memcpy(chksum_buffer_, data + offset, length);
+      chksum_buffer_offset_ = length;
+    }
+  }
+
+  // Add the buffered bytes which haven't been checksummed yet to the
+  // checksum. This doesn't change what has been written, so it's allowed on a
+  // const stream, which is why the checksum state is mutable.
+  void ChecksumStaged() const {
+    UpdateChecksum(staging_ + staged_chksummed_, staged_ - staged_chksummed_);
+    staged_chksummed_ = staged_;
+  }
+
+  mutable uint32_t chksum_;
+  mutable uint8_t chksum_buffer_[4];
+  mutable unsigned chksum_buffer_offset_;
+
+  uint8_t staging_[4096];
+  size_t staged_;  // number of bytes in |staging_|
+  // number of bytes of |staging_| checksummed
+  mutable size_t staged_chksummed_;
+};
+
+// -----------------------------------------------------------------------------
+// An OTCStream which doesn't copy the output into one contiguous buffer.
+// Instead it builds a list of segments, suitable for writev or sendmsg. Large
+// writes which come from the input file (most of the glyph data, for example)
+// are referenced where they are, and everything else is gathered into buffers
+// owned by the stream.
+//
+// Since the referenced segments can't be modified afterwards, this stream
+// can't seek. It must be used with OTCOptions::forward_only set. Otherwise the
+// first seek which would move the position makes every later write fail, and
+// so otc_process fails too.
+// -----------------------------------------------------------------------------
+class OTCIOVecStream : public OTCStream {
+ public:
+  // input: the OpenType file which will be given to otc_process. This must
+  //   outlive the segments returned by GetIOVec.
+  // length: the size, in bytes, of |input|
+  OTCIOVecStream(const uint8_t *input, size_t length);
+
+  bool WriteRaw(const void *data, size_t length);
+  void Seek(off_t position);
+  off_t Tell() const;
+
+  // Set |iov| to the list of segments which make up the output, in order. The
+  // segments are only valid while this object, and the input, are alive. Note
+  // that there may be more than IOV_MAX segments.
+  void GetIOVec(std::vector<struct iovec> *iov) const;
+
+ private:
+  struct Segment {
+    const uint8_t *input;  // NULL if the data is in |buffer_|
+    size_t offset;  // offset into |buffer_| if |input| is NULL
+    size_t length;
+  };
+
+  // Writes which are shorter than this are always copied, since a segment
+  // costs more than copying a few bytes.
+  static const size_t kMinReferenceLength = 64;
+
+  const uint8_t *const input_;
+  const size_t input_length_;
+  size_t length_;
+  bool seek_failed_;  // true if Seek was asked to move the position
+  std::vector<Segment> segments_;
+  std::vector<uint8_t> buffer_;
+
+  // Not copyable
+  OTCIOVecStream(const OTCIOVecStream&);
+  void operator=(const OTCIOVecStream&);
 };
 
 // -----------------------------------------------------------------------------
@@ -138,9 +279,374 @@ class OTCStream {
 //   output: a pointer to an object implementing the OTCStream interface. The
 //     sanitisied output will be written to this. In the even of a failure,
 //     partial output may have been written.
-//   input: the OpenType file
+//   input: the OpenType file. This may also be a WOFF 1.0 file, in which case
+//     each table is decompressed into its own buffer (or, if it's stored
+//     uncompressed, used in place) and parsed from there.
 //   length: the size, in bytes, of |input|
 // -----------------------------------------------------------------------------
 bool otc_process(OTCStream *output, const uint8_t *input, size_t length);
 
+// An index which maps Unicode code-points to glyph ids, built from the
+// character map of a sanitised font. See OTCOptions::cmap_index.
+struct OTCCMAPIndex;
+
+// An inclusive range of Unicode code-points
+struct OTCCodePointRange {
+  uint32_t start;
+  uint32_t end;
+};
+
+// The set of code-points which a font maps to a glyph other than .notdef,
+// suitable for generating a CSS unicode-range descriptor. See
+// OTCOptions::coverage.
+struct OTCCoverage {
+  OTCCoverage()
+      : want_bitmap(false) {
+  }
+
+  // (input) If true, |bitmap| is filled in as well as |ranges|.
+  bool want_bitmap;
+  // (output) The covered code-points as a sorted list of ranges. Adjacent
+  // ranges are always merged, so there is a gap between each range.
+  std::vector<OTCCodePointRange> ranges;
+  // (output) Either empty or 0x110000 bits, one for each code-point. The bit
+  // for code-point c is (bitmap[c >> 3] >> (c & 7)) & 1.
+  std::vector<uint8_t> bitmap;
+};
+
+// The number of bytes saved in each table by OTCOptions::compact and
+// OTCOptions::drop_glyph_names
+struct OTCCompactStats {
+  OTCCompactStats()
+      : loca(0),
+        hmtx(0),
+        post(0),
+        cmap(0) {
+  }
+
+  size_t loca;
+  size_t hmtx;
+  size_t post;
+  size_t cmap;
+};
+
+// The container which otc_process writes the sanitised font in
+enum OTCOutputFormat {
+  // A plain OpenType (TrueType) file
+  OTC_OUTPUT_SFNT,
+  // A WOFF 1.0 file with zlib compressed tables. See
+  // http://www.w3.org/TR/WOFF/
+  OTC_OUTPUT_WOFF,
+  // A WOFF 2.0 file, compressed with Brotli and with the glyf table split
+  // into separate streams of contours, points, flags and so on (loca is
+  // dropped and rebuilt by the decoder). The decoder's glyf table has the same
+  // outlines but isn't byte for byte the same as the sanitised one. See
+  // http://www.w3.org/TR/WOFF2/
+  OTC_OUTPUT_WOFF2
+};
+
+// A cache of the results of otc_process, keyed by a hash of the input. See
+// otc_cache_new.
+struct OTCCache;
+
+// -----------------------------------------------------------------------------
+// Options which change the way that otc_process works. The defaults give the
+// same behaviour as the three argument version of otc_process.
+// -----------------------------------------------------------------------------
+struct OTCOptions {
+  OTCOptions()
+      : forward_only(false),
+        cmap_index(NULL),
+        coverage(NULL),
+        subset(NULL),
+        compact(false),
+        drop_glyph_names(false),
+        compact_stats(NULL),
+        output_format(OTC_OUTPUT_SFNT),
+        num_threads(1),
+        table_memo(NULL) {
+  }
+
+  // If true, the output is written strictly in order and OTCStream::Seek and
+  // OTCStream::Tell are never called, so the output can be a pipe or a socket.
+  // In order to do this, the length and checksum of every table is calculated
+  // before anything is written, which costs an extra pass over the output.
+  bool forward_only;
+
+  // If not NULL, and the file is successfully sanitised, |*cmap_index| is set
+  // to a newly allocated index of the font's character map, which must be
+  // freed with otc_cmap_index_free. (This is built from the tables as parsed,
+  // so the sanitised output doesn't need to be parsed again.)
+  OTCCMAPIndex **cmap_index;
+
+  // If not NULL, and the file is successfully sanitised, |*coverage| is filled
+  // in with the code-points which the font's character map covers. As with
+  // |cmap_index|, this is found from the tables as they are parsed.
+  OTCCoverage *coverage;
+
+  // If not NULL, the output only contains the glyphs needed to render these
+  // code-points: those which they map to, .notdef and any components of those
+  // glyphs. The remaining glyphs are renumbered and the character map only
+  // includes these code-points. |cmap_index| and |coverage| describe the
+  // subset font.
+  const std::vector<uint32_t> *subset;
+
+  // If true, the output is made smaller without changing the font: short loca
+  // offsets are used whenever the glyph data is small enough, glyphs at the
+  // end of hmtx which share the same advance only store their left side
+  // bearings and the character map is re-encoded as compactly as possible.
+  bool compact;
+
+  // If true, the glyph names are dropped by writing a version 3 post table.
+  bool drop_glyph_names;
+
+  // If not NULL, the bytes saved by |compact| and |drop_glyph_names| in each
+  // table are added to |*compact_stats| (so it can accumulate over many
+  // files).
+  OTCCompactStats *compact_stats;
+
+  // The container to write. A WOFF file is always written strictly in order,
+  // whatever |forward_only| says, since all of its tables are serialised and
+  // compressed in memory before anything is written.
+  OTCOutputFormat output_format;
+
+  // The maximum number of threads, including the calling thread, used to
+  // parse the tables of the input and to compress the tables of a WOFF 1.0
+  // file. Tables which don't depend on each other are parsed at the same time
+  // (the glyph data, say, alongside the character map), which mostly helps
+  // large fonts. If zero, one thread per online CPU is used.
+  unsigned num_threads;
+
+  // If not NULL, the cmap and post tables are looked up in, and added to, this
+  // cache (from otc_cache_new) by a hash of their bytes and the number of
+  // glyphs. The fonts of a family often share these tables byte for byte, so
+  // the later fonts skip parsing and reserialising them. The output is the
+  // same either way. A table is only memoised when it's written as parsed:
+  // not with |subset|, and not with |compact|, |cmap_index| or |coverage| for
+  // cmap or |drop_glyph_names| for post. The same cache can be used for
+  // otc_process_cached: tables and whole fonts are hashed in separate domains,
+  // so their keys only collide by chance.
+  OTCCache *table_memo;
+};
+
+bool otc_process(OTCStream *output, const uint8_t *input, size_t length,
+                 const OTCOptions &options);
+
+// -----------------------------------------------------------------------------
+// Split an OpenType file into several sanitised fonts, each of which only
+// contains the glyphs needed for one set of code-points (as with
+// OTCOptions::subset). This is typically used to serve a large font as
+// several slices with different CSS unicode-range descriptors. The input is
+// only parsed and validated once, however many slices there are.
+//   outputs: an array of |slices.size()| streams. The i-th slice is written
+//     to outputs[i].
+//   input: the OpenType file
+//   length: the size, in bytes, of |input|
+//   slices: the code-points of each slice. These needn't be disjoint.
+//   options: |subset|, |cmap_index|, |coverage| and |table_memo| aren't used.
+// Returns false if the file is rejected, or any slice fails, in which case
+// some of the outputs may have been written.
+// -----------------------------------------------------------------------------
+bool otc_process_slices(OTCStream *const *outputs, const uint8_t *input,
+                        size_t length,
+                        const std::vector<std::vector<uint32_t> > &slices,
+                        const OTCOptions &options = OTCOptions());
+
+// -----------------------------------------------------------------------------
+// Calculate the exact size of the sanitised version of an OpenType file
+// without writing it anywhere.
+//   output_length: (output) the number of bytes which otc_process would write
+//   input: the OpenType file
+//   length: the size, in bytes, of |input|
+//   options: the options which will be passed to otc_process
+// Returns false if the file would be rejected by otc_process.
+// -----------------------------------------------------------------------------
+bool otc_output_size(size_t *output_length, const uint8_t *input,
+                     size_t length, const OTCOptions &options = OTCOptions());
+
+// -----------------------------------------------------------------------------
+// Process an OpenType file, writing the sanitised version into a fixed size,
+// caller-owned buffer. This fails if the output doesn't fit, in which case
+// the buffer may have been partially written. Use otc_output_size to find how
+// large the buffer needs to be.
+//   output: the buffer to write into
+//   output_length: the size, in bytes, of |output|
+//   written: (output) the number of bytes written to |output|
+//   input: the OpenType file
+//   length: the size, in bytes, of |input|
+// -----------------------------------------------------------------------------
+bool otc_process_buffer(uint8_t *output, size_t output_length, size_t *written,
+                        const uint8_t *input, size_t length,
+                        const OTCOptions &options = OTCOptions());
+
+// -----------------------------------------------------------------------------
+// Process a batch of OpenType files on a pool of worker threads. otc_process
+// shares no state between calls, so this is equivalent to calling it on each
+// input in turn, only faster.
+//   outputs: an array of |count| streams. The sanitised version of inputs[i]
+//     is written to outputs[i]. Each stream is only used by a single thread.
+//   inputs: an array of |count| OpenType files
+//   lengths: lengths[i] is the size, in bytes, of inputs[i]
+//   results: (output) an array of |count| bools. results[i] is set to the
+//     return value of otc_process for inputs[i].
+//   count: the number of files in the batch
+//   num_threads: the maximum number of threads to use, including the calling
+//     thread. If zero, one thread per online CPU is used.
+// -----------------------------------------------------------------------------
+void otc_process_batch(OTCStream *const *outputs, const uint8_t *const *inputs,
+                       const size_t *lengths, bool *results, size_t count,
+                       unsigned num_threads);
+
+// Counters describing the use of an OTCCache. See otc_cache_stats.
+struct OTCCacheStats {
+  OTCCacheStats()
+      : hits(0),
+        negative_hits(0),
+        misses(0),
+        evictions(0),
+        entries(0),
+        bytes(0) {
+  }
+
+  // The number of calls answered from the cache, including |negative_hits|
+  uint64_t hits;
+  // The number of calls answered by a cached rejection
+  uint64_t negative_hits;
+  // The number of calls which had to run otc_process
+  uint64_t misses;
+  // The number of entries dropped to keep the cache within its size
+  uint64_t evictions;
+  // The number of entries, both sanitised fonts and rejections, in the cache
+  size_t entries;
+  // The number of bytes charged against the cache's size
+  size_t bytes;
+};
+
+// -----------------------------------------------------------------------------
+// Create a cache of sanitised fonts, for use with otc_process_cached. The
+// cache is safe to use from any number of threads at once.
+//   max_bytes: the maximum size of the cache. Each entry is charged the length
+//     of its output plus a small, fixed overhead. The least recently used
+//     entries are dropped to stay within this.
+// Returns NULL if the cache couldn't be created.
+// -----------------------------------------------------------------------------
+OTCCache *otc_cache_new(size_t max_bytes);
+
+// -----------------------------------------------------------------------------
+// Free a cache from otc_cache_new. No other thread may be using it.
+// -----------------------------------------------------------------------------
+void otc_cache_free(OTCCache *cache);
+
+// -----------------------------------------------------------------------------
+// As otc_process, but the result is looked up in |cache| first. The cache is
+// keyed by a 128-bit hash of the input and of the options which affect the
+// output, and it remembers rejected files as well as sanitised ones, so a
+// repeated input costs no more than hashing it.
+//
+// The hash is keyed with a secret chosen when the cache is created, so a
+// hostile input can't be made to collide with another font's entry.
+//
+// If |options| asks for a cmap index, coverage or compact stats, the cache is
+// bypassed, since none of those are kept.
+// -----------------------------------------------------------------------------
+bool otc_process_cached(OTCCache *cache, OTCStream *output,
+                        const uint8_t *input, size_t length,
+                        const OTCOptions &options = OTCOptions());
+
+// -----------------------------------------------------------------------------
+// Set |*stats| to a snapshot of the counters of |cache|.
+// -----------------------------------------------------------------------------
+void otc_cache_stats(OTCCache *cache, OTCCacheStats *stats);
+
+// A persistent store of the results of otc_process, kept in a pair of files.
+// See otc_store_open.
+struct OTCStore;
+
+// -----------------------------------------------------------------------------
+// Open a persistent store of sanitised fonts, creating it if it doesn't
+// exist. Unlike OTCCache, the store survives restarts: the results are kept
+// in an append-only data file, |path| with ".data" appended, and found through
+// an open-addressed hash table in an index file, |path| with ".index"
+// appended. Both are mapped into memory, so a lookup neither copies nor parses
+// anything.
+//
+// Every record is checksummed and a record is only added to the index once
+// it's on disk. If the process or machine crashes, a half written record is
+// discarded when the store is next opened, and if the index is damaged it's
+// rebuilt from the data file. The output of each record is checked the first
+// time it's looked up after the store is opened, and if it's damaged the
+// lookup misses. A store written by a version of the sanitiser whose output
+// may differ is emptied when it's opened.
+//
+// Only one process may have a store open at a time, but within that process it
+// may be used from any number of threads.
+//   path: the name of the store, without the extensions
+//   max_bytes: the maximum size of the data file. This much address space is
+//     reserved, so that the data never has to be mapped again as it grows.
+//   max_entries: the number of results which the index has room for, if it's
+//     created. Once either limit is reached, nothing more is added.
+// Returns NULL if the store couldn't be opened.
+// -----------------------------------------------------------------------------
+OTCStore *otc_store_open(const char *path, uint64_t max_bytes,
+                         size_t max_entries);
+
+// -----------------------------------------------------------------------------
+// Close a store from otc_store_open. No other thread may be using it, and any
+// pointers returned by otc_store_lookup become invalid.
+// -----------------------------------------------------------------------------
+void otc_store_close(OTCStore *store);
+
+// -----------------------------------------------------------------------------
+// Find the result of otc_process for an input in a store.
+//   ok: (output) the result of otc_process
+//   output: (output) if |*ok|, the sanitised font. This points into the store's
+//     mapping of the data file and is valid until the store is closed.
+//   output_length: (output) the length, in bytes, of |*output|
+//   input: the OpenType file
+//   length: the size, in bytes, of |input|
+//   options: the options which would be passed to otc_process. As with
+//     otc_process_cached, these may not ask for a cmap index, coverage or
+//     compact stats.
+// Returns false if the input isn't in the store.
+// -----------------------------------------------------------------------------
+bool otc_store_lookup(OTCStore *store, bool *ok, const uint8_t **output,
+                      size_t *output_length, const uint8_t *input,
+                      size_t length, const OTCOptions &options = OTCOptions());
+
+// -----------------------------------------------------------------------------
+// As otc_process, but the result is looked up in |store| first, and added to
+// it if it isn't there. If |options| asks for a cmap index, coverage or
+// compact stats, the store is bypassed.
+// -----------------------------------------------------------------------------
+bool otc_process_stored(OTCStore *store, OTCStream *output,
+                        const uint8_t *input, size_t length,
+                        const OTCOptions &options = OTCOptions());
+
+// -----------------------------------------------------------------------------
+// Map a code-point to a glyph id in constant time. The 3.10.12 subtable takes
+// precedence, then the 3.1.4 subtable and finally the 3.10.13 (many to one)
+// subtable. (A mapping to .notdef is treated as no mapping, so a code-point
+// which one subtable maps to .notdef may still be mapped by the next.)
+//   index: an index from OTCOptions::cmap_index
+//   code_point: a Unicode code-point
+// Returns the glyph id, or zero (.notdef) if the code-point isn't mapped.
+// -----------------------------------------------------------------------------
+uint16_t otc_cmap_lookup(const OTCCMAPIndex *index, uint32_t code_point);
+
+// -----------------------------------------------------------------------------
+// Map a string of code-points to glyph ids. This is equivalent to calling
+// otc_cmap_lookup on each in turn.
+//   glyphs: (output) an array of |count| glyph ids
+//   index: an index from OTCOptions::cmap_index
+//   code_points: an array of |count| Unicode code-points
+//   count: the number of code-points
+// -----------------------------------------------------------------------------
+void otc_cmap_lookup_batch(uint16_t *glyphs, const OTCCMAPIndex *index,
+                           const uint32_t *code_points, size_t count);
+
+// -----------------------------------------------------------------------------
+// Free an index from OTCOptions::cmap_index.
+// -----------------------------------------------------------------------------
+void otc_cmap_index_free(OTCCMAPIndex *index);
+
 #endif  // OPENTYPE_CONDOM_H_
@@ -0,0 +1,241 @@
+#include <string.h>
+
+#include "otc.h"
+#include "array.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Each function handles as much as it can with SSE2, where available, and
+// then finishes the remaining elements with scalar code. Rather than branching
+// on each element, the vector loops OR together a mask of failures and check
+// it once at the end.
+
+static inline uint16_t
+LoadU16(const uint8_t *src) {
+  uint16_t v;
+  memcpy(&v, src, sizeof(v));
+  return ntohs(v);
+}
+
+static inline uint32_t
+LoadU32(const uint8_t *src) {
+  uint32_t v;
+  memcpy(&v, src, sizeof(v));
+  return ntohl(v);
+}
+
+#if defined(__SSE2__)
+static inline __m128i
+Load128(const uint8_t *src) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+}
+
+static inline void
+Store128(void *dst, __m128i v) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), v);
+}
+
+static inline __m128i
+ByteSwap16(__m128i v) {
+  return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+static inline __m128i
+ByteSwap32(__m128i v) {
+  v = ByteSwap16(v);
+  v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+  return _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+}
+
+static inline bool
+AnySet(__m128i v) {
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xffff;
+}
+#endif
+
+bool
+otc_load_u16_array(uint16_t *dst, const uint8_t *src, size_t count,
+                   uint16_t max_value) {
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i max = _mm_set1_epi16(max_value);
+  __m128i bad = _mm_setzero_si128();
+  for (; i + 8 <= count; i += 8) {
+    const __m128i v = ByteSwap16(Load128(src + i * 2));
+    // Unsigned saturating subtraction is non-zero iff v > max
+    bad = _mm_or_si128(bad, _mm_subs_epu16(v, max));
+    Store128(dst + i, v);
+  }
+  if (AnySet(bad))
+    return false;
+#endif
+
+  for (; i < count; ++i) {
+    dst[i] = LoadU16(src + i * 2);
+    if (dst[i] > max_value)
+      return false;
+  }
+
+  return true;
+}
+
+bool
+otc_load_s16_array(int16_t *dst, const uint8_t *src, size_t count,
+                   int16_t min_value) {
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i min = _mm_set1_epi16(min_value);
+  __m128i bad = _mm_setzero_si128();
+  for (; i + 8 <= count; i += 8) {
+    const __m128i v = ByteSwap16(Load128(src + i * 2));
+    bad = _mm_or_si128(bad, _mm_cmplt_epi16(v, min));
+    Store128(dst + i, v);
+  }
+  if (AnySet(bad))
+    return false;
+#endif
+
+  for (; i < count; ++i) {
+    dst[i] = LoadU16(src + i * 2);
+    if (dst[i] < min_value)
+      return false;
+  }
+
+  return true;
+}
+
+bool
+otc_load_u16_s16_array(uint16_t *dst, const uint8_t *src, size_t count,
+                       uint16_t max_first, int16_t min_second) {
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  // The lanes alternate between the two values of each pair. In the lanes
+  // holding the first value, the signed comparison is against the minimum
+  // int16_t and so never fails. In the lanes holding the second value, the
+  // saturating subtraction is of 0xffff and so is always zero.
+  const __m128i max = _mm_set1_epi32(0xffff0000u | max_first);
+  const __m128i min = _mm_set1_epi32(
+      (static_cast<uint32_t>(static_cast<uint16_t>(min_second)) << 16) | 0x8000);
+  __m128i bad = _mm_setzero_si128();
+  for (; i + 4 <= count; i += 4) {
+    const __m128i v = ByteSwap16(Load128(src + i * 4));
+    bad = _mm_or_si128(bad, _mm_subs_epu16(v, max));
+    bad = _mm_or_si128(bad, _mm_cmplt_epi16(v, min));
+    Store128(dst + i * 2, v);
+  }
+  if (AnySet(bad))
+    return false;
+#endif
+
+  for (; i < count; ++i) {
+    dst[i * 2] = LoadU16(src + i * 4);
+    dst[i * 2 + 1] = LoadU16(src + i * 4 + 2);
+    if (dst[i * 2] > max_first ||
+        static_cast<int16_t>(dst[i * 2 + 1]) < min_second) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool
+otc_load_monotonic_u16_array(uint32_t *dst, const uint8_t *src, size_t count,
+                             unsigned shift) {
+  if (!count)
+    return true;
+
+  dst[0] = static_cast<uint32_t>(LoadU16(src)) << shift;
+  size_t i = 1;
+
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i shift_count = _mm_cvtsi32_si128(shift);
+  __m128i bad = _mm_setzero_si128();
+  for (; i + 8 <= count; i += 8) {
+    // Compare each value with the one before it, which we get with a second,
+    // overlapping load.
+    const __m128i v = ByteSwap16(Load128(src + i * 2));
+    const __m128i prev = ByteSwap16(Load128(src + i * 2 - 2));
+    bad = _mm_or_si128(bad, _mm_subs_epu16(prev, v));
+    Store128(dst + i, _mm_sll_epi32(_mm_unpacklo_epi16(v, zero), shift_count));
+    Store128(dst + i + 4, _mm_sll_epi32(_mm_unpackhi_epi16(v, zero), shift_count));
+  }
+  if (AnySet(bad))
+    return false;
+#endif
+
+  for (; i < count; ++i) {
+    dst[i] = static_cast<uint32_t>(LoadU16(src + i * 2)) << shift;
+    if (dst[i] < dst[i - 1])
+      return false;
+  }
+
+  return true;
+}
+
+bool
+otc_load_monotonic_u32_array(uint32_t *dst, const uint8_t *src,
+                             size_t count) {
+  if (!count)
+    return true;
+
+  dst[0] = LoadU32(src);
+  size_t i = 1;
+
+#if defined(__SSE2__)
+  // SSE2 only has signed comparisons, so we flip the top bits first.
+  const __m128i bias = _mm_set1_epi32(0x80000000);
+  __m128i bad = _mm_setzero_si128();
+  for (; i + 4 <= count; i += 4) {
+    const __m128i v = ByteSwap32(Load128(src + i * 4));
+    const __m128i prev = ByteSwap32(Load128(src + i * 4 - 4));
+    bad = _mm_or_si128(bad, _mm_cmpgt_epi32(_mm_xor_si128(prev, bias),
+                                            _mm_xor_si128(v, bias)));
+    Store128(dst + i, v);
+  }
+  if (AnySet(bad))
+    return false;
+#endif
+
+  for (; i < count; ++i) {
+    dst[i] = LoadU32(src + i * 4);
+    if (dst[i] < dst[i - 1])
+      return false;
+  }
+
+  return true;
+}
+
+uint16_t
+otc_max_u16_array(const uint8_t *src, size_t count) {
+  uint16_t max_value = 0;
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  if (count >= 8) {
+    // SSE2 only has a signed 16-bit maximum, so we flip the top bits first.
+    const __m128i bias = _mm_set1_epi16(-32768);
+    __m128i max = bias;
+    for (; i + 8 <= count; i += 8) {
+      const __m128i v = ByteSwap16(Load128(src + i * 2));
+      max = _mm_max_epi16(max, _mm_xor_si128(v, bias));
+    }
+
+    max = _mm_max_epi16(max, _mm_shuffle_epi32(max, _MM_SHUFFLE(1, 0, 3, 2)));
+    max = _mm_max_epi16(max, _mm_shuffle_epi32(max, _MM_SHUFFLE(2, 3, 0, 1)));
+    max = _mm_max_epi16(max, _mm_srli_epi32(max, 16));
+    max_value = _mm_cvtsi128_si32(max) ^ 0x8000;
+  }
+#endif
+
+  for (; i < count; ++i)
+    max_value = std::max(max_value, LoadU16(src + i * 2));
+
+  return max_value;
+}
@@ -0,0 +1,41 @@
+#ifndef OTC_ARRAY_H_
+#define OTC_ARRAY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// These functions convert arrays of big-endian values from a font into host
+// order, validating them as they go. They don't do any bounds checking on
+// |src|: that's the job of the Buffer methods which call them. Each returns
+// false if any value fails validation, in which case |dst| may have been
+// partially written.
+
+// dst[i] = src[i]. Fails if any value is > |max_value|.
+bool otc_load_u16_array(uint16_t *dst, const uint8_t *src, size_t count,
+                        uint16_t max_value);
+
+// dst[i] = src[i]. Fails if any value is < |min_value|.
+bool otc_load_s16_array(int16_t *dst, const uint8_t *src, size_t count,
+                        int16_t min_value);
+
+// |src| is |count| pairs of (uint16_t, int16_t), which are stored in |dst| in
+// the same order. Fails if the first of any pair is > |max_first| or the
+// second of any pair is < |min_second|.
+bool otc_load_u16_s16_array(uint16_t *dst, const uint8_t *src, size_t count,
+                            uint16_t max_first, int16_t min_second);
+
+// dst[i] = src[i] << shift, where |src| holds 16-bit values. Fails unless the
+// values are monotonically increasing (but not necessarily strictly so).
+bool otc_load_monotonic_u16_array(uint32_t *dst, const uint8_t *src,
+                                  size_t count, unsigned shift);
+
+// dst[i] = src[i]. Fails unless the values are monotonically increasing (but
+// not necessarily strictly so).
+bool otc_load_monotonic_u32_array(uint32_t *dst, const uint8_t *src,
+                                  size_t count);
+
+// Returns the largest of |count| big-endian 16-bit values at |src|, or zero
+// if |count| is zero.
+uint16_t otc_max_u16_array(const uint8_t *src, size_t count);
+
+#endif  // OTC_ARRAY_H_
@@ -0,0 +1,41 @@
+#include "otc.h"
+#include "parallel.h"
+
+// otc_process keeps all of its state in a per-call OpenTypeFile and the
+// per-table structures hanging off it. The only statics in the library are
+// constant (the table of parsers and a few zero-byte padding buffers) so any
+// number of threads can call it at once, as long as they use different output
+// streams. Thus each font is simply an item for otc_parallel_for and all the
+// scratch state for that font lives on the worker's own stack.
+
+namespace {
+
+struct BatchJob {
+  OTCStream *const *outputs;
+  const uint8_t *const *inputs;
+  const size_t *lengths;
+  bool *results;
+};
+
+void
+ProcessOne(void *arg, size_t i) {
+  BatchJob *job = static_cast<BatchJob*>(arg);
+
+  job->results[i] = otc_process(job->outputs[i], job->inputs[i],
+                                job->lengths[i]);
+}
+
+}  // anonymous namespace
+
+void
+otc_process_batch(OTCStream *const *outputs, const uint8_t *const *inputs,
+                  const size_t *lengths, bool *results, size_t count,
+                  unsigned num_threads) {
+  BatchJob job;
+  job.outputs = outputs;
+  job.inputs = inputs;
+  job.lengths = lengths;
+  job.results = results;
+
+  otc_parallel_for(count, num_threads, ProcessOne, &job);
+}
@@ -0,0 +1,264 @@
+#include <pthread.h>
+
+#include <map>
+#include <vector>
+
+#include "otc.h"
+#include "cache.h"
+
+// The cache is split into shards, each with its own lock, LRU list and share
+// of the size limit, so that threads looking up different fonts rarely
+// contend. A lookup only holds its shard's lock while finding the entry and
+// taking a reference to it: the output is written to the caller's stream
+// afterwards, so a slow stream doesn't hold up anyone else. An entry which is
+// evicted while it's being written is freed by the last reader.
+
+namespace {
+
+const unsigned kMaxShards = 16;
+// A cache is only split into shards of at least this size, so that a small
+// cache can still hold a few large fonts.
+const size_t kMinShardBytes = 4 * 1024 * 1024;
+// The bytes charged for an entry on top of its output: the entry itself and
+// its node in the map.
+const size_t kEntryOverhead = 128;
+
+struct CacheShard {
+  pthread_mutex_t lock;
+  std::map<OTCHash, OTCCacheEntry*> entries;
+  OTCCacheEntry *head;  // most recently used
+  OTCCacheEntry *tail;  // least recently used
+  size_t bytes;
+  size_t max_bytes;
+  OTCCacheStats stats;
+};
+
+void
+Unlink(CacheShard *shard, OTCCacheEntry *entry) {
+  if (entry->prev) {
+    entry->prev->next = entry->next;
+  } else {
+    shard->head = entry->next;
+  }
+  if (entry->next) {
+    entry->next->prev = entry->prev;
+  } else {
+    shard->tail = entry->prev;
+  }
+  entry->prev = entry->next = NULL;
+}
+
+void
+PushFront(CacheShard *shard, OTCCacheEntry *entry) {
+  entry->prev = NULL;
+  entry->next = shard->head;
+  if (shard->head) {
+    shard->head->prev = entry;
+  } else {
+    shard->tail = entry;
+  }
+  shard->head = entry;
+}
+
+// Remove |entry| from |shard|. It's freed now if nobody is using it, or
+// otherwise by the last caller to release it. Must be called with the lock
+// held.
+void
+Evict(CacheShard *shard, OTCCacheEntry *entry) {
+  Unlink(shard, entry);
+  shard->entries.erase(entry->key);
+  shard->bytes -= entry->cost;
+  shard->stats.evictions++;
+  if (entry->refs) {
+    entry->evicted = true;
+  } else {
+    delete entry;
+  }
+}
+
+}  // anonymous namespace
+
+struct OTCCache {
+  uint8_t hash_key[16];
+  unsigned num_shards;
+  CacheShard shards[kMaxShards];
+};
+
+OTCCache *
+otc_cache_new(size_t max_bytes) {
+  OTCCache *cache = new OTCCache;
+  if (!otc_hash_key(cache->hash_key)) {
+    delete cache;
+    return NULL;
+  }
+
+  cache->num_shards = 1;
+  while (cache->num_shards < kMaxShards &&
+         max_bytes / (cache->num_shards * 2) >= kMinShardBytes) {
+    cache->num_shards *= 2;
+  }
+
+  for (unsigned i = 0; i < cache->num_shards; ++i) {
+    CacheShard *shard = &cache->shards[i];
+    pthread_mutex_init(&shard->lock, NULL);
+    shard->head = shard->tail = NULL;
+    shard->bytes = 0;
+    shard->max_bytes = max_bytes / cache->num_shards;
+  }
+
+  return cache;
+}
+
+void
+otc_cache_free(OTCCache *cache) {
+  for (unsigned i = 0; i < cache->num_shards; ++i) {
+    CacheShard *shard = &cache->shards[i];
+    for (OTCCacheEntry *entry = shard->head; entry; ) {
+      OTCCacheEntry *next = entry->next;
+      delete entry;
+      entry = next;
+    }
+    pthread_mutex_destroy(&shard->lock);
+  }
+  delete cache;
+}
+
+const uint8_t *
+otc_cache_hash_key(const OTCCache *cache) {
+  return cache->hash_key;
+}
+
+OTCCacheEntry *
+otc_cache_acquire(OTCCache *cache, const OTCHash &key) {
+  CacheShard *shard = &cache->shards[key.words[1] % cache->num_shards];
+
+  pthread_mutex_lock(&shard->lock);
+  const std::map<OTCHash, OTCCacheEntry*>::const_iterator
+      it = shard->entries.find(key);
+  if (it == shard->entries.end()) {
+    shard->stats.misses++;
+    pthread_mutex_unlock(&shard->lock);
+    return NULL;
+  }
+
+  OTCCacheEntry *entry = it->second;
+  Unlink(shard, entry);
+  PushFront(shard, entry);
+  shard->stats.hits++;
+  if (!entry->ok)
+    shard->stats.negative_hits++;
+  entry->refs++;
+  pthread_mutex_unlock(&shard->lock);
+
+  return entry;
+}
+
+void
+otc_cache_release(OTCCache *cache, OTCCacheEntry *entry) {
+  CacheShard *shard = &cache->shards[entry->key.words[1] % cache->num_shards];
+
+  pthread_mutex_lock(&shard->lock);
+  entry->refs--;
+  const bool free_entry = !entry->refs && entry->evicted;
+  pthread_mutex_unlock(&shard->lock);
+
+  if (free_entry)
+    delete entry;
+}
+
+OTCCacheEntry *
+otc_cache_entry_new(const OTCHash &key) {
+  OTCCacheEntry *entry = new OTCCacheEntry;
+  entry->key = key;
+  entry->ok = false;
+  entry->chksum = 0;
+  entry->cost = 0;
+  entry->refs = 0;
+  entry->evicted = false;
+  entry->prev = entry->next = NULL;
+  return entry;
+}
+
+OTCCacheEntry *
+otc_cache_insert(OTCCache *cache, OTCCacheEntry *entry) {
+  CacheShard *shard = &cache->shards[entry->key.words[1] % cache->num_shards];
+  entry->cost = entry->output.size() + kEntryOverhead;
+  entry->refs = 1;
+
+  pthread_mutex_lock(&shard->lock);
+  // Another thread may have added the same input in the meantime, in which
+  // case its entry is kept.
+  const std::map<OTCHash, OTCCacheEntry*>::const_iterator
+      it = shard->entries.find(entry->key);
+  if (it != shard->entries.end()) {
+    OTCCacheEntry *existing = it->second;
+    existing->refs++;
+    pthread_mutex_unlock(&shard->lock);
+    delete entry;
+    return existing;
+  }
+
+  if (entry->cost > shard->max_bytes) {
+    // Only the caller's reference keeps it alive.
+    entry->evicted = true;
+  } else {
+    while (shard->bytes + entry->cost > shard->max_bytes)
+      Evict(shard, shard->tail);
+    shard->entries[entry->key] = entry;
+    PushFront(shard, entry);
+    shard->bytes += entry->cost;
+  }
+  pthread_mutex_unlock(&shard->lock);
+
+  return entry;
+}
+
+bool
+otc_process_cached(OTCCache *cache, OTCStream *output, const uint8_t *data,
+                   size_t length, const OTCOptions &options) {
+  if (!otc_hash_cacheable(options))
+    return otc_process(output, data, length, options);
+
+  OTCHash key;
+  otc_hash_request(&key, cache->hash_key, data, length, options);
+
+  OTCCacheEntry *entry = otc_cache_acquire(cache, key);
+  if (!entry) {
+    // The font is sanitised into memory, rather than straight to |output|, so
+    // that a failure is certainly a rejection and not an error from the
+    // stream.
+    entry = otc_cache_entry_new(key);
+    VectorStream stream(&entry->output);
+    entry->ok = otc_process(&stream, data, length, options);
+    if (!entry->ok)
+      entry->output.clear();
+    entry = otc_cache_insert(cache, entry);
+  }
+
+  // The output is written without holding any lock, so a slow stream doesn't
+  // hold up other threads.
+  const bool result =
+      entry->ok &&
+      (entry->output.empty() ||
+       output->Write(&entry->output[0], entry->output.size())) &&
+      output->Flush();
+  otc_cache_release(cache, entry);
+
+  return result;
+}
+
+void
+otc_cache_stats(OTCCache *cache, OTCCacheStats *stats) {
+  *stats = OTCCacheStats();
+  for (unsigned i = 0; i < cache->num_shards; ++i) {
+    CacheShard *shard = &cache->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    stats->hits += shard->stats.hits;
+    stats->negative_hits += shard->stats.negative_hits;
+    stats->misses += shard->stats.misses;
+    stats->evictions += shard->stats.evictions;
+    stats->entries += shard->entries.size();
+    stats->bytes += shard->bytes;
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef OTC_CACHE_H_
+#define OTC_CACHE_H_
+
+#include <vector>
+
+#include "hash.h"
+
+// An entry in an OTCCache: either a whole font (see otc_process_cached) or a
+// single table (see OTCOptions::table_memo).
+struct OTCCacheEntry {
+  OTCHash key;
+  bool ok;  // false if the input was rejected
+  std::vector<uint8_t> output;
+  // For a table, the sum of the whole big-endian words of |output|
+  uint32_t chksum;
+
+  // The remaining fields belong to the cache.
+  size_t cost;
+  unsigned refs;  // the number of callers using |output|
+  bool evicted;
+  // The LRU list of the shard, most recently used first
+  OTCCacheEntry *prev;
+  OTCCacheEntry *next;
+};
+
+// Return the key which |cache| hashes its inputs with
+const uint8_t *otc_cache_hash_key(const OTCCache *cache);
+
+// Find |key| in |cache|, counting a hit or a miss. If it's found, a reference
+// is taken, so the entry isn't freed until it's released with
+// otc_cache_release, even if it's evicted in the meantime.
+OTCCacheEntry *otc_cache_acquire(OTCCache *cache, const OTCHash &key);
+
+void otc_cache_release(OTCCache *cache, OTCCacheEntry *entry);
+
+// Return a new entry for |key|, ready to be filled in and added with
+// otc_cache_insert.
+OTCCacheEntry *otc_cache_entry_new(const OTCHash &key);
+
+// Add |entry| to |cache|, which takes ownership of it, and return it with a
+// reference held. If another thread has already added the same key, |entry|
+// is freed and the existing entry is returned instead. If |entry| is too large
+// for the cache it's kept alive by the reference alone.
+OTCCacheEntry *otc_cache_insert(OTCCache *cache, OTCCacheEntry *entry);
+
+#endif  // OTC_CACHE_H_
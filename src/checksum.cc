@@ -0,0 +1,141 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "otc.h"
+#include "checksum.h"
+
+#if defined(OTC_CHECKSUM_X86)
+#include <immintrin.h>
+#endif
+
+uint32_t
+otc_checksum_words_scalar(const uint8_t *data, size_t num_words) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < num_words; ++i) {
+    uint32_t word;
+    memcpy(&word, data + i * 4, sizeof(word));
+    sum += ntohl(word);
+  }
+  return sum;
+}
+
+#if defined(OTC_CHECKSUM_X86)
+
+// Since addition modulo 2^32 is associative, we can keep a number of partial
+// sums in the lanes of a vector register and add them together at the end.
+// The only complication is that each word needs to be byte-swapped first.
+
+__attribute__((target("sse2")))
+static inline __m128i
+ByteSwapWords128(__m128i v) {
+  // SSE2 doesn't have a byte shuffle, so we swap the bytes of each 16-bit
+  // value and then swap the 16-bit halves of each 32-bit value.
+  v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+  v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+  return _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+}
+
+__attribute__((target("sse2")))
+static inline uint32_t
+HorizontalSum128(__m128i v) {
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(v);
+}
+
+__attribute__((target("sse2")))
+uint32_t
+otc_checksum_words_sse2(const uint8_t *data, size_t num_words) {
+  __m128i sum0 = _mm_setzero_si128();
+  __m128i sum1 = _mm_setzero_si128();
+  size_t i = 0;
+
+  for (; i + 8 <= num_words; i += 8) {
+    const __m128i a =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 4));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 4 + 16));
+    sum0 = _mm_add_epi32(sum0, ByteSwapWords128(a));
+    sum1 = _mm_add_epi32(sum1, ByteSwapWords128(b));
+  }
+
+  const uint32_t sum = HorizontalSum128(_mm_add_epi32(sum0, sum1));
+  return sum + otc_checksum_words_scalar(data + i * 4, num_words - i);
+}
+
+__attribute__((target("avx2")))
+uint32_t
+otc_checksum_words_avx2(const uint8_t *data, size_t num_words) {
+  const __m256i bswap = _mm256_setr_epi8(
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  __m256i sum0 = _mm256_setzero_si256();
+  __m256i sum1 = _mm256_setzero_si256();
+  __m256i sum2 = _mm256_setzero_si256();
+  __m256i sum3 = _mm256_setzero_si256();
+  size_t i = 0;
+
+  for (; i + 32 <= num_words; i += 32) {
+    const __m256i *p = reinterpret_cast<const __m256i*>(data + i * 4);
+    sum0 = _mm256_add_epi32(sum0, _mm256_shuffle_epi8(_mm256_loadu_si256(p), bswap));
+    sum1 = _mm256_add_epi32(sum1, _mm256_shuffle_epi8(_mm256_loadu_si256(p + 1), bswap));
+    sum2 = _mm256_add_epi32(sum2, _mm256_shuffle_epi8(_mm256_loadu_si256(p + 2), bswap));
+    sum3 = _mm256_add_epi32(sum3, _mm256_shuffle_epi8(_mm256_loadu_si256(p + 3), bswap));
+  }
+
+  for (; i + 8 <= num_words; i += 8) {
+    const __m256i *p = reinterpret_cast<const __m256i*>(data + i * 4);
+    sum0 = _mm256_add_epi32(sum0, _mm256_shuffle_epi8(_mm256_loadu_si256(p), bswap));
+  }
+
+  const __m256i sum = _mm256_add_epi32(_mm256_add_epi32(sum0, sum1),
+                                       _mm256_add_epi32(sum2, sum3));
+  const __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum),
+                                       _mm256_extracti128_si256(sum, 1));
+  return HorizontalSum128(sum128) +
+         otc_checksum_words_scalar(data + i * 4, num_words - i);
+}
+
+bool
+otc_cpu_has_sse2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse2");
+}
+
+bool
+otc_cpu_has_avx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+#endif  // OTC_CHECKSUM_X86
+
+typedef uint32_t (*ChecksumKernel) (const uint8_t *data, size_t num_words);
+
+static ChecksumKernel
+ChooseChecksumKernel() {
+#if defined(OTC_CHECKSUM_X86)
+  if (otc_cpu_has_avx2())
+    return otc_checksum_words_avx2;
+  if (otc_cpu_has_sse2())
+    return otc_checksum_words_sse2;
+#endif
+  return otc_checksum_words_scalar;
+}
+
+// This is chosen the first time it's needed, rather than by a static
+// initialiser, which might run after another translation unit's has already
+// checksummed something.
+static ChecksumKernel checksum_kernel;
+static pthread_once_t checksum_kernel_once = PTHREAD_ONCE_INIT;
+
+static void
+InitChecksumKernel() {
+  checksum_kernel = ChooseChecksumKernel();
+}
+
+uint32_t
+otc_checksum_words(const uint8_t *data, size_t num_words) {
+  pthread_once(&checksum_kernel_once, InitChecksumKernel);
+  return checksum_kernel(data, num_words);
+}
@@ -0,0 +1,24 @@
+#ifndef OTC_CHECKSUM_H_
+#define OTC_CHECKSUM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Each of these returns the sum, modulo 2^32, of |num_words| big-endian 32-bit
+// words starting at |data|, which needn't be aligned. otc_checksum_words (in
+// opentype-condom.h) picks the fastest one which the CPU supports. They are
+// exposed separately for testing and benchmarking.
+
+uint32_t otc_checksum_words_scalar(const uint8_t *data, size_t num_words);
+
+#if defined(__i386__) || defined(__x86_64__)
+#define OTC_CHECKSUM_X86
+
+uint32_t otc_checksum_words_sse2(const uint8_t *data, size_t num_words);
+uint32_t otc_checksum_words_avx2(const uint8_t *data, size_t num_words);
+
+bool otc_cpu_has_sse2();
+bool otc_cpu_has_avx2();
+#endif
+
+#endif  // OTC_CHECKSUM_H_
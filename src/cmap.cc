@@ -1,8 +1,11 @@
+#include <algorithm>
 #include <vector>
 
 #include "otc.h"
 #include "cmap.h"
 #include "maxp.h"
+#include "subset.h"
+#include "compact.h"
 
 struct CMAPSubtableHeader {
   uint16_t platform;
@@ -53,9 +56,9 @@ parse_314(OpenTypeFile *file, const uint8_t *data, size_t length, uint16_t num_g
   if (segcount < 1)
     return failure();
 
-  // log2segcount is the maximal x s.t. 2^x < segcount
+  // log2segcount is the maximal x s.t. 2^x <= segcount
   unsigned log2segcount = 0;
-  while (1u << (log2segcount + 1) < segcount)
+  while (1u << (log2segcount + 1) <= segcount)
     log2segcount++;
 
   const uint16_t expected_search_range = 2 * 1 << log2segcount;
@@ -69,12 +72,13 @@ parse_314(OpenTypeFile *file, const uint8_t *data, size_t length, uint16_t num_g
   if (range_shift != expected_range_shift)
     return failure();
 
-  std::vector<Subtable314Range> ranges(segcount);
+  std::vector<uint16_t> end_codes(segcount);
+  std::vector<uint16_t> start_codes(segcount);
+  std::vector<int16_t> id_deltas(segcount);
+  std::vector<uint16_t> id_range_offsets(segcount);
 
-  for (unsigned i = 0; i < segcount; ++i) {
-    if (!subtable.ReadU16(&ranges[i].end_range))
-      return failure();
-  }
+  if (!subtable.ReadU16Array(&end_codes[0], segcount))
+    return failure();
 
   uint16_t padding;
   if (!subtable.ReadU16(&padding))
@@ -82,18 +86,21 @@ parse_314(OpenTypeFile *file, const uint8_t *data, size_t length, uint16_t num_g
   if (padding)
     return failure();
 
-  for (unsigned i = 0; i < segcount; ++i) {
-    if (!subtable.ReadU16(&ranges[i].start_range))
-      return failure();
-  }
-  for (unsigned i = 0; i < segcount; ++i) {
-    if (!subtable.ReadS16(&ranges[i].id_delta))
-      return failure();
+  if (!subtable.ReadU16Array(&start_codes[0], segcount) ||
+      !subtable.ReadS16Array(&id_deltas[0], segcount)) {
+    return failure();
   }
+  const size_t id_range_offsets_offset = subtable.offset();
+  if (!subtable.ReadU16Array(&id_range_offsets[0], segcount))
+    return failure();
+
+  std::vector<Subtable314Range> ranges(segcount);
   for (unsigned i = 0; i < segcount; ++i) {
-    ranges[i].id_range_offset_offset = subtable.offset();
-    if (!subtable.ReadU16(&ranges[i].id_range_offset))
-      return failure();
+    ranges[i].end_range = end_codes[i];
+    ranges[i].start_range = start_codes[i];
+    ranges[i].id_delta = id_deltas[i];
+    ranges[i].id_range_offset = id_range_offsets[i];
+    ranges[i].id_range_offset_offset = id_range_offsets_offset + i * 2;
     if (ranges[i].id_range_offset & 1)
       return failure();
   }
@@ -111,32 +118,40 @@ parse_314(OpenTypeFile *file, const uint8_t *data, size_t length, uint16_t num_g
   if (ranges[segcount - 1].end_range != 0xffff)
     return failure();
 
-  // A format 4 CMAP subtable is complex. To be safe we simulate a lookup of
-  // each code-point defined in the table and make sure that they are all valid
-  // glyphs and that we don't access anything out-of-bounds.
-  for (unsigned i = 1; i < segcount; ++i) {
-    for (unsigned cp = ranges[i].start_range; cp <= ranges[i].end_range; ++cp) {
-      const uint16_t code_point = cp;
-      if (ranges[i].id_range_offset == 0) {
-        // this is explictly allowed to overflow in the spec
-        const uint16_t glyph = code_point + ranges[i].id_delta;
-        if (glyph >= num_glyphs)
-          return failure();
-      } else {
-        const uint16_t range_delta = code_point - ranges[i].start_range;
-        // this might seem odd, but it's true. The offset is relative to the
-        // location of the offset value itself.
-        const uint32_t glyph_id_offset = ranges[i].id_range_offset_offset +
-                                         ranges[i].id_range_offset +
-                                         range_delta * 2;
-        // We need to be able to access a 16-bit value from this offset
-        if (glyph_id_offset + 1 >= length)
-          return failure();
-        uint16_t glyph;
-        memcpy(&glyph, data + glyph_id_offset, 2);
-        glyph = ntohs(glyph);
-        if (glyph >= num_glyphs)
-          return failure();
+  // A format 4 CMAP subtable is complex. We need to make sure that every
+  // code-point in the table maps to a valid glyph and that no lookup accesses
+  // anything out-of-bounds. Rather than simulating a lookup of each
+  // code-point, we check each segment as a whole.
+  for (unsigned i = 0; i < segcount; ++i) {
+    if (ranges[i].start_range > ranges[i].end_range)
+      return failure();
+    const unsigned num_code_points =
+        ranges[i].end_range - ranges[i].start_range + 1;
+
+    if (ranges[i].id_range_offset == 0) {
+      // The glyph for each code-point is code_point + id_delta, which is
+      // explictly allowed to overflow in the spec. Thus the glyphs are a
+      // contiguous run, modulo 65536, starting at the glyph for start_range.
+      // Since num_glyphs <= 65535, a run which wraps around can never be
+      // entirely valid and it's sufficient to check that the last glyph of the
+      // run, without wrapping, is in range.
+      const unsigned first_glyph =
+          static_cast<uint16_t>(ranges[i].start_range + ranges[i].id_delta);
+      if (first_glyph + num_code_points - 1 >= num_glyphs)
+        return failure();
+    } else {
+      // this might seem odd, but it's true. The offset is relative to the
+      // location of the offset value itself.
+      const uint32_t glyph_id_offset = ranges[i].id_range_offset_offset +
+                                       ranges[i].id_range_offset;
+      // We need to be able to access a 16-bit value for every code-point
+      if (glyph_id_offset > length ||
+          num_code_points * 2 > length - glyph_id_offset) {
+        return failure();
+      }
+      if (otc_max_u16_array(data + glyph_id_offset, num_code_points) >=
+          num_glyphs) {
+        return failure();
       }
     }
   }
@@ -144,6 +159,9 @@ parse_314(OpenTypeFile *file, const uint8_t *data, size_t length, uint16_t num_g
   // We accept the table.
   file->cmap->subtable_314_data = data;
   file->cmap->subtable_314_length = length;
+  file->cmap->subtable_314_chksummed = true;
+  file->cmap->subtable_314_chksum =
+      length >= 4 ? otc_checksum_words(data, length / 4) : 0;
 
   return true;
 }
@@ -192,10 +210,15 @@ parse_31012(OpenTypeFile *file, const uint8_t *data, size_t length, uint16_t num
       return failure();
     }
 
+    if (groups[i].start_range > groups[i].end_range)
+      return failure();
+
     // Also we assert that the glyph value is within range. Because the range
     // limits, above, we don't need to worry about overflow.
-    if (groups[i].end_range + groups[i].start_glyph_id > num_glyphs)
+    if (groups[i].start_glyph_id +
+        (groups[i].end_range - groups[i].start_range) >= num_glyphs) {
       return failure();
+    }
   }
 
   // the groups must be sorted by start code and may not overlap
@@ -217,8 +240,8 @@ parse_31013(OpenTypeFile *file, const uint8_t *data, size_t length, uint16_t num
   // later.
 
   subtable.Skip(8);
-  uint16_t language;
-  if (!subtable.ReadU16(&language))
+  uint32_t language;
+  if (!subtable.ReadU32(&language))
     return failure();
   if (language)
     return failure();
@@ -251,6 +274,9 @@ parse_31013(OpenTypeFile *file, const uint8_t *data, size_t length, uint16_t num
       return failure();
     }
 
+    if (groups[i].start_range > groups[i].end_range)
+      return failure();
+
     if (groups[i].start_glyph_id >= num_glyphs)
       return failure();
   }
@@ -392,29 +418,67 @@ otc_cmap_serialise(OTCStream *out, OpenTypeFile *file) {
   const unsigned num_subtables = static_cast<unsigned>(have_314) +
                                  static_cast<unsigned>(have_31012) +
                                  static_cast<unsigned>(have_31013);
-  const off_t table_start = out->Tell();
+
+  // The size of each subtable is known in advance, so we can calculate the
+  // offsets and write the table strictly in order. (This means that the
+  // output stream never needs to seek backwards.)
+  uint32_t offset = 4 + num_subtables * 8;
+  const uint32_t offset_314 = offset;
+  if (have_314)
+    offset += file->cmap->subtable_314_length;
+  const uint32_t offset_31012 = offset;
+  if (have_31012)
+    offset += 16 + file->cmap->subtable_31012.size() * 12;
+  const uint32_t offset_31013 = offset;
 
   if (!out->WriteU16(0) ||
       !out->WriteU16(num_subtables)) {
     return failure();
   }
 
-  const off_t record_offset = out->Tell();
-  out->Pad(num_subtables * 8);
-
-  const off_t offset_314 = out->Tell();
   if (have_314) {
+    if (!out->WriteU16(3) ||
+        !out->WriteU16(1) ||
+        !out->WriteU32(offset_314)) {
+      return failure();
+    }
+  }
+
+  if (have_31012) {
+    if (!out->WriteU16(3) ||
+        !out->WriteU16(10) ||
+        !out->WriteU32(offset_31012)) {
+      return failure();
+    }
+  }
+
+  if (have_31013) {
+    if (!out->WriteU16(3) ||
+        !out->WriteU16(10) ||
+        !out->WriteU32(offset_31013)) {
+      return failure();
+    }
+  }
+
+  // The 3.1.4 subtable starts on a word boundary, so a checksum of it which
+  // was found while parsing can be used.
+  if (have_314 && file->cmap->subtable_314_chksummed) {
+    if (!out->WriteWithChecksum(file->cmap->subtable_314_data,
+                                file->cmap->subtable_314_length,
+                                file->cmap->subtable_314_chksum)) {
+      return failure();
+    }
+  } else if (have_314) {
     if (!out->Write(file->cmap->subtable_314_data, file->cmap->subtable_314_length))
       return failure();
   }
 
-  const off_t offset_31012 = out->Tell();
   if (have_31012) {
     std::vector<OpenTypeCMAPSubtableRange> &groups = file->cmap->subtable_31012;
     const unsigned num_groups = groups.size();
     if (!out->WriteU16(12) ||
         !out->WriteU16(0) ||
-        !out->WriteU32(num_groups * 12 + 14) ||
+        !out->WriteU32(num_groups * 12 + 16) ||
         !out->WriteU32(0) ||
         !out->WriteU32(num_groups)) {
       return failure();
@@ -429,13 +493,12 @@ otc_cmap_serialise(OTCStream *out, OpenTypeFile *file) {
     }
   }
 
-  const off_t offset_31013 = out->Tell();
   if (have_31013) {
     std::vector<OpenTypeCMAPSubtableRange> &groups = file->cmap->subtable_31013;
     const unsigned num_groups = groups.size();
     if (!out->WriteU16(13) ||
         !out->WriteU16(0) ||
-        !out->WriteU32(num_groups * 12 + 14) ||
+        !out->WriteU32(num_groups * 12 + 16) ||
         !out->WriteU32(0) ||
         !out->WriteU32(num_groups)) {
       return failure();
@@ -450,44 +513,547 @@ otc_cmap_serialise(OTCStream *out, OpenTypeFile *file) {
     }
   }
 
-  const off_t table_end = out->Tell();
-  // We might have hanging bytes from the above's checksum which the OTCStream
-  // then merges into the table of offsets.
-  OTCStream::ChecksumState saved_checksum = out->SaveChecksumState();
-  out->ResetChecksum();
+  return true;
+}
+
+void
+otc_cmap_free(OpenTypeFile *file) {
+  delete file->cmap;
+}
+
+// Code-points are indexed in pages of this many entries
+static const unsigned kCMAPIndexPageBits = 8;
+static const unsigned kCMAPIndexPageSize = 1 << kCMAPIndexPageBits;
+// One more than the largest Unicode code-point
+static const uint32_t kCMAPIndexMaxCodePoint = 0x110000;
+static const unsigned kCMAPIndexNumPages =
+    kCMAPIndexMaxCodePoint >> kCMAPIndexPageBits;
+
+// A two-level page table. Pages without any mapped code-points all share the
+// page of zeros at the start of |glyphs|.
+struct OTCCMAPIndex {
+  OTCCMAPIndex()
+      : glyphs(kCMAPIndexPageSize) {
+    std::fill(pages, pages + kCMAPIndexNumPages, 0);
+  }
 
-  // Now seek back and write the table of offsets
-  out->Seek(record_offset);
-  if (have_314) {
-    if (!out->WriteU16(3) ||
-        !out->WriteU16(1) ||
-        !out->WriteU32(offset_314 - table_start)) {
-      return failure();
+  // Since a mapping to glyph zero (.notdef) is the same as no mapping at all,
+  // these are ignored rather than replacing earlier mappings.
+  void Map(uint32_t code_point, uint16_t glyph) {
+    if (code_point >= kCMAPIndexMaxCodePoint || !glyph)
+      return;
+    const unsigned page = code_point >> kCMAPIndexPageBits;
+    if (!pages[page]) {
+      pages[page] = glyphs.size();
+      glyphs.resize(glyphs.size() + kCMAPIndexPageSize);
     }
+    glyphs[pages[page] + (code_point & (kCMAPIndexPageSize - 1))] = glyph;
   }
 
-  if (have_31012) {
-    if (!out->WriteU16(3) ||
-        !out->WriteU16(10) ||
-        !out->WriteU32(offset_31012 - table_start)) {
-      return failure();
+  // The offset of each page in |glyphs|
+  uint32_t pages[kCMAPIndexNumPages];
+  std::vector<uint16_t> glyphs;
+};
+
+// Call |visitor->Map(code_point, glyph)| for every code-point which a 3.1.4
+// subtable maps to a glyph other than zero, in order.
+template<typename T>
+static void
+visit_314(T *visitor, const uint8_t *data, size_t length, uint16_t num_glyphs) {
+  // This subtable has already been validated by parse_314, so we only need to
+  // extract the mappings. The reads are still checked, so that a subtable
+  // which somehow wasn't is simply ignored.
+  Buffer subtable(data, length);
+  uint16_t segcountx2;
+  if (!subtable.Skip(6) ||
+      !subtable.ReadU16(&segcountx2) ||
+      !subtable.Skip(6)) {
+    return;
+  }
+  const uint16_t segcount = segcountx2 >> 1;
+  if (!segcount)
+    return;
+
+  std::vector<uint16_t> end_codes(segcount);
+  std::vector<uint16_t> start_codes(segcount);
+  std::vector<int16_t> id_deltas(segcount);
+  std::vector<uint16_t> id_range_offsets(segcount);
+  if (!subtable.ReadU16Array(&end_codes[0], segcount) ||
+      !subtable.Skip(2) ||
+      !subtable.ReadU16Array(&start_codes[0], segcount) ||
+      !subtable.ReadS16Array(&id_deltas[0], segcount)) {
+    return;
+  }
+  const size_t id_range_offsets_offset = subtable.offset();
+  if (!subtable.ReadU16Array(&id_range_offsets[0], segcount))
+    return;
+
+  for (unsigned i = 0; i < segcount; ++i) {
+    const uint8_t *glyph_ids = data + id_range_offsets_offset + i * 2 +
+                               id_range_offsets[i];
+    for (unsigned cp = start_codes[i]; cp <= end_codes[i]; ++cp) {
+      uint16_t glyph;
+      if (id_range_offsets[i] == 0) {
+        glyph = cp + id_deltas[i];
+      } else {
+        const unsigned j = cp - start_codes[i];
+        glyph = glyph_ids[j * 2] << 8 | glyph_ids[j * 2 + 1];
+        if (glyph)
+          glyph += id_deltas[i];
+      }
+      // parse_314 only checks the values in the glyph id array, before the
+      // delta is added, so we need to check the final glyph here.
+      if (glyph && glyph < num_glyphs)
+        visitor->Map(cp, glyph);
     }
   }
+}
 
-  if (have_31013) {
-    if (!out->WriteU16(3) ||
-        !out->WriteU16(10) ||
-        !out->WriteU32(offset_31013 - table_start)) {
-      return failure();
+static void
+index_groups(OTCCMAPIndex *index,
+             const std::vector<OpenTypeCMAPSubtableRange> &groups,
+             bool many_to_one) {
+  for (unsigned i = 0; i < groups.size(); ++i) {
+    // The parser limits the ranges to 2^30, but there are no code-points
+    // beyond kCMAPIndexMaxCodePoint.
+    const uint32_t end = std::min(groups[i].end_range,
+                                  kCMAPIndexMaxCodePoint - 1);
+    for (uint32_t cp = groups[i].start_range; cp <= end; ++cp) {
+      uint16_t glyph = groups[i].start_glyph_id;
+      if (!many_to_one)
+        glyph += cp - groups[i].start_range;
+      index->Map(cp, glyph);
     }
   }
+}
 
-  out->Seek(table_end);
-  out->RestoreChecksum(saved_checksum);
-  return true;
+OTCCMAPIndex *
+otc_cmap_build_index(OpenTypeFile *file) {
+  OTCCMAPIndex *index = new OTCCMAPIndex;
+
+  // Later mappings replace earlier ones, so the subtables are added in
+  // reverse order of precedence.
+  index_groups(index, file->cmap->subtable_31013, true);
+  if (file->cmap->subtable_314_data) {
+    visit_314(index, file->cmap->subtable_314_data,
+              file->cmap->subtable_314_length, file->maxp->num_glyphs);
+  }
+  index_groups(index, file->cmap->subtable_31012, false);
+
+  return index;
+}
+
+uint16_t
+otc_cmap_lookup(const OTCCMAPIndex *index, uint32_t code_point) {
+  if (code_point >= kCMAPIndexMaxCodePoint)
+    return 0;
+  return index->glyphs[index->pages[code_point >> kCMAPIndexPageBits] +
+                       (code_point & (kCMAPIndexPageSize - 1))];
 }
 
 void
-otc_cmap_free(OpenTypeFile *file) {
-  delete file->cmap;
+otc_cmap_lookup_batch(uint16_t *glyphs, const OTCCMAPIndex *index,
+                      const uint32_t *code_points, size_t count) {
+  const uint32_t *const pages = index->pages;
+  const uint16_t *const page_data = &index->glyphs[0];
+
+  for (size_t i = 0; i < count; ++i) {
+    const uint32_t code_point = code_points[i];
+    if (code_point >= kCMAPIndexMaxCodePoint) {
+      glyphs[i] = 0;
+      continue;
+    }
+    glyphs[i] = page_data[pages[code_point >> kCMAPIndexPageBits] +
+                          (code_point & (kCMAPIndexPageSize - 1))];
+  }
+}
+
+void
+otc_cmap_index_free(OTCCMAPIndex *index) {
+  delete index;
+}
+
+// Collects the code-points passed to Map as a list of ranges
+class CoverageBuilder {
+ public:
+  CoverageBuilder(std::vector<OTCCodePointRange> *ranges)
+      : ranges_(ranges) {
+  }
+
+  void Map(uint32_t code_point, uint16_t glyph) {
+    AddRange(code_point, code_point);
+  }
+
+  void AddRange(uint32_t start, uint32_t end) {
+    if (start > end || start >= kCMAPIndexMaxCodePoint)
+      return;
+    end = std::min(end, kCMAPIndexMaxCodePoint - 1);
+    if (ranges_->size() && ranges_->back().end + 1 == start) {
+      ranges_->back().end = end;
+    } else {
+      OTCCodePointRange range;
+      range.start = start;
+      range.end = end;
+      ranges_->push_back(range);
+    }
+  }
+
+ private:
+  std::vector<OTCCodePointRange> *const ranges_;
+};
+
+static bool
+RangeStartLessThan(const OTCCodePointRange &a, const OTCCodePointRange &b) {
+  return a.start < b.start;
+}
+
+void
+otc_cmap_coverage(OpenTypeFile *file, OTCCoverage *coverage) {
+  std::vector<OTCCodePointRange> &ranges = coverage->ranges;
+  ranges.clear();
+
+  // Each subtable gives a sorted list of ranges. We concatenate them, sort and
+  // then merge any which overlap or touch.
+  CoverageBuilder builder(&ranges);
+  if (file->cmap->subtable_314_data) {
+    visit_314(&builder, file->cmap->subtable_314_data,
+              file->cmap->subtable_314_length, file->maxp->num_glyphs);
+  }
+  const std::vector<OpenTypeCMAPSubtableRange> &groups_12 =
+      file->cmap->subtable_31012;
+  for (unsigned i = 0; i < groups_12.size(); ++i) {
+    // Only the first code-point of a group can map to glyph zero
+    const uint32_t start = groups_12[i].start_range +
+                           (groups_12[i].start_glyph_id == 0);
+    builder.AddRange(start, groups_12[i].end_range);
+  }
+  const std::vector<OpenTypeCMAPSubtableRange> &groups_13 =
+      file->cmap->subtable_31013;
+  for (unsigned i = 0; i < groups_13.size(); ++i) {
+    if (groups_13[i].start_glyph_id)
+      builder.AddRange(groups_13[i].start_range, groups_13[i].end_range);
+  }
+
+  std::sort(ranges.begin(), ranges.end(), RangeStartLessThan);
+  unsigned num_merged = 0;
+  for (unsigned i = 0; i < ranges.size(); ++i) {
+    if (num_merged && ranges[i].start <= ranges[num_merged - 1].end + 1) {
+      ranges[num_merged - 1].end = std::max(ranges[num_merged - 1].end,
+                                            ranges[i].end);
+    } else {
+      ranges[num_merged++] = ranges[i];
+    }
+  }
+  ranges.resize(num_merged);
+
+  coverage->bitmap.clear();
+  if (!coverage->want_bitmap)
+    return;
+
+  std::vector<uint8_t> &bitmap = coverage->bitmap;
+  bitmap.resize(kCMAPIndexMaxCodePoint / 8);
+  for (unsigned i = 0; i < ranges.size(); ++i) {
+    uint32_t cp = ranges[i].start;
+    const uint32_t end = ranges[i].end + 1;
+    // Set bits one at a time up to a byte boundary, then whole bytes.
+    for (; cp < end && (cp & 7); ++cp)
+      bitmap[cp >> 3] |= 1 << (cp & 7);
+    if (end - cp >= 8) {
+      memset(&bitmap[cp >> 3], 0xff, (end - cp) >> 3);
+      cp += (end - cp) & ~7u;
+    }
+    for (; cp < end; ++cp)
+      bitmap[cp >> 3] |= 1 << (cp & 7);
+  }
+}
+
+static void
+append_u16(std::vector<uint8_t> *out, uint16_t value) {
+  out->push_back(value >> 8);
+  out->push_back(value);
+}
+
+// A run of consecutive code-points which map to consecutive glyphs
+struct Mapping314Run {
+  uint16_t start;
+  uint16_t end;
+  uint16_t glyph;  // the glyph for |start|
+};
+
+// Append a 3.1.4 subtable for |mappings|, which must be sorted, to |out|.
+// Returns false if the subtable would be too large.
+static bool
+build_314(std::vector<uint8_t> *out,
+          const std::vector<OTCCodePointMapping> &mappings) {
+  std::vector<Mapping314Run> runs;
+  for (unsigned i = 0; i < mappings.size(); ++i) {
+    const uint32_t cp = mappings[i].first;
+    if (cp > 0xffff)
+      break;
+    const uint16_t glyph = mappings[i].second;
+    if (runs.size() && runs.back().end + 1u == cp &&
+        static_cast<uint16_t>(runs.back().glyph + (cp - runs.back().start)) ==
+        glyph) {
+      runs.back().end = cp;
+    } else {
+      Mapping314Run run;
+      run.start = run.end = cp;
+      run.glyph = glyph;
+      runs.push_back(run);
+    }
+  }
+
+  // Each segment either covers a single run, using idDelta, for 8 bytes, or
+  // covers any number of consecutive runs using the glyph id array, for 8
+  // bytes plus two for every code-point from the start of the first run to
+  // the end of the last. (Any code-points between the runs map to zero.) We
+  // find the cheapest division of the runs into segments by dynamic
+  // programming: cost[j] is the least cost of encoding the first j runs.
+  //
+  // The cost of a glyph id array segment covering runs i..j-1 is
+  //   cost[i] + 8 + 2 * (runs[j-1].end + 1 - runs[i].start)
+  // so we only need to track the smallest cost[i] - 2 * runs[i].start so far.
+  const unsigned num_runs = runs.size();
+  std::vector<unsigned> cost(num_runs + 1);
+  // If is_array[j], the last segment of the best encoding of the first j runs
+  // is a glyph id array segment starting at run first_run[j].
+  std::vector<bool> is_array(num_runs + 1);
+  std::vector<unsigned> first_run(num_runs + 1);
+  int best_array_base = 0;
+  unsigned best_array_first = 0;
+  for (unsigned j = 0; j < num_runs; ++j) {
+    const int array_base = static_cast<int>(cost[j]) - 2 * runs[j].start;
+    if (j == 0 || array_base < best_array_base) {
+      best_array_base = array_base;
+      best_array_first = j;
+    }
+
+    const unsigned delta_cost = cost[j] + 8;
+    const unsigned array_cost = best_array_base + 8 + 2 * (runs[j].end + 1);
+    if (array_cost < delta_cost) {
+      cost[j + 1] = array_cost;
+      is_array[j + 1] = true;
+      first_run[j + 1] = best_array_first;
+    } else {
+      cost[j + 1] = delta_cost;
+      is_array[j + 1] = false;
+      first_run[j + 1] = j;
+    }
+  }
+
+  // Recover the segments, in reverse order
+  std::vector<std::pair<unsigned, unsigned> > segment_runs;
+  for (unsigned j = num_runs; j; j = first_run[j])
+    segment_runs.push_back(std::make_pair(first_run[j], j));
+  std::reverse(segment_runs.begin(), segment_runs.end());
+
+  std::vector<uint16_t> start_codes, end_codes, deltas, id_range_offsets;
+  std::vector<uint16_t> glyph_ids;
+  for (unsigned i = 0; i < segment_runs.size(); ++i) {
+    const Mapping314Run &first = runs[segment_runs[i].first];
+    const Mapping314Run &last = runs[segment_runs[i].second - 1];
+    start_codes.push_back(first.start);
+    end_codes.push_back(last.end);
+    if (!is_array[segment_runs[i].second]) {
+      deltas.push_back(first.glyph - first.start);
+      // Filled in below, once the number of segments is known.
+      id_range_offsets.push_back(0);
+      continue;
+    }
+
+    // For now, store one more than the index of the segment's first entry in
+    // |glyph_ids|.
+    const unsigned base = glyph_ids.size();
+    deltas.push_back(0);
+    id_range_offsets.push_back(1 + base);
+    for (unsigned j = segment_runs[i].first; j < segment_runs[i].second; ++j) {
+      // Code-points between runs map to zero
+      glyph_ids.resize(base + (runs[j].start - first.start));
+      for (unsigned cp = runs[j].start; cp <= runs[j].end; ++cp)
+        glyph_ids.push_back(runs[j].glyph + (cp - runs[j].start));
+    }
+  }
+  // The last segment must end at 0xffff. This one maps it to glyph zero.
+  if (end_codes.empty() || end_codes.back() != 0xffff) {
+    start_codes.push_back(0xffff);
+    end_codes.push_back(0xffff);
+    deltas.push_back(1);
+    id_range_offsets.push_back(0);
+  }
+
+  const unsigned segcount = end_codes.size();
+  const unsigned length = 16 + segcount * 8 + glyph_ids.size() * 2;
+  if (length > 0xffff)
+    return false;
+
+  // The id range offsets are relative to their own position, so convert the
+  // indexes into |glyph_ids|.
+  for (unsigned i = 0; i < segcount; ++i) {
+    if (id_range_offsets[i])
+      id_range_offsets[i] = 2 * (segcount - i) + 2 * (id_range_offsets[i] - 1);
+  }
+
+  unsigned log2segcount = 0;
+  while (1u << (log2segcount + 1) <= segcount)
+    log2segcount++;
+  const unsigned search_range = 2u << log2segcount;
+
+  append_u16(out, 4);  // format
+  append_u16(out, length);
+  append_u16(out, 0);  // language
+  append_u16(out, segcount * 2);
+  append_u16(out, search_range);
+  append_u16(out, log2segcount);
+  append_u16(out, segcount * 2 - search_range);
+  for (unsigned i = 0; i < segcount; ++i)
+    append_u16(out, end_codes[i]);
+  append_u16(out, 0);  // padding
+  for (unsigned i = 0; i < segcount; ++i)
+    append_u16(out, start_codes[i]);
+  for (unsigned i = 0; i < segcount; ++i)
+    append_u16(out, deltas[i]);
+  for (unsigned i = 0; i < segcount; ++i)
+    append_u16(out, id_range_offsets[i]);
+  for (unsigned i = 0; i < glyph_ids.size(); ++i)
+    append_u16(out, glyph_ids[i]);
+
+  return true;
+}
+
+// Set |groups| to the 3.10.12 groups for |mappings|, which must be sorted.
+static void
+build_31012(std::vector<OpenTypeCMAPSubtableRange> *groups,
+            const std::vector<OTCCodePointMapping> &mappings) {
+  groups->clear();
+  for (unsigned i = 0; i < mappings.size(); ++i) {
+    const uint32_t cp = mappings[i].first;
+    const uint16_t glyph = mappings[i].second;
+    if (groups->size() && groups->back().end_range + 1 == cp &&
+        groups->back().start_glyph_id + (cp - groups->back().start_range) ==
+        glyph) {
+      groups->back().end_range = cp;
+    } else {
+      OpenTypeCMAPSubtableRange group;
+      group.start_range = cp;
+      group.end_range = cp;
+      group.start_glyph_id = glyph;
+      groups->push_back(group);
+    }
+  }
+}
+
+bool
+otc_cmap_subset(OpenTypeFile *subset, OpenTypeFile *file,
+                const std::vector<OTCCodePointMapping> &mappings) {
+  OpenTypeCMAP *cmap = new OpenTypeCMAP;
+  subset->cmap = cmap;
+
+  // The subset always has a 3.1.4 subtable, built from the BMP mappings.
+  if (!build_314(&cmap->subtable_314_buffer, mappings))
+    return failure();
+  cmap->subtable_314_data = &cmap->subtable_314_buffer[0];
+  cmap->subtable_314_length = cmap->subtable_314_buffer.size();
+
+  // If there are any mappings outside the BMP, all the mappings are also
+  // given in a 3.10.12 subtable.
+  if (mappings.size() && mappings.back().first > 0xffff)
+    build_31012(&cmap->subtable_31012, mappings);
+
+  return true;
+}
+
+// The size of the cmap table which otc_cmap_serialise writes
+static size_t
+serialised_length(const OpenTypeCMAP *cmap) {
+  size_t length = 4;
+  if (cmap->subtable_314_data)
+    length += 8 + cmap->subtable_314_length;
+  if (cmap->subtable_31012.size())
+    length += 8 + 16 + cmap->subtable_31012.size() * 12;
+  if (cmap->subtable_31013.size())
+    length += 8 + 16 + cmap->subtable_31013.size() * 12;
+  return length;
+}
+
+// Collects the mappings passed to Map in an array indexed by code-point
+class BMPMapper {
+ public:
+  BMPMapper(std::vector<uint16_t> *glyphs)
+      : glyphs_(glyphs) {
+  }
+
+  void Map(uint32_t code_point, uint16_t glyph) {
+    (*glyphs_)[code_point] = glyph;
+  }
+
+ private:
+  std::vector<uint16_t> *const glyphs_;
+};
+
+size_t
+otc_cmap_compact(OpenTypeFile *file) {
+  OpenTypeCMAP *cmap = file->cmap;
+
+  // Find the mapping given by the 3.1.4 and 3.10.12 subtables together, with
+  // 3.10.12 taking precedence, as in otc_cmap_lookup. The 3.10.13 subtable is
+  // left alone.
+  std::vector<uint16_t> bmp_glyphs(0x10000);
+  std::vector<OTCCodePointMapping> mappings;
+  if (cmap->subtable_314_data) {
+    BMPMapper mapper(&bmp_glyphs);
+    visit_314(&mapper, cmap->subtable_314_data, cmap->subtable_314_length,
+              file->maxp->num_glyphs);
+  }
+  const std::vector<OpenTypeCMAPSubtableRange> &groups = cmap->subtable_31012;
+  std::vector<OTCCodePointMapping> supplementary;
+  for (unsigned i = 0; i < groups.size(); ++i) {
+    // Code-points past the end of Unicode are dropped. Since the groups don't
+    // overlap, this also bounds the work done here.
+    const uint32_t end = std::min(groups[i].end_range,
+                                  kCMAPIndexMaxCodePoint - 1);
+    for (uint32_t cp = groups[i].start_range; cp <= end; ++cp) {
+      const uint16_t glyph =
+          groups[i].start_glyph_id + (cp - groups[i].start_range);
+      if (!glyph)
+        continue;
+      if (cp <= 0xffff) {
+        bmp_glyphs[cp] = glyph;
+      } else {
+        supplementary.push_back(std::make_pair(cp, glyph));
+      }
+    }
+  }
+
+  for (unsigned cp = 0; cp <= 0xffff; ++cp) {
+    if (bmp_glyphs[cp])
+      mappings.push_back(std::make_pair(cp, bmp_glyphs[cp]));
+  }
+  mappings.insert(mappings.end(), supplementary.begin(), supplementary.end());
+
+  // The 3.1.4 subtable is rebuilt from the mapping and the 3.10.12 subtable
+  // is only needed if there are mappings outside the BMP.
+  std::vector<uint8_t> subtable_314;
+  if (!build_314(&subtable_314, mappings))
+    return 0;
+  std::vector<OpenTypeCMAPSubtableRange> subtable_31012;
+  if (supplementary.size())
+    build_31012(&subtable_31012, mappings);
+
+  const size_t old_length = serialised_length(cmap);
+  size_t new_length = 4 + 8 + subtable_314.size();
+  if (subtable_31012.size())
+    new_length += 8 + 16 + subtable_31012.size() * 12;
+  if (cmap->subtable_31013.size())
+    new_length += 8 + 16 + cmap->subtable_31013.size() * 12;
+  // Keep the original encoding unless the new one is smaller
+  if (new_length >= old_length)
+    return 0;
+
+  cmap->subtable_314_buffer.swap(subtable_314);
+  cmap->subtable_314_data = &cmap->subtable_314_buffer[0];
+  cmap->subtable_314_length = cmap->subtable_314_buffer.size();
+  cmap->subtable_314_chksummed = false;
+  cmap->subtable_31012.swap(subtable_31012);
+
+  return old_length - new_length;
 }
@@ -10,13 +10,32 @@ struct OpenTypeCMAPSubtableRange {
 struct OpenTypeCMAP {
   OpenTypeCMAP()
       : subtable_314_data(NULL),
-        subtable_314_length(0) {
+        subtable_314_length(0),
+        subtable_314_chksummed(false),
+        subtable_314_chksum(0) {
   }
 
   const uint8_t *subtable_314_data;
   size_t subtable_314_length;
+  // If |subtable_314_chksummed|, the sum of the whole words of
+  // |subtable_314_data|. This is found while parsing, for a subtable which is
+  // taken from the input, so that it isn't summed again each time the table
+  // is written.
+  bool subtable_314_chksummed;
+  uint32_t subtable_314_chksum;
+  // If the 3.1.4 subtable was built, rather than taken from the input, then
+  // |subtable_314_data| points into this.
+  std::vector<uint8_t> subtable_314_buffer;
   std::vector<OpenTypeCMAPSubtableRange> subtable_31012;
   std::vector<OpenTypeCMAPSubtableRange> subtable_31013;
 };
 
+// Build an index of the character map in |file|, which must have been
+// successfully parsed. See otc_cmap_lookup.
+OTCCMAPIndex *otc_cmap_build_index(OpenTypeFile *file);
+
+// Find the code-points which the character map in |file|, which must have
+// been successfully parsed, maps to a glyph. See OTCOptions::coverage.
+void otc_cmap_coverage(OpenTypeFile *file, OTCCoverage *coverage);
+
 #endif
@@ -0,0 +1,20 @@
+#ifndef OTC_COMPACT_H_
+#define OTC_COMPACT_H_
+
+// Each of these rewrites the given table(s) of |file| to take less space
+// without changing the font, and returns the number of bytes saved.
+
+// Switches to short loca offsets if they are large enough. Updates |file->head|.
+size_t otc_loca_compact(OpenTypeFile *file);
+// Moves trailing glyphs with the same advance into the lsbs array. Updates
+// |file->hhea|.
+size_t otc_hmtx_compact(OpenTypeFile *file);
+// Rebuilds the 3.1.4 subtable with the cheapest mix of idDelta and glyph id
+// array segments, merges contiguous 3.10.12 groups and drops the 3.10.12
+// subtable if it only maps code-points in the BMP.
+size_t otc_cmap_compact(OpenTypeFile *file);
+// Drops the glyph names by switching to a version 3 table. (This does change
+// the font, so it's only done when requested.)
+size_t otc_post_compact(OpenTypeFile *file);
+
+#endif  // OTC_COMPACT_H_
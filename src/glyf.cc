@@ -2,40 +2,133 @@
 #include "loca.h"
 #include "glyf.h"
 #include "maxp.h"
+#include "subset.h"
+#include "parallel.h"
 
+namespace {
+
+// Fonts with many glyphs are parsed and serialised in chunks of at least this
+// many glyphs, on several threads if OpenTypeFile::num_threads allows.
+const unsigned kMinGlyphsPerChunk = 2048;
+
+// Return the number of chunks to split |num_glyphs| glyphs into
+unsigned
+NumChunks(unsigned num_glyphs, unsigned num_threads) {
+  if (num_threads == 1)
+    return 1;
+  const unsigned num_chunks = num_glyphs / kMinGlyphsPerChunk;
+  if (num_chunks < 2)
+    return 1;
+  // A few chunks per thread keep the threads busy even if some glyphs are
+  // much bigger than others.
+  if (num_threads && num_chunks > 4 * num_threads)
+    return 4 * num_threads;
+  return num_chunks;
+}
+
+// Return the length of the simple glyph |glyph| up to, but not including, the
+// length of its bytecode.
+unsigned
+SimpleGlyphHeaderLength(const OpenTypeGlyph &glyph) {
+  const unsigned num_contours = glyph.data[0] << 8 | glyph.data[1];
+  return 10 + num_contours * 2;
+}
+
+// Return the length of |glyph| once its bytecode is removed and it's padded
+uint32_t
+OutputLength(const OpenTypeGlyph &glyph) {
+  return Round4(glyph.length - glyph.bytecode_length);
+}
+
+// Write the glyphs [begin, end) of |glyf| to |out|. Runs of glyphs which are
+// written unchanged, and which are next to each other in the input, are
+// written with a single call.
 bool
-otc_glyf_parse(OpenTypeFile *file, const uint8_t *data, size_t length) {
-  Buffer table(data, length);
+WriteGlyphs(OTCStream *out, const OpenTypeGLYF *glyf, unsigned begin,
+            unsigned end) {
+  static const uint8_t kZeros[4] = {0};
+  const uint8_t *run = NULL;
+  size_t run_length = 0;
 
-  // http://www.microsoft.com/typography/otspec/glyf.htm
+  for (unsigned i = begin; i < end; ++i) {
+    const OpenTypeGlyph &glyph = glyf->glyphs[i];
+    if (!glyph.length)
+      continue;
 
-  // The GLYF table is pretty complicated. Thankfully, we can skip most of the
-  // complexity. For simple glyphs, we just want to remove the hinting
-  // bytecode. For composite glyphs, we can pass it directly since we'll
-  // already have removed the hinting code from the individual components.
+    // A glyph without bytecode which needs no padding is written as it is.
+    if (!glyph.bytecode_length && !(glyph.length & 3)) {
+      if (run && run + run_length == glyph.data) {
+        run_length += glyph.length;
+        continue;
+      }
+      if (run && !out->Write(run, run_length))
+        return failure();
+      run = glyph.data;
+      run_length = glyph.length;
+      continue;
+    }
 
-  if (!file->maxp || !file->loca)
-    return failure();
+    if (run && !out->Write(run, run_length))
+      return failure();
+    run = NULL;
 
-  OpenTypeGLYF *glyf = new OpenTypeGLYF;
-  file->glyf = glyf;
+    if (glyph.bytecode_length) {
+      // The glyph up to the bytecode length, then a zero length, followed by
+      // the rest of the glyph.
+      const unsigned header_length = SimpleGlyphHeaderLength(glyph);
+      const unsigned tail = header_length + 2 + glyph.bytecode_length;
+      if (!out->Write(glyph.data, header_length) ||
+          !out->Write(kZeros, 2) ||
+          !out->Write(glyph.data + tail, glyph.length - tail)) {
+        return failure();
+      }
+    } else if (!out->Write(glyph.data, glyph.length)) {
+      return failure();
+    }
 
-  const unsigned num_glyphs = file->maxp->num_glyphs;
-  std::vector<uint32_t> &offsets = file->loca->offsets;
+    // glyphs must be four byte aligned
+    const unsigned new_size = glyph.length - glyph.bytecode_length;
+    if (!out->Write(kZeros, (4 - (new_size & 3)) % 4))
+      return failure();
+  }
 
-  if (offsets.size() != num_glyphs + 1)
+  if (run && !out->Write(run, run_length))
     return failure();
+  return true;
+}
+
+// A range of glyphs which is parsed on its own
+struct ParseChunk {
+  unsigned begin, end;  // the glyphs [begin, end)
+  uint32_t length;  // the length of the chunk, once the hinting is removed
+  bool verbatim;  // true if every glyph is written as it is
+  bool ok;
+};
+
+// Parse the glyphs [chunk->begin, chunk->end) of the glyf table at |data|,
+// whose offsets are given by |offsets|, into |glyphs|. |new_offsets| is set to
+// the offsets of the glyphs in the output, relative to the start of the chunk.
+bool
+ParseGlyphs(ParseChunk *chunk, const uint8_t *data, size_t length,
+            const std::vector<uint32_t> &offsets, OpenTypeGlyph *glyphs,
+            uint32_t *new_offsets) {
+  Buffer table(data, length);
 
-  std::vector<uint32_t> resulting_offsets(num_glyphs + 1);
   uint32_t current_offset = 0;
+  chunk->verbatim = true;
+
+  for (unsigned i = chunk->begin; i < chunk->end; ++i) {
+    OpenTypeGlyph &glyph = glyphs[i];
+    glyph.data = NULL;
+    glyph.length = 0;
+    glyph.bytecode_length = 0;
+    new_offsets[i] = current_offset;
 
-  for (unsigned i = 0; i < num_glyphs; ++i) {
     const unsigned gly_offset = offsets[i];
     // The LOCA parser checks that these values are monotonic
     const unsigned gly_length = offsets[i + 1] - offsets[i];
     if (!gly_length) {
       // this glyph has no outline (e.g. the space charactor)
-      resulting_offsets[i] = current_offset;
       continue;
     }
 
@@ -61,7 +154,8 @@ otc_glyf_parse(OpenTypeFile *file, const uint8_t *data, size_t length) {
     if (xmin > xmax || ymin > ymax)
       return failure();
 
-    unsigned size_reduction = 0;
+    glyph.data = data + gly_offset;
+    glyph.length = gly_length;
 
     if (num_contours >= 0) {
       // this is a simple glyph and might contain bytecode
@@ -74,40 +168,162 @@ otc_glyf_parse(OpenTypeFile *file, const uint8_t *data, size_t length) {
 
       // when we remove the bytecode we need to shorten the glyph by this
       // amount.
-      size_reduction = bytecode_length;
-
-      // enqueue three vectors: the glyph data up to the bytecode length, then
-      // a pointer to a static uint16_t 0 to overwrite the length, followed by
-      // the rest of the glyph.
       const unsigned gly_header_length = 10 + num_contours * 2 + 2;
-      glyf->iov.push_back(std::make_pair(data + gly_offset, gly_header_length - 2));
-      glyf->iov.push_back(std::make_pair((const uint8_t*) "\x00\x00", 2));
       if (gly_length < (gly_header_length + bytecode_length))
         return failure();
-      glyf->iov.push_back(std::make_pair(data + gly_offset + gly_header_length + bytecode_length,
-                                         gly_length - (gly_header_length + bytecode_length)));
-    } else {
-      // it's a composite glyph without any bytecode. Enqueue the whole thing
-      glyf->iov.push_back(std::make_pair(data + gly_offset, gly_length));
+      glyph.bytecode_length = bytecode_length;
     }
+    // Otherwise it's a composite glyph without any bytecode, which is written
+    // as it is.
 
-    resulting_offsets[i] = current_offset;
-    if (size_reduction > gly_length)
-      return failure();
-    unsigned new_size = gly_length - size_reduction;
+    const unsigned new_size = gly_length - glyph.bytecode_length;
     if (new_size < 14)
       return failure();
-    // glyphs must be four byte aligned
-    const unsigned padding = (4 - (new_size & 3)) % 4;
-    if (padding) {
-      glyf->iov.push_back(std::make_pair((const uint8_t*) "\x00\x00\x00\x00", padding));
-      new_size += padding;
+    if (glyph.bytecode_length || (glyph.length & 3))
+      chunk->verbatim = false;
+    current_offset += OutputLength(glyph);
+  }
+  chunk->length = current_offset;
+
+  return true;
+}
+
+struct ParseJob {
+  std::vector<ParseChunk> *chunks;
+  const uint8_t *data;
+  size_t length;
+  const std::vector<uint32_t> *offsets;
+  OpenTypeGlyph *glyphs;
+  uint32_t *new_offsets;
+};
+
+void
+ParseChunkWork(void *arg, size_t i) {
+  ParseJob *job = static_cast<ParseJob*>(arg);
+  ParseChunk *chunk = &(*job->chunks)[i];
+  chunk->ok = ParseGlyphs(chunk, job->data, job->length, *job->offsets,
+                          job->glyphs, job->new_offsets);
+}
+
+// A range of glyphs which is serialised, and checksummed, on its own
+struct SerialiseChunk {
+  unsigned begin, end;  // the glyphs [begin, end)
+  std::vector<uint8_t> data;
+  uint32_t chksum;
+  bool ok;
+};
+
+struct SerialiseJob {
+  const OpenTypeGLYF *glyf;
+  std::vector<SerialiseChunk> *chunks;
+};
+
+void
+SerialiseChunkWork(void *arg, size_t i) {
+  SerialiseJob *job = static_cast<SerialiseJob*>(arg);
+  SerialiseChunk *chunk = &(*job->chunks)[i];
+
+  size_t length = 0;
+  for (unsigned j = chunk->begin; j < chunk->end; ++j)
+    length += OutputLength(job->glyf->glyphs[j]);
+  chunk->data.reserve(length);
+
+  // Every glyph is padded to four bytes, so the chunk is a whole number of
+  // words.
+  VectorStream stream(&chunk->data);
+  chunk->ok = WriteGlyphs(&stream, job->glyf, chunk->begin, chunk->end) &&
+              stream.Flush();
+  chunk->chksum = stream.chksum();
+}
+
+}  // anonymous namespace
+
+bool
+otc_glyf_parse(OpenTypeFile *file, const uint8_t *data, size_t length) {
+  // http://www.microsoft.com/typography/otspec/glyf.htm
+
+  // The GLYF table is pretty complicated. Thankfully, we can skip most of the
+  // complexity. For simple glyphs, we just want to remove the hinting
+  // bytecode. For composite glyphs, we can pass it directly since we'll
+  // already have removed the hinting code from the individual components.
+
+  if (!file->maxp || !file->loca)
+    return failure();
+
+  OpenTypeGLYF *glyf = new OpenTypeGLYF;
+  file->glyf = glyf;
+
+  const unsigned num_glyphs = file->maxp->num_glyphs;
+  std::vector<uint32_t> &offsets = file->loca->offsets;
+
+  if (offsets.size() != num_glyphs + 1)
+    return failure();
+
+  // Each glyph is parsed on its own, so large fonts are split into chunks
+  // which are parsed in parallel. The offsets of each chunk are then moved
+  // along by the lengths of those before it.
+  const unsigned num_chunks = NumChunks(num_glyphs, file->num_threads);
+  std::vector<ParseChunk> chunks(num_chunks);
+  for (unsigned i = 0; i < num_chunks; ++i) {
+    chunks[i].begin = static_cast<uint64_t>(num_glyphs) * i / num_chunks;
+    chunks[i].end = static_cast<uint64_t>(num_glyphs) * (i + 1) / num_chunks;
+    chunks[i].ok = false;
+  }
+
+  glyf->glyphs.resize(num_glyphs);
+  std::vector<uint32_t> resulting_offsets(num_glyphs + 1);
+
+  ParseJob job;
+  job.chunks = &chunks;
+  job.data = data;
+  job.length = length;
+  job.offsets = &offsets;
+  job.glyphs = num_glyphs ? &glyf->glyphs[0] : NULL;
+  job.new_offsets = &resulting_offsets[0];
+  otc_parallel_for(num_chunks, file->num_threads, ParseChunkWork, &job);
+
+  uint32_t current_offset = 0;
+  bool verbatim = offsets[0] == 0;
+  for (unsigned i = 0; i < num_chunks; ++i) {
+    const ParseChunk &chunk = chunks[i];
+    if (!chunk.ok)
+      return failure();
+    verbatim &= chunk.verbatim;
+    current_offset += chunk.length;
+  }
+
+  if (verbatim) {
+    // Since the glyphs are contiguous, starting from the beginning of the
+    // table, and none of them change, neither do the offsets. The table is
+    // summed now, while it's in the cache, so that writing it (perhaps more
+    // than once, to lay out the file first) costs nothing more than a copy.
+    // If that's the whole table, the sum comes from verifying its checksum, and
+    // it's only summed again if the checksum is wrong.
+    glyf->verbatim = data;
+    glyf->verbatim_length = current_offset;
+    uint32_t tag;
+    memcpy(&tag, "glyf", 4);
+    if (current_offset &&
+        (current_offset != length ||
+         !otc_verify_checksum(file, tag, data, length,
+                              &glyf->verbatim_chksum))) {
+      glyf->verbatim_chksum = otc_checksum_words(data, current_offset / 4);
     }
-    current_offset += new_size;
+    return true;
+  }
+
+  current_offset = 0;
+  for (unsigned i = 0; i < num_chunks; ++i) {
+    if (current_offset) {
+      for (unsigned j = chunks[i].begin; j < chunks[i].end; ++j)
+        resulting_offsets[j] += current_offset;
+    }
+    current_offset += chunks[i].length;
   }
   resulting_offsets[num_glyphs] = current_offset;
 
   file->loca->offsets = resulting_offsets;
+  file->loca->verbatim = NULL;
 
   return true;
 }
@@ -120,16 +336,200 @@ otc_glyf_should_serialise(OpenTypeFile *file) {
 bool
 otc_glyf_serialise(OTCStream *out, OpenTypeFile *file) {
   const OpenTypeGLYF *glyf = file->glyf;
+  const unsigned num_glyphs = glyf->glyphs.size();
 
-  for (unsigned i = 0; i < glyf->iov.size(); ++i) {
-    if (!out->Write(glyf->iov[i].first, glyf->iov[i].second))
+  if (glyf->verbatim) {
+    return out->WriteWithChecksum(glyf->verbatim, glyf->verbatim_length,
+                                  glyf->verbatim_chksum);
+  }
+
+  const unsigned num_chunks = NumChunks(num_glyphs, file->num_threads);
+  if (num_chunks == 1)
+    return WriteGlyphs(out, glyf, 0, num_glyphs);
+
+  // Every glyph is padded to four bytes, so each chunk starts on a word
+  // boundary and its checksum can be calculated on its own, in parallel with
+  // the others. The chunks are gathered into memory to do that, which costs a
+  // copy of the table, so it's only done when there are threads to spare.
+  std::vector<SerialiseChunk> chunks(num_chunks);
+  for (unsigned i = 0; i < num_chunks; ++i) {
+    chunks[i].begin = static_cast<uint64_t>(num_glyphs) * i / num_chunks;
+    chunks[i].end = static_cast<uint64_t>(num_glyphs) * (i + 1) / num_chunks;
+  }
+
+  SerialiseJob job;
+  job.glyf = glyf;
+  job.chunks = &chunks;
+  otc_parallel_for(num_chunks, file->num_threads, SerialiseChunkWork, &job);
+
+  for (unsigned i = 0; i < num_chunks; ++i) {
+    if (!chunks[i].ok)
       return failure();
+    if (chunks[i].data.empty())
+      continue;
+    if (!out->WriteWithChecksum(&chunks[i].data[0], chunks[i].data.size(),
+                                chunks[i].chksum)) {
+      return failure();
+    }
   }
 
   return true;
 }
 
+void
+otc_glyf_get_glyph(const OpenTypeGLYF *glyf, unsigned glyph,
+                   std::vector<uint8_t> *out) {
+  out->clear();
+  VectorStream stream(out);
+  WriteGlyphs(&stream, glyf, glyph, glyph + 1);
+  stream.Flush();
+}
+
 void
 otc_glyf_free(OpenTypeFile *file) {
   delete file->glyf;
 }
+
+// Find the offset of the glyph index in each component of the composite glyph
+// at |data|.
+static bool
+composite_glyph_indexes(const uint8_t *data, size_t length,
+                        std::vector<size_t> *offsets) {
+  static const uint16_t kArg1And2AreWords = 1 << 0;
+  static const uint16_t kWeHaveAScale = 1 << 3;
+  static const uint16_t kMoreComponents = 1 << 5;
+  static const uint16_t kWeHaveAnXAndYScale = 1 << 6;
+  static const uint16_t kWeHaveATwoByTwo = 1 << 7;
+
+  Buffer glyph(data, length);
+  // skip the number of contours and the bounding box
+  if (!glyph.Skip(10))
+    return failure();
+
+  uint16_t flags;
+  do {
+    uint16_t glyph_index;
+    if (!glyph.ReadU16(&flags))
+      return failure();
+    offsets->push_back(glyph.offset());
+    if (!glyph.ReadU16(&glyph_index))
+      return failure();
+
+    unsigned args_length = flags & kArg1And2AreWords ? 4 : 2;
+    if (flags & kWeHaveAScale) {
+      args_length += 2;
+    } else if (flags & kWeHaveAnXAndYScale) {
+      args_length += 4;
+    } else if (flags & kWeHaveATwoByTwo) {
+      args_length += 8;
+    }
+    if (!glyph.Skip(args_length))
+      return failure();
+  } while (flags & kMoreComponents);
+
+  // Any instructions for the composite follow, but they don't reference any
+  // glyphs.
+  return true;
+}
+
+// If |glyph| is a composite glyph, set |*data| and |*length| to the whole
+// glyph and return true.
+static bool
+get_composite_glyph(const OpenTypeGLYF *glyf, unsigned glyph,
+                    const uint8_t **data, size_t *length) {
+  const OpenTypeGlyph &g = glyf->glyphs[glyph];
+  if (!g.length)
+    return false;  // an empty glyph
+
+  // The top bit of the number of contours is set for composite glyphs.
+  if (!(g.data[0] & 0x80))
+    return false;
+
+  *data = g.data;
+  *length = g.length;
+  return true;
+}
+
+bool
+otc_glyf_components(OpenTypeFile *file, unsigned glyph,
+                    std::vector<uint16_t> *components) {
+  const uint8_t *data;
+  size_t length;
+  if (!get_composite_glyph(file->glyf, glyph, &data, &length))
+    return true;
+
+  std::vector<size_t> offsets;
+  if (!composite_glyph_indexes(data, length, &offsets))
+    return failure();
+  for (unsigned i = 0; i < offsets.size(); ++i)
+    components->push_back(data[offsets[i]] << 8 | data[offsets[i] + 1]);
+
+  return true;
+}
+
+bool
+otc_glyf_subset(OpenTypeFile *subset, OpenTypeFile *file,
+                const OTCGlyphMap &map) {
+  const OpenTypeGLYF *glyf = file->glyf;
+  const std::vector<uint32_t> &offsets = file->loca->offsets;
+  OpenTypeGLYF *subset_glyf = new OpenTypeGLYF;
+  subset->glyf = subset_glyf;
+  OpenTypeLOCA *subset_loca = new OpenTypeLOCA;
+  subset->loca = subset_loca;
+
+  const unsigned num_glyphs = map.new_to_old.size();
+
+  // First, copy the composite glyphs and rewrite their component glyph ids.
+  // This is done before building |glyphs| so that |composite_data| doesn't
+  // move afterwards.
+  std::vector<size_t> composite_offsets(num_glyphs);
+  std::vector<size_t> index_offsets;
+  for (unsigned i = 0; i < num_glyphs; ++i) {
+    const uint8_t *data;
+    size_t length;
+    if (!get_composite_glyph(glyf, map.new_to_old[i], &data, &length))
+      continue;
+
+    index_offsets.clear();
+    if (!composite_glyph_indexes(data, length, &index_offsets))
+      return failure();
+
+    std::vector<uint8_t> &composite_data = subset_glyf->composite_data;
+    composite_offsets[i] = composite_data.size();
+    composite_data.insert(composite_data.end(), data, data + length);
+    uint8_t *const copy = &composite_data[composite_offsets[i]];
+    for (unsigned j = 0; j < index_offsets.size(); ++j) {
+      const uint16_t old_glyph = copy[index_offsets[j]] << 8 |
+                                 copy[index_offsets[j] + 1];
+      if (old_glyph >= map.old_to_new.size() ||
+          map.old_to_new[old_glyph] == kGlyphDropped) {
+        return failure();
+      }
+      const uint16_t new_glyph = map.old_to_new[old_glyph];
+      copy[index_offsets[j]] = new_glyph >> 8;
+      copy[index_offsets[j] + 1] = new_glyph;
+    }
+  }
+
+  subset_glyf->glyphs.resize(num_glyphs);
+  subset_loca->offsets.resize(num_glyphs + 1);
+  uint32_t current_offset = 0;
+
+  for (unsigned i = 0; i < num_glyphs; ++i) {
+    const unsigned old_glyph = map.new_to_old[i];
+    subset_loca->offsets[i] = current_offset;
+    // These are the offsets after the hinting has been removed
+    current_offset += offsets[old_glyph + 1] - offsets[old_glyph];
+
+    subset_glyf->glyphs[i] = glyf->glyphs[old_glyph];
+    const uint8_t *data;
+    size_t length;
+    if (get_composite_glyph(glyf, old_glyph, &data, &length)) {
+      subset_glyf->glyphs[i].data =
+          &subset_glyf->composite_data[composite_offsets[i]];
+    }
+  }
+  subset_loca->offsets[num_glyphs] = current_offset;
+
+  return true;
+}
@@ -2,10 +2,40 @@
 #define OTC_GLYF_H_
 
 #include <vector>
-#include <utility>
+
+// A glyph as it was found in the input. Since the only change we make to a
+// glyph is to cut out its hinting bytecode, this is enough to write it: the
+// bytecode of a simple glyph follows its end-points array, whose length comes
+// from the number of contours at the start of the glyph.
+struct OpenTypeGlyph {
+  const uint8_t *data;  // in the input, or in OpenTypeGLYF::composite_data
+  uint32_t length;  // zero for an empty glyph
+  uint16_t bytecode_length;  // always zero for a composite glyph
+};
 
 struct OpenTypeGLYF {
-  std::vector<std::pair<const uint8_t*, size_t> > iov;
+  OpenTypeGLYF()
+      : verbatim(NULL),
+        verbatim_length(0),
+        verbatim_chksum(0) {
+  }
+
+  std::vector<OpenTypeGlyph> glyphs;
+  // If not NULL, every glyph in the input is already unhinted, padded and
+  // directly after the one before, so the output is simply the first
+  // |verbatim_length| bytes of the input table, whose words sum to
+  // |verbatim_chksum|.
+  const uint8_t *verbatim;
+  uint32_t verbatim_length;
+  uint32_t verbatim_chksum;
+  // Composite glyphs which have been rewritten when subsetting, referenced by
+  // |glyphs|.
+  std::vector<uint8_t> composite_data;
 };
 
+// Set |*out| to glyph |glyph| as it's written: without its bytecode and
+// padded to a multiple of four bytes.
+void otc_glyf_get_glyph(const OpenTypeGLYF *glyf, unsigned glyph,
+                        std::vector<uint8_t> *out);
+
 #endif  // OTC_GLYF_H_
@@ -0,0 +1,193 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "hash.h"
+
+// SipHash: https://131002.net/siphash/
+
+namespace {
+
+uint64_t
+LoadLE64(const uint8_t *p) {
+  uint64_t value = 0;
+  for (unsigned i = 8; i--; )
+    value = value << 8 | p[i];
+  return value;
+}
+
+uint64_t
+Rotate(uint64_t value, unsigned bits) {
+  return value << bits | value >> (64 - bits);
+}
+
+struct SipState {
+  uint64_t v0, v1, v2, v3;
+
+  void Rounds(unsigned n) {
+    while (n--) {
+      v0 += v1; v1 = Rotate(v1, 13); v1 ^= v0; v0 = Rotate(v0, 32);
+      v2 += v3; v3 = Rotate(v3, 16); v3 ^= v2;
+      v0 += v3; v3 = Rotate(v3, 21); v3 ^= v0;
+      v2 += v1; v1 = Rotate(v1, 17); v1 ^= v2; v2 = Rotate(v2, 32);
+    }
+  }
+
+  void Compress(uint64_t m) {
+    v3 ^= m;
+    Rounds(2);
+    v0 ^= m;
+  }
+};
+
+// Hashes the concatenation of everything passed to Update, so that a key can
+// cover several buffers without copying them into one.
+class SipHasher {
+ public:
+  explicit SipHasher(const uint8_t key[16])
+      : buffered_(0),
+        length_(0) {
+    const uint64_t k0 = LoadLE64(key);
+    const uint64_t k1 = LoadLE64(key + 8);
+    s_.v0 = 0x736f6d6570736575ull ^ k0;
+    s_.v1 = 0x646f72616e646f6dull ^ k1 ^ 0xee;  // 0xee: the 128-bit variant
+    s_.v2 = 0x6c7967656e657261ull ^ k0;
+    s_.v3 = 0x7465646279746573ull ^ k1;
+  }
+
+  void Update(const uint8_t *data, size_t length) {
+    length_ += length;
+    if (buffered_) {
+      const size_t n = std::min(length, static_cast<size_t>(8) - buffered_);
+      memcpy(buffer_ + buffered_, data, n);
+      buffered_ += n;
+      data += n;
+      length -= n;
+      if (buffered_ < 8)
+        return;
+      s_.Compress(LoadLE64(buffer_));
+      buffered_ = 0;
+    }
+
+    const size_t num_words = length / 8;
+    for (size_t i = 0; i < num_words; ++i)
+      s_.Compress(LoadLE64(data + 8 * i));
+    buffered_ = length & 7;
+    memcpy(buffer_, data + 8 * num_words, buffered_);
+  }
+
+  void Final(OTCHash *out) {
+    memset(buffer_ + buffered_, 0, 8 - buffered_);
+    buffer_[7] = length_;
+    s_.Compress(LoadLE64(buffer_));
+
+    s_.v2 ^= 0xee;
+    s_.Rounds(4);
+    out->words[0] = s_.v0 ^ s_.v1 ^ s_.v2 ^ s_.v3;
+    s_.v1 ^= 0xdd;
+    s_.Rounds(4);
+    out->words[1] = s_.v0 ^ s_.v1 ^ s_.v2 ^ s_.v3;
+  }
+
+ private:
+  SipState s_;
+  uint8_t buffer_[8];
+  size_t buffered_;  // number of bytes in |buffer_|
+  uint64_t length_;  // total number of bytes passed to Update
+};
+
+// The first byte hashed for each kind of key, so that keys of different kinds
+// are hashes of different streams.
+const uint8_t kRequestDomain = 'R';
+const uint8_t kTableDomain = 'T';
+
+// Append |value| to |out| as four big-endian bytes
+void
+AppendU32(std::vector<uint8_t> *out, uint32_t value) {
+  out->push_back(value >> 24);
+  out->push_back(value >> 16);
+  out->push_back(value >> 8);
+  out->push_back(value);
+}
+
+}  // anonymous namespace
+
+void
+otc_hash(OTCHash *out, const uint8_t key[16], const uint8_t *data,
+         size_t length) {
+  SipHasher hasher(key);
+  hasher.Update(data, length);
+  hasher.Final(out);
+}
+
+bool
+otc_hash_cacheable(const OTCOptions &options) {
+  return !options.cmap_index && !options.coverage && !options.compact_stats;
+}
+
+void
+otc_hash_request(OTCHash *out, const uint8_t key[16], const uint8_t *data,
+                 size_t length, const OTCOptions &options) {
+  // The options which affect the output bytes are hashed in one stream with
+  // the input: the domain byte, the length of the options, the options and
+  // then the input. Since the length says where the options end, no two
+  // requests hash the same stream.
+  std::vector<uint8_t> options_data;
+  options_data.push_back(options.output_format);
+  options_data.push_back(options.compact);
+  options_data.push_back(options.drop_glyph_names);
+  options_data.push_back(options.subset != NULL);
+  if (options.subset) {
+    for (unsigned i = 0; i < options.subset->size(); ++i)
+      AppendU32(&options_data, (*options.subset)[i]);
+  }
+
+  std::vector<uint8_t> header;
+  header.push_back(kRequestDomain);
+  AppendU32(&header, options_data.size());
+  header.insert(header.end(), options_data.begin(), options_data.end());
+
+  SipHasher hasher(key);
+  hasher.Update(&header[0], header.size());
+  hasher.Update(data, length);
+  hasher.Final(out);
+}
+
+void
+otc_hash_table(OTCHash *out, const uint8_t key[16], uint32_t tag,
+               uint16_t num_glyphs, const uint8_t *data, size_t length) {
+  // As with otc_hash_request, one stream is hashed: the domain byte, the tag
+  // and the number of glyphs, which have a fixed length, and then the table.
+  // The domain byte keeps tables apart from whole fonts.
+  uint8_t header[7];
+  header[0] = kTableDomain;
+  memcpy(header + 1, &tag, 4);
+  header[5] = num_glyphs >> 8;
+  header[6] = num_glyphs;
+
+  SipHasher hasher(key);
+  hasher.Update(header, sizeof(header));
+  hasher.Update(data, length);
+  hasher.Final(out);
+}
+
+bool
+otc_hash_key(uint8_t key[16]) {
+  const int fd = open("/dev/urandom", O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  size_t done = 0;
+  while (done < 16) {
+    const ssize_t n = read(fd, key + done, 16 - done);
+    if (n <= 0)
+      break;
+    done += n;
+  }
+  close(fd);
+
+  return done == 16;
+}
@@ -0,0 +1,53 @@
+#ifndef OTC_HASH_H_
+#define OTC_HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "opentype-condom.h"
+
+// A 128-bit hash, used to identify inputs which have been seen before.
+struct OTCHash {
+  uint64_t words[2];
+
+  bool operator<(const OTCHash &other) const {
+    if (words[0] != other.words[0])
+      return words[0] < other.words[0];
+    return words[1] < other.words[1];
+  }
+
+  bool operator==(const OTCHash &other) const {
+    return words[0] == other.words[0] && words[1] == other.words[1];
+  }
+};
+
+// Set |out| to the SipHash-2-4 of |length| bytes at |data|, with a 128-bit
+// output, under the 128-bit |key|. Without the key, inputs which collide can't
+// be found any faster than by chance, so a cache indexed by this hash can't be
+// poisoned by a hostile font. Use otc_hash_key to generate a random key.
+void otc_hash(OTCHash *out, const uint8_t key[16], const uint8_t *data,
+              size_t length);
+
+// Returns true if the result of otc_process with |options| is entirely its
+// output, so that it can be cached. Options which return anything else (a
+// cmap index, coverage or compact stats) can't be.
+bool otc_hash_cacheable(const OTCOptions &options);
+
+// Set |out| to the key under which a cache stores the result of otc_process
+// for |length| bytes at |data| and |options|: a hash of the input and of the
+// options which affect the output.
+void otc_hash_request(OTCHash *out, const uint8_t key[16], const uint8_t *data,
+                      size_t length, const OTCOptions &options);
+
+// Set |out| to the key under which a single table, |length| bytes at |data|
+// with the tag |tag|, is memoised (see OTCOptions::table_memo). A table's
+// parsing depends on the number of glyphs in the font, so that's hashed too.
+// Tables are hashed in a different domain from otc_hash_request's fonts.
+void otc_hash_table(OTCHash *out, const uint8_t key[16], uint32_t tag,
+                    uint16_t num_glyphs, const uint8_t *data, size_t length);
+
+// Fill |key| with random bytes from the operating system. Returns false if
+// none are available.
+bool otc_hash_key(uint8_t key[16]);
+
+#endif  // OTC_HASH_H_
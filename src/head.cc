@@ -19,6 +19,7 @@ otc_head_parse(OpenTypeFile *file, const uint8_t *data, size_t length) {
 
   // Skip the checksum adjustment
   table.Skip(4);
+  file->head->checksum_adjustment = 0;
 
   uint32_t magic;
   if (!table.ReadTag(&magic) ||
@@ -89,7 +90,7 @@ bool
 otc_head_serialise(OTCStream *out, OpenTypeFile *file) {
   if (!out->WriteU32(0x00010000) ||
       !out->WriteU32(file->head->revision) ||
-      !out->WriteU32(0) ||  // check sum not filled in yet
+      !out->WriteU32(file->head->checksum_adjustment) ||
       !out->WriteU32(0x5F0F3CF5) ||
       !out->WriteU16(file->head->flags) ||
       !out->WriteU16(file->head->ppem) ||
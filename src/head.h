@@ -3,6 +3,9 @@
 
 struct OpenTypeHEAD {
   uint32_t revision;
+  // This is always zero after parsing. otc_process fills it in when it can
+  // calculate the value before writing the table.
+  uint32_t checksum_adjustment;
   uint16_t flags;
   uint16_t ppem;
   uint64_t created;
@@ -2,6 +2,13 @@
 #include "maxp.h"
 #include "hhea.h"
 #include "hmtx.h"
+#include "subset.h"
+#include "compact.h"
+
+// We read the metrics straight into the pairs, so they must be laid out as two
+// 16-bit values. This fails to compile otherwise.
+typedef char hmtx_metric_is_two_uint16s[
+    sizeof(std::pair<uint16_t, int16_t>) == 2 * sizeof(uint16_t) ? 1 : -1];
 
 bool
 otc_hmtx_parse(OpenTypeFile *file, const uint8_t *data, size_t length) {
@@ -20,31 +27,19 @@ otc_hmtx_parse(OpenTypeFile *file, const uint8_t *data, size_t length) {
     return failure();
   const unsigned num_lsbs = file->maxp->num_glyphs - num_hmetrics;
 
-  for (unsigned i = 0; i < num_hmetrics; ++i) {
-    uint16_t adv;
-    int16_t lsb;
-    if (!table.ReadU16(&adv) ||
-        !table.ReadS16(&lsb)) {
+  hmtx->metrics.resize(num_hmetrics);
+  if (num_hmetrics) {
+    if (!table.ReadU16S16Array(reinterpret_cast<uint16_t*>(&hmtx->metrics[0]),
+                               num_hmetrics, file->hhea->adv_width_max,
+                               file->hhea->min_lsb)) {
       return failure();
     }
-
-    if (adv > file->hhea->adv_width_max)
-      return failure();
-    if (lsb < file->hhea->min_lsb)
-      return failure();
-
-    hmtx->metrics.push_back(std::make_pair(adv, lsb));
   }
 
-  for (unsigned i = 0; i < num_lsbs; ++i) {
-    int16_t lsb;
-    if (!table.ReadS16(&lsb))
+  hmtx->lsbs.resize(num_lsbs);
+  if (num_lsbs) {
+    if (!table.ReadS16Array(&hmtx->lsbs[0], num_lsbs, file->hhea->min_lsb))
       return failure();
-
-    if (lsb < file->hhea->min_lsb)
-      return failure();
-
-    hmtx->lsbs.push_back(lsb);
   }
 
   return true;
@@ -78,3 +73,62 @@ void
 otc_hmtx_free(OpenTypeFile *file) {
   delete file->hmtx;
 }
+
+bool
+otc_hmtx_subset(OpenTypeFile *subset, OpenTypeFile *file,
+                const OTCGlyphMap &map) {
+  const OpenTypeHMTX *hmtx = file->hmtx;
+  OpenTypeHMTX *subset_hmtx = new OpenTypeHMTX;
+  subset->hmtx = subset_hmtx;
+
+  if (hmtx->metrics.empty())
+    return failure();
+
+  // Every glyph in the subset gets a full metric. Glyphs which were in |lsbs|
+  // take the advance of the last full metric.
+  const unsigned num_glyphs = map.new_to_old.size();
+  subset_hmtx->metrics.resize(num_glyphs);
+  for (unsigned i = 0; i < num_glyphs; ++i) {
+    const unsigned old_glyph = map.new_to_old[i];
+    if (old_glyph < hmtx->metrics.size()) {
+      subset_hmtx->metrics[i] = hmtx->metrics[old_glyph];
+    } else {
+      subset_hmtx->metrics[i].first = hmtx->metrics.back().first;
+      subset_hmtx->metrics[i].second =
+          hmtx->lsbs[old_glyph - hmtx->metrics.size()];
+    }
+  }
+
+  subset->hhea->num_hmetrics = num_glyphs;
+
+  return true;
+}
+
+size_t
+otc_hmtx_compact(OpenTypeFile *file) {
+  OpenTypeHMTX *hmtx = file->hmtx;
+  std::vector<std::pair<uint16_t, int16_t> > &metrics = hmtx->metrics;
+  if (metrics.empty())
+    return 0;
+
+  // Glyphs in |lsbs| take the advance of the last metric, so any run of
+  // metrics at the end with that advance can be moved into |lsbs|.
+  const uint16_t advance = metrics.back().first;
+  unsigned num_hmetrics = metrics.size();
+  while (num_hmetrics > 1 && metrics[num_hmetrics - 2].first == advance)
+    num_hmetrics--;
+
+  const unsigned num_moved = metrics.size() - num_hmetrics;
+  if (!num_moved)
+    return 0;
+
+  std::vector<int16_t> lsbs(num_moved);
+  for (unsigned i = 0; i < num_moved; ++i)
+    lsbs[i] = metrics[num_hmetrics + i].second;
+  hmtx->lsbs.insert(hmtx->lsbs.begin(), lsbs.begin(), lsbs.end());
+  metrics.resize(num_hmetrics);
+  file->hhea->num_hmetrics = num_hmetrics;
+
+  // Each moved glyph loses its two byte advance
+  return num_moved * 2;
+}
@@ -0,0 +1,83 @@
+#include <stdint.h>
+
+#include "otc.h"
+
+OTCIOVecStream::OTCIOVecStream(const uint8_t *input, size_t length)
+    : input_(input),
+      input_length_(length),
+      length_(0),
+      seek_failed_(false) {
+}
+
+bool
+OTCIOVecStream::WriteRaw(const void *data, size_t length) {
+  const uint8_t *const bytes = static_cast<const uint8_t*>(data);
+  const uintptr_t start = reinterpret_cast<uintptr_t>(bytes);
+  const uintptr_t input_start = reinterpret_cast<uintptr_t>(input_);
+
+  if (seek_failed_)
+    return false;
+
+  length_ += length;
+
+  if (length >= kMinReferenceLength &&
+      start >= input_start &&
+      start - input_start <= input_length_ &&
+      length <= input_length_ - (start - input_start)) {
+    // This data is from the input, so we just reference it. If it follows on
+    // from the previous reference, we can extend that instead.
+    if (segments_.size()) {
+      Segment &last = segments_.back();
+      if (last.input && last.input + last.length == bytes) {
+        last.length += length;
+        return true;
+      }
+    }
+
+    Segment segment;
+    segment.input = bytes;
+    segment.offset = 0;
+    segment.length = length;
+    segments_.push_back(segment);
+    return true;
+  }
+
+  if (!segments_.size() || segments_.back().input) {
+    Segment segment;
+    segment.input = NULL;
+    segment.offset = buffer_.size();
+    segment.length = 0;
+    segments_.push_back(segment);
+  }
+
+  buffer_.insert(buffer_.end(), bytes, bytes + length);
+  segments_.back().length += length;
+  return true;
+}
+
+void
+OTCIOVecStream::Seek(off_t position) {
+  // Seeking is only possible if it's a no-op. Anything else would leave the
+  // output corrupt, so every later write fails instead.
+  if (static_cast<size_t>(position) != length_)
+    seek_failed_ = true;
+}
+
+off_t
+OTCIOVecStream::Tell() const {
+  return length_;
+}
+
+void
+OTCIOVecStream::GetIOVec(std::vector<struct iovec> *iov) const {
+  // |buffer_| may have been reallocated as it grew, so we can only calculate
+  // the pointers into it once all the writes have been done.
+  iov->resize(segments_.size());
+  for (unsigned i = 0; i < segments_.size(); ++i) {
+    const uint8_t *base = segments_[i].input;
+    if (!base)
+      base = &buffer_[segments_[i].offset];
+    (*iov)[i].iov_base = const_cast<uint8_t*>(base);
+    (*iov)[i].iov_len = segments_[i].length;
+  }
+}
@@ -2,6 +2,7 @@
 #include "loca.h"
 #include "maxp.h"
 #include "head.h"
+#include "compact.h"
 
 bool
 otc_loca_parse(OpenTypeFile *file, const uint8_t *data, size_t length) {
@@ -19,32 +20,29 @@ otc_loca_parse(OpenTypeFile *file, const uint8_t *data, size_t length) {
     return failure();
 
   const unsigned num_glyphs = file->maxp->num_glyphs;
-  unsigned last_offset = 0;
   loca->offsets.resize(num_glyphs + 1);
 
+  // Note that there is one more offset than the number of glyphs in order to
+  // give the length of the final glyph.
   if (file->head->index_to_loc_format == 0) {
-    // Note that the <= here (and below) is correct. There is one more offset
-    // than the number of glyphs in order to give the length of the final
-    // glyph.
-    for (unsigned i = 0; i <= num_glyphs; ++i) {
-      uint16_t offset;
-      if (!table.ReadU16(&offset))
-        return failure();
-      if (offset < last_offset)
-        return failure();
-      last_offset = offset;
-      loca->offsets[i] = offset * 2;
-    }
+    // Short offsets are stored divided by two.
+    if (!table.ReadMonotonicU16Array(&loca->offsets[0], num_glyphs + 1, 1))
+      return failure();
   } else {
-    for (unsigned i = 0; i <= num_glyphs; ++i) {
-      uint32_t offset;
-      if (!table.ReadU32(&offset))
-        return failure();
-      if (offset < last_offset)
-        return failure();
-      last_offset = offset;
-      loca->offsets[i] = offset;
-    }
+    if (!table.ReadMonotonicU32Array(&loca->offsets[0], num_glyphs + 1))
+      return failure();
+  }
+
+  // otc_glyf_parse clears this if it changes the offsets.
+  loca->verbatim = data;
+  loca->verbatim_format = file->head->index_to_loc_format;
+  // If nothing follows the offsets, the table is written exactly as it is, so
+  // if its checksum is right it needn't be summed again.
+  if (table.offset() == length) {
+    uint32_t tag;
+    memcpy(&tag, "loca", 4);
+    loca->chksum_verified =
+        otc_verify_checksum(file, tag, data, length, &loca->words_chksum);
   }
 
   return true;
@@ -64,6 +62,15 @@ otc_loca_serialise(OTCStream *out, OpenTypeFile *file) {
   if (!maxp || !head)
     return failure();
 
+  if (loca->verbatim && loca->verbatim_format == head->index_to_loc_format) {
+    const size_t entry_size = head->index_to_loc_format == 0 ? 2 : 4;
+    const size_t length = loca->offsets.size() * entry_size;
+    if (loca->chksum_verified)
+      return out->WriteWithChecksum(loca->verbatim, length,
+                                    loca->words_chksum);
+    return out->Write(loca->verbatim, length);
+  }
+
   if (head->index_to_loc_format == 0) {
     for (unsigned i = 0; i < loca->offsets.size(); ++i) {
       if (!out->WriteU16(loca->offsets[i] >> 1))
@@ -83,3 +90,19 @@ void
 otc_loca_free(OpenTypeFile *file) {
   delete file->loca;
 }
+
+size_t
+otc_loca_compact(OpenTypeFile *file) {
+  const std::vector<uint32_t> &offsets = file->loca->offsets;
+  if (file->head->index_to_loc_format == 0)
+    return 0;
+
+  // Short offsets are stored divided by two. Since glyf pads every glyph to a
+  // multiple of four bytes, all the offsets are even and we only need to check
+  // the last, and largest, one.
+  if (offsets.back() > 0xffff * 2)
+    return 0;
+
+  file->head->index_to_loc_format = 0;
+  return offsets.size() * 2;
+}
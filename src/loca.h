@@ -4,7 +4,22 @@
 #include <vector>
 
 struct OpenTypeLOCA {
+  OpenTypeLOCA()
+      : verbatim(NULL),
+        verbatim_format(0),
+        chksum_verified(false),
+        words_chksum(0) {
+  }
+
   std::vector<uint32_t> offsets;
+  // If not NULL, |offsets| are unchanged from the input table, which is
+  // written as it is unless the format has been changed since.
+  const uint8_t *verbatim;
+  int16_t verbatim_format;  // as OpenTypeHEAD::index_to_loc_format
+  // If |chksum_verified|, |verbatim| is the whole input table and the sum of
+  // its whole words is |words_chksum|.
+  bool chksum_verified;
+  uint32_t words_chksum;
 };
 
 #endif  // OTC_LOCA_H_
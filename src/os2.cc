@@ -10,6 +10,12 @@ otc_os2_parse(OpenTypeFile *file, const uint8_t *data, size_t length) {
   file->os2 = new OpenTypeOS2;
   file->os2->data = data;
   file->os2->length = length;
+  // The table is written exactly as it is, so if its checksum is right it
+  // needn't be summed again.
+  uint32_t tag;
+  memcpy(&tag, "OS/2", 4);
+  file->os2->chksum_verified =
+      otc_verify_checksum(file, tag, data, length, &file->os2->words_chksum);
 
   return true;
 }
@@ -23,9 +29,12 @@ bool
 otc_os2_serialise(OTCStream *out, OpenTypeFile *file) {
   const OpenTypeOS2 *os2 = file->os2;
 
-  if (!out->Write(os2->data, os2->length))
+  if (os2->chksum_verified) {
+    if (!out->WriteWithChecksum(os2->data, os2->length, os2->words_chksum))
+      return failure();
+  } else if (!out->Write(os2->data, os2->length)) {
     return failure();
-
+  }
 
   return true;
 }
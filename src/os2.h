@@ -4,6 +4,9 @@
 struct OpenTypeOS2 {
   const uint8_t *data;
   size_t length;
+  // If |chksum_verified|, the sum of the whole words of |data|
+  bool chksum_verified;
+  uint32_t words_chksum;
 };
 
 #endif  // OTC_OS2_H_
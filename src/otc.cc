@@ -8,6 +8,14 @@
 #include <stdlib.h>
 
 #include "otc.h"
+#include "cache.h"
+#include "cmap.h"
+#include "head.h"
+#include "maxp.h"
+#include "subset.h"
+#include "compact.h"
+#include "woff.h"
+#include "parallel.h"
 
 #define F(name, capname) \
   bool otc_##name##_parse(OpenTypeFile *file, const uint8_t *data, size_t length); \
@@ -24,13 +32,6 @@ struct OpenTypeTable {
   uint32_t length;
 };
 
-// Round a value up to the nearest multiple of 4. Note that this can overflow
-// and return zero.
-template<typename T>
-T Round4(T value) {
-  return (value + 3) & ~3;
-}
-
 static uint32_t
 tag(const char *tag_str) {
   uint32_t ret;
@@ -53,57 +54,149 @@ struct OutputTable {
 
 struct BypassTable {
   uint32_t tag;
-  size_t offset;  // offset into input data
+  const uint8_t *data;  // in the input, a decompressed WOFF table or |memo|
   size_t length;
+  // If not NULL, this table was found in, or added to, OTCOptions::table_memo
+  // and is written in place of the parsed table. A reference to the entry is
+  // held until ReleaseMemoTables.
+  OTCCacheEntry *memo;
 };
 
-bool
-otc_process(OTCStream *output, const uint8_t *data, size_t length) {
-  Buffer file(data, length);
+// A table which is going to be written out: either a bypass table, which is
+// copied verbatim from the input, or one which we reserialise.
+struct TableSource {
+  uint32_t tag;
+  const BypassTable *bypass;  // NULL unless this is a bypass table
+  bool (*serialise) (OTCStream *out, OpenTypeFile *file);
+};
 
-  // we disallow all files > 1GB in size for sanity.
-  if (length > 1024 * 1024 * 1024)
-    return failure();
+static const struct {
+  uint32_t tag;
+  bool (*parse) (OpenTypeFile *otf, const uint8_t *data, size_t length);
+  bool (*serialise) (OTCStream *out, OpenTypeFile *file);
+  bool (*should_serialise) (OpenTypeFile *file);
+  void (*free) (OpenTypeFile *file);
+  bool required;
+  bool bypass;
+  // The tags, separated by spaces, of the tables which must be parsed before
+  // this one. Tables which don't depend on each other may be parsed at the
+  // same time (see OTCOptions::num_threads).
+  const char *after;
+} table_parsers[] = {
+  { tag("maxp"), otc_maxp_parse, otc_maxp_serialise, otc_maxp_should_serialise, otc_maxp_free, 1, 0, "" },
+  { tag("cmap"), otc_cmap_parse, otc_cmap_serialise, otc_cmap_should_serialise, otc_cmap_free, 1, 0, "maxp" },
+  { tag("head"), otc_head_parse, otc_head_serialise, otc_head_should_serialise, otc_head_free, 1, 0, "" },
+  { tag("hhea"), otc_hhea_parse, otc_hhea_serialise, otc_hhea_should_serialise, otc_hhea_free, 1, 0, "maxp" },
+  { tag("hmtx"), otc_hmtx_parse, otc_hmtx_serialise, otc_hmtx_should_serialise, otc_hmtx_free, 1, 0, "maxp hhea" },
+  { tag("name"), otc_name_parse, otc_name_serialise, otc_name_should_serialise, otc_name_free, 1, 0, "" },
+  { tag("OS/2"), otc_os2_parse, otc_os2_serialise, otc_os2_should_serialise, otc_os2_free, 1, 0, "" },
+  { tag("post"), otc_post_parse, otc_post_serialise, otc_post_should_serialise, otc_post_free, 1, 0, "maxp" },
+  { tag("loca"), otc_loca_parse, otc_loca_serialise, otc_loca_should_serialise, otc_loca_free, 1, 0, "maxp head" },
+  { tag("glyf"), otc_glyf_parse, otc_glyf_serialise, otc_glyf_should_serialise, otc_glyf_free, 1, 0, "maxp loca" },
+  { 0, NULL, NULL, NULL, 0 },
+};
 
-  OpenTypeFile header;
-  if (!file.ReadU32(&header.version))
+// An OTCStream which discards everything written to it. It's used to find the
+// length and checksum of a table without writing it anywhere.
+class CountingStream : public OTCStream {
+ public:
+  CountingStream()
+      : position_(0) {
+  }
+
+  bool WriteRaw(const void *data, size_t length) {
+    position_ += length;
+    return true;
+  }
+
+  void Seek(off_t position) {
+    position_ = position;
+  }
+
+  off_t Tell() const {
+    return position_;
+  }
+
+ private:
+  off_t position_;
+};
+
+// An OTCStream which writes into a fixed size buffer, owned by the caller.
+// Writes which would overflow the buffer fail.
+class MemoryStream : public OTCStream {
+ public:
+  MemoryStream(uint8_t *buffer, size_t length)
+      : buffer_(buffer),
+        length_(length),
+        position_(0) {
+  }
+
+  bool WriteRaw(const void *data, size_t length) {
+    if (position_ > length_ || length > length_ - position_)
+      return false;
+    memcpy(buffer_ + position_, data, length);
+    position_ += length;
+    return true;
+  }
+
+  void Seek(off_t position) {
+    position_ = position;
+  }
+
+  off_t Tell() const {
+    return position_;
+  }
+
+ private:
+  uint8_t *const buffer_;
+  const size_t length_;
+  size_t position_;
+};
+
+// Read the table directory of an OpenType file into |header| and |table_data|
+static bool
+ReadSFNTTables(OpenTypeFile *header, const uint8_t *data, size_t length,
+               std::vector<OpenTypeTableData> *table_data) {
+  Buffer file(data, length);
+
+  if (!file.ReadU32(&header->version))
     return failure();
-  if (header.version >> 16 != 1)
+  if (header->version >> 16 != 1)
     return failure();
 
-  if (!file.ReadU16(&header.num_tables) ||
-      !file.ReadU16(&header.search_range) ||
-      !file.ReadU16(&header.entry_selector) ||
-      !file.ReadU16(&header.range_shift))
+  if (!file.ReadU16(&header->num_tables) ||
+      !file.ReadU16(&header->search_range) ||
+      !file.ReadU16(&header->entry_selector) ||
+      !file.ReadU16(&header->range_shift))
     return failure();
 
   // search_range is (Maximum power of 2 <= numTables) x 16. Thus, to avoid
   // overflow num_tables is, at most, 2^16 / 16 = 2^12
-  if (header.num_tables >= 4096 || header.num_tables < 1)
+  if (header->num_tables >= 4096 || header->num_tables < 1)
     return failure();
 
   unsigned max_pow2 = 0;
-  while (1u << (max_pow2 + 1) < header.num_tables)
+  while (1u << (max_pow2 + 1) < header->num_tables)
     max_pow2++;
   const uint16_t expected_search_range = (1u << max_pow2) << 4;
-  if (header.search_range != expected_search_range)
+  if (header->search_range != expected_search_range)
     return failure();
 
   // entry_selector is Log2(maximum power of 2 <= numTables)
-  if (header.entry_selector != max_pow2)
+  if (header->entry_selector != max_pow2)
     return failure();
 
   // range_shift is NumTables x 16-searchRange. We know that 16*num_tables
   // doesn't over flow because we range checked it above. Also, we know that
   // it's > header.search_range by construction of search_range.
-  const uint32_t expected_range_shift = 16 * header.num_tables - header.search_range;
-  if (header.range_shift != expected_range_shift)
+  const uint32_t expected_range_shift = 16 * header->num_tables - header->search_range;
+  if (header->range_shift != expected_range_shift)
     return failure();
 
   // Next up is the list of tables.
   std::vector<OpenTypeTable> tables;
 
-  for (unsigned i = 0; i < header.num_tables; ++i) {
+  for (unsigned i = 0; i < header->num_tables; ++i) {
     OpenTypeTable table;
     if (!file.ReadTag(&table.tag) ||
         !file.ReadU32(&table.chksum) ||
@@ -117,7 +210,7 @@ otc_process(OTCStream *output, const uint8_t *data, size_t length) {
 
   const size_t data_offset = file.offset();
 
-  for (unsigned i = 0; i < header.num_tables; ++i) {
+  for (unsigned i = 0; i < header->num_tables; ++i) {
     // the tables must be sorted by tag (when taken as big-endian numbers).
     // This also remove the possibility of duplicate tables.
     if (i) {
@@ -147,39 +240,180 @@ otc_process(OTCStream *output, const uint8_t *data, size_t length) {
   // we could check that the tables are disjoint, but it's now technically
   // invalid for them to overlap according to the spec.
 
-  std::map<uint32_t, OpenTypeTable> table_map;
-  for (unsigned i = 0; i < header.num_tables; ++i)
+  for (unsigned i = 0; i < header->num_tables; ++i) {
+    OpenTypeTableData table;
+    table.tag = tables[i].tag;
+    table.data = data + tables[i].offset;
+    table.length = tables[i].length;
+    table.chksum = tables[i].chksum;
+    table_data->push_back(table);
+  }
+
+  return true;
+}
+
+bool
+otc_verify_checksum(const OpenTypeFile *file, uint32_t tag,
+                    const uint8_t *data, size_t length,
+                    uint32_t *words_chksum) {
+  const std::map<uint32_t, uint32_t>::const_iterator
+    it = file->input_chksums.find(tag);
+  if (it == file->input_chksums.end())
+    return false;
+
+  // The checksum covers the table padded with zeros to a whole word.
+  const size_t num_words = length / 4;
+  const uint32_t sum = num_words ? otc_checksum_words(data, num_words) : 0;
+  uint8_t tail[4] = {0};
+  memcpy(tail, data + num_words * 4, length & 3);
+  if (sum + (tail[0] << 24 | tail[1] << 16 | tail[2] << 8 | tail[3]) !=
+      it->second) {
+    return false;
+  }
+
+  *words_chksum = sum;
+  return true;
+}
+
+// Returns the cache in which the table |tag| should be memoised, or NULL if it
+// shouldn't be: only tables which are written exactly as they're parsed can
+// be.
+static OTCCache *
+TableMemo(uint32_t table_tag, const OTCOptions &options) {
+  if (!options.table_memo || options.subset)
+    return NULL;
+  if (table_tag == tag("cmap") &&
+      !options.compact && !options.cmap_index && !options.coverage) {
+    return options.table_memo;
+  }
+  if (table_tag == tag("post") && !options.drop_glyph_names)
+    return options.table_memo;
+  return NULL;
+}
+
+// Parse table |i| of |table_parsers| through |memo|. If the table has been
+// seen before, with the same number of glyphs, its serialised form is reused
+// and it isn't parsed at all. Otherwise it's parsed and serialised, and the
+// result is added to |memo|. Either way, |bypass| is set to the serialised
+// table.
+static bool
+ParseMemoised(OpenTypeFile *header, unsigned i, const uint8_t *data,
+              size_t length, OTCCache *memo, BypassTable *bypass) {
+  OTCHash key;
+  otc_hash_table(&key, otc_cache_hash_key(memo), table_parsers[i].tag,
+                 header->maxp->num_glyphs, data, length);
+
+  OTCCacheEntry *entry = otc_cache_acquire(memo, key);
+  if (!entry) {
+    entry = otc_cache_entry_new(key);
+    entry->ok = table_parsers[i].parse(header, data, length);
+    if (entry->ok) {
+      VectorStream stream(&entry->output);
+      entry->ok = table_parsers[i].serialise(&stream, header) &&
+                  stream.Flush();
+      // Only the whole words are summed: any trailing bytes are summed with
+      // the padding when the table is written.
+      if (entry->output.size() >= 4) {
+        entry->chksum = otc_checksum_words(&entry->output[0],
+                                           entry->output.size() / 4);
+      }
+    }
+    if (!entry->ok)
+      entry->output.clear();
+    entry = otc_cache_insert(memo, entry);
+  }
+
+  bypass->tag = table_parsers[i].tag;
+  bypass->data = entry->output.empty() ? NULL : &entry->output[0];
+  bypass->length = entry->output.size();
+  bypass->memo = entry;
+
+  if (!entry->ok)
+    return failure();
+  return true;
+}
+
+// Returns a mask of the indices in |table_parsers| of the tables which table
+// |i| depends on.
+static uint32_t
+TableDependencies(unsigned i) {
+  uint32_t dependencies = 0;
+  for (const char *after = table_parsers[i].after; *after;
+       after += after[4] ? 5 : 4) {
+    for (unsigned j = 0; table_parsers[j].parse; ++j) {
+      if (table_parsers[j].tag == tag(after))
+        dependencies |= 1u << j;
+    }
+  }
+  return dependencies;
+}
+
+// The state shared by the parsers of one file when they run on several threads
+struct ParseJob {
+  OpenTypeFile *header;
+  const OTCOptions *options;
+  // The input table for each entry of |table_parsers|, or NULL if it's missing
+  std::vector<const OpenTypeTableData*> tables;
+  // The memoised tables, with |memo| set, indexed as |tables|
+  std::vector<BypassTable> memo_tables;
+};
+
+static bool
+ParseTable(void *arg, size_t i) {
+  ParseJob *job = static_cast<ParseJob*>(arg);
+  const OpenTypeTableData *table = job->tables[i];
+  if (!table)
+    return true;
+
+  OTCCache *memo = TableMemo(table_parsers[i].tag, *job->options);
+  if (memo) {
+    return ParseMemoised(job->header, i, table->data, table->length, memo,
+                         &job->memo_tables[i]);
+  }
+
+  return table_parsers[i].parse(job->header, table->data, table->length);
+}
+
+static bool
+ParseGeneric(OpenTypeFile *header, const uint8_t *data, size_t length,
+             std::vector<BypassTable> *bypass_tables,
+             const OTCOptions &options) {
+  // we disallow all files > 1GB in size for sanity.
+  if (length > 1024 * 1024 * 1024)
+    return failure();
+
+  std::vector<OpenTypeTableData> tables;
+  if (length >= 4 && !memcmp(data, "wOFF", 4)) {
+    if (!otc_woff_read_tables(header, data, length, &tables))
+      return failure();
+  } else if (!ReadSFNTTables(header, data, length, &tables)) {
+    return failure();
+  }
+
+  std::map<uint32_t, OpenTypeTableData> table_map;
+  for (unsigned i = 0; i < tables.size(); ++i) {
     table_map[tables[i].tag] = tables[i];
+    header->input_chksums[tables[i].tag] = tables[i].chksum;
+  }
 
-  const struct {
-    uint32_t tag;
-    bool (*parse) (OpenTypeFile *otf, const uint8_t *data, size_t length);
-    bool (*serialise) (OTCStream *out, OpenTypeFile *file);
-    bool (*should_serialise) (OpenTypeFile *file);
-    void (*free) (OpenTypeFile *file);
-    bool required;
-    bool bypass;
-  } table_parsers[] = {
-    { tag("maxp"), otc_maxp_parse, otc_maxp_serialise, otc_maxp_should_serialise, otc_maxp_free, 1, 0 },
-    { tag("cmap"), otc_cmap_parse, otc_cmap_serialise, otc_cmap_should_serialise, otc_cmap_free, 1, 0 },
-    { tag("head"), otc_head_parse, otc_head_serialise, otc_head_should_serialise, otc_head_free, 1, 0 },
-    { tag("hhea"), otc_hhea_parse, otc_hhea_serialise, otc_hhea_should_serialise, otc_hhea_free, 1, 0 },
-    { tag("hmtx"), otc_hmtx_parse, otc_hmtx_serialise, otc_hmtx_should_serialise, otc_hmtx_free, 1, 0 },
-    { tag("name"), otc_name_parse, otc_name_serialise, otc_name_should_serialise, otc_name_free, 1, 0 },
-    { tag("OS/2"), otc_os2_parse, otc_os2_serialise, otc_os2_should_serialise, otc_os2_free, 1, 0 },
-    { tag("post"), otc_post_parse, otc_post_serialise, otc_post_should_serialise, otc_post_free, 1, 0 },
-    { tag("loca"), otc_loca_parse, otc_loca_serialise, otc_loca_should_serialise, otc_loca_free, 1, 0 },
-    { tag("glyf"), otc_glyf_parse, otc_glyf_serialise, otc_glyf_should_serialise, otc_glyf_free, 1, 0 },
-    { 0, NULL, NULL, NULL, 0 },
-  };
+  header->num_threads = options.num_threads;
 
-  std::vector<BypassTable> bypass_tables;
+  ParseJob job;
+  job.header = header;
+  job.options = &options;
+  std::vector<uint32_t> dependencies;
 
   for (unsigned i = 0; ; ++i) {
     if (table_parsers[i].parse == NULL)
       break;
 
-    const std::map<uint32_t, OpenTypeTable>::const_iterator
+    BypassTable memo_table;
+    memo_table.memo = NULL;
+    job.memo_tables.push_back(memo_table);
+    job.tables.push_back(NULL);
+    dependencies.push_back(TableDependencies(i));
+
+    const std::map<uint32_t, OpenTypeTableData>::const_iterator
       it = table_map.find(table_parsers[i].tag);
 
     if (it == table_map.end()) {
@@ -190,17 +424,53 @@ otc_process(OTCStream *output, const uint8_t *data, size_t length) {
 
     if (table_parsers[i].bypass) {
       BypassTable bypass;
-      bypass.offset = it->second.offset;
+      bypass.data = it->second.data;
       bypass.length = it->second.length;
       bypass.tag = table_parsers[i].tag;
-      bypass_tables.push_back(bypass);
+      bypass.memo = NULL;
+      bypass_tables->push_back(bypass);
     }
 
-    if (!table_parsers[i].parse(&header, data + it->second.offset, it->second.length))
-      return failure();
+    job.tables[i] = &it->second;
+  }
+
+  // Each table is parsed as soon as the tables it depends on have been, so
+  // the time taken approaches that of the longest chain of dependencies
+  // (maxp, head, loca, glyf) rather than the sum of every table.
+  const bool result = otc_parallel_graph(job.tables.size(), &dependencies[0],
+                                         options.num_threads, ParseTable,
+                                         &job);
+
+  // Even if parsing failed, the memoised tables are added so that their
+  // references are released along with the rest.
+  for (unsigned i = 0; i < job.memo_tables.size(); ++i) {
+    if (job.memo_tables[i].memo)
+      bypass_tables->push_back(job.memo_tables[i]);
+  }
+
+  if (!result)
+    return failure();
+  return true;
+}
+
+// Find the list of tables which will be written, in the order in which
+// they'll be written.
+static void
+GetTableSources(OpenTypeFile *header,
+                const std::vector<BypassTable> &bypass_tables,
+                std::vector<TableSource> *sources) {
+  for (unsigned i = 0; i < bypass_tables.size(); ++i) {
+    // Memoised tables are written in the place of the parsed ones, below.
+    if (bypass_tables[i].memo)
+      continue;
+
+    TableSource source;
+    source.tag = bypass_tables[i].tag;
+    source.bypass = &bypass_tables[i];
+    source.serialise = NULL;
+    sources->push_back(source);
   }
 
-  unsigned num_output_tables = 0;
   for (unsigned i = 0; ; ++i) {
     if (table_parsers[i].parse == NULL)
       break;
@@ -208,45 +478,107 @@ otc_process(OTCStream *output, const uint8_t *data, size_t length) {
     if (table_parsers[i].bypass)
       continue;
 
-    if (table_parsers[i].should_serialise(&header))
-      num_output_tables++;
+    TableSource source;
+    source.tag = table_parsers[i].tag;
+    source.bypass = NULL;
+    source.serialise = table_parsers[i].serialise;
+    for (unsigned j = 0; j < bypass_tables.size(); ++j) {
+      if (bypass_tables[j].memo && bypass_tables[j].tag == source.tag) {
+        source.bypass = &bypass_tables[j];
+        source.serialise = NULL;
+      }
+    }
+
+    if (!source.bypass && !table_parsers[i].should_serialise(header))
+      continue;
+
+    sources->push_back(source);
   }
+}
 
-  num_output_tables += bypass_tables.size();
+// Write a single table, without any padding, to |out|
+static bool
+WriteTable(OTCStream *out, OpenTypeFile *header, const TableSource &source) {
+  if (source.bypass && source.bypass->memo) {
+    return out->WriteWithChecksum(source.bypass->data, source.bypass->length,
+                                  source.bypass->memo->chksum);
+  }
+  if (source.bypass)
+    return out->Write(source.bypass->data, source.bypass->length);
+  return source.serialise(out, header);
+}
 
-  max_pow2 = 0;
+static bool
+WriteOffsetTable(OTCStream *out, unsigned num_output_tables) {
+  unsigned max_pow2 = 0;
   while (1u << (max_pow2 + 1) < num_output_tables)
     max_pow2++;
   const uint16_t output_search_range = (1 << max_pow2) << 4;
 
+  return out->WriteU32(0x00010000) &&
+         out->WriteU16(num_output_tables) &&
+         out->WriteU16(output_search_range) &&
+         out->WriteU16(max_pow2) &&
+         out->WriteU16((num_output_tables << 4) - output_search_range);
+}
+
+// Write the table records for |out_tables|, which must be sorted by tag.
+// |tables_chksum| is set to the sum of the checksums of the tables.
+static bool
+WriteTableRecords(OTCStream *out, const std::vector<OutputTable> &out_tables,
+                  uint32_t *tables_chksum) {
+  *tables_chksum = 0;
+  for (unsigned i = 0; i < out_tables.size(); ++i) {
+    if (!out->WriteTag(out_tables[i].tag) ||
+        !out->WriteU32(out_tables[i].chksum) ||
+        !out->WriteU32(out_tables[i].offset) ||
+        !out->WriteU32(out_tables[i].length)) {
+      return failure();
+    }
+    *tables_chksum += out_tables[i].chksum;
+  }
+
+  return true;
+}
+
+// http://www.microsoft.com/typography/otspec/otff.htm
+static uint32_t
+ChecksumAdjustment(uint32_t file_chksum) {
+  return static_cast<uint32_t>(0xb1b0afba) - file_chksum;
+}
+
+static bool
+SerialiseSeeking(OTCStream *output, OpenTypeFile *header,
+                 const std::vector<TableSource> &sources) {
   output->ResetChecksum();
-  if (!output->WriteU32(0x00010000) ||
-      !output->WriteU16(num_output_tables) ||
-      !output->WriteU16(output_search_range) ||
-      !output->WriteU16(max_pow2) ||
-      !output->WriteU16((num_output_tables << 4) - output_search_range)) {
+  if (!WriteOffsetTable(output, sources.size()))
     return failure();
-  }
   const uint32_t offset_table_chksum = output->chksum();
 
+  if (!output->Flush())
+    return failure();
   const size_t table_record_offset = output->Tell();
-  output->Pad(16 * num_output_tables);
+  output->Pad(16 * sources.size());
 
   std::vector<OutputTable> out_tables;
 
   size_t head_table_offset = 0;
-  for (unsigned i = 0; i < bypass_tables.size(); ++i) {
-    const BypassTable &bypass = bypass_tables[i];
+  for (unsigned i = 0; i < sources.size(); ++i) {
+    if (!output->Flush())
+      return failure();
 
     OutputTable out;
-    out.tag = bypass.tag;
+    out.tag = sources[i].tag;
     out.offset = output->Tell();
 
     output->ResetChecksum();
-    if (bypass.tag == tag("head"))
+    if (sources[i].tag == tag("head"))
       head_table_offset = out.offset;
-    if (!output->Write(data + bypass.offset, bypass.length))
+    if (!WriteTable(output, header, sources[i]) ||
+        !output->Flush()) {
       return failure();
+    }
+
     const size_t end_offset = output->Tell();
     out.length = end_offset - out.offset;
 
@@ -256,71 +588,401 @@ otc_process(OTCStream *output, const uint8_t *data, size_t length) {
     out_tables.push_back(out);
   }
 
-  for (unsigned i = 0; ; ++i) {
-    if (table_parsers[i].parse == NULL)
-      break;
+  if (!output->Flush())
+    return failure();
+  const size_t end_of_file = output->Tell();
 
-    if (table_parsers[i].bypass)
-      continue;
+  // Need to sort the output tables for inclusion in the file
+  std::sort(out_tables.begin(), out_tables.end(), OutputTable::SortByTag);
+  output->Seek(table_record_offset);
 
-    if (!table_parsers[i].should_serialise(&header))
-      continue;
+  output->ResetChecksum();
+  uint32_t tables_chksum;
+  if (!WriteTableRecords(output, out_tables, &tables_chksum))
+    return failure();
+  const uint32_t table_record_chksum = output->chksum();
+  if (!output->Flush())
+    return failure();
+
+  const uint32_t file_chksum = offset_table_chksum + tables_chksum + table_record_chksum;
+
+  // seek into the 'head' table and write in the checksum magic value
+  assert(head_table_offset != 0);
+  output->Seek(head_table_offset + 8);
+  if (!output->WriteU32(ChecksumAdjustment(file_chksum)) ||
+      !output->Flush()) {
+    return failure();
+  }
+
+  output->Seek(end_of_file);
+
+  return true;
+}
 
+// Calculate the offset, length and checksum of each table, in the order given
+// by |sources|, without writing anything. If not NULL, |file_length| is set to
+// the total length of the output.
+static bool
+LayoutTables(OpenTypeFile *header, const std::vector<TableSource> &sources,
+             std::vector<OutputTable> *out_tables, size_t *file_length) {
+  CountingStream counter;
+  size_t offset = 12 + 16 * sources.size();
+
+  for (unsigned i = 0; i < sources.size(); ++i) {
     OutputTable out;
-    out.tag = table_parsers[i].tag;
-    out.offset = output->Tell();
+    out.tag = sources[i].tag;
+    out.offset = offset;
 
-    output->ResetChecksum();
-    if (table_parsers[i].tag == tag("head"))
-      head_table_offset = out.offset;
-    if (!table_parsers[i].serialise(output, &header))
+    counter.ResetChecksum();
+    counter.Flush();
+    const off_t start = counter.Tell();
+    if (!WriteTable(&counter, header, sources[i]))
       return failure();
+    counter.Flush();
+    out.length = counter.Tell() - start;
 
-    const size_t end_offset = output->Tell();
-    out.length = end_offset - out.offset;
+    // Every table starts on a four byte boundary so we can calculate the
+    // padding from the length alone.
+    counter.Pad((4 - (out.length & 3)) % 4);
+    out.chksum = counter.chksum();
+    out_tables->push_back(out);
 
-    // align tables to four bytes
-    output->Pad((4 - (end_offset & 3)) % 4);
-    out.chksum = output->chksum();
-    out_tables.push_back(out);
+    offset += Round4(out.length);
   }
 
-  const size_t end_of_file = output->Tell();
+  if (file_length)
+    *file_length = offset;
 
-  // Need to sort the output tables for inclusion in the file
-  std::sort(out_tables.begin(), out_tables.end(), OutputTable::SortByTag);
-  output->Seek(table_record_offset);
+  return true;
+}
+
+static bool
+SerialiseForwardOnly(OTCStream *output, OpenTypeFile *header,
+                     const std::vector<TableSource> &sources) {
+  // We can only fill in the checksum adjustment if we serialise the 'head'
+  // table ourselves.
+  for (unsigned i = 0; i < sources.size(); ++i) {
+    if (sources[i].tag == tag("head") && sources[i].bypass)
+      return failure();
+  }
+
+  std::vector<OutputTable> out_tables;
+  if (!LayoutTables(header, sources, &out_tables, NULL))
+    return failure();
 
   output->ResetChecksum();
-  uint32_t tables_chksum = 0;
-  for (unsigned i = 0; i < out_tables.size(); ++i) {
-    if (!output->WriteTag(out_tables[i].tag) ||
-        !output->WriteU32(out_tables[i].chksum) ||
-        !output->WriteU32(out_tables[i].offset) ||
-        !output->WriteU32(out_tables[i].length)) {
+  if (!WriteOffsetTable(output, sources.size()))
+    return failure();
+  const uint32_t offset_table_chksum = output->chksum();
+
+  std::vector<OutputTable> sorted_tables(out_tables);
+  std::sort(sorted_tables.begin(), sorted_tables.end(), OutputTable::SortByTag);
+
+  output->ResetChecksum();
+  uint32_t tables_chksum;
+  if (!WriteTableRecords(output, sorted_tables, &tables_chksum))
+    return failure();
+  const uint32_t table_record_chksum = output->chksum();
+
+  // The checksum of the 'head' table was calculated with a zero checksum
+  // adjustment so, just as when seeking back to fill it in, the sum of the
+  // tables' checksums is unaffected by setting it now.
+  const uint32_t file_chksum = offset_table_chksum + tables_chksum + table_record_chksum;
+  header->head->checksum_adjustment = ChecksumAdjustment(file_chksum);
+
+  for (unsigned i = 0; i < sources.size(); ++i) {
+    if (!WriteTable(output, header, sources[i]))
+      return failure();
+    output->Pad((4 - (out_tables[i].length & 3)) % 4);
+  }
+
+  if (!output->Flush())
+    return failure();
+
+  return true;
+}
+
+static bool
+SortSourcesByTag(const TableSource &a, const TableSource &b) {
+  return ntohl(a.tag) < ntohl(b.tag);
+}
+
+static bool
+SerialiseWOFF(OTCStream *output, OpenTypeFile *header,
+              const std::vector<TableSource> &sources,
+              const OTCOptions &options) {
+  // The glyf transform may change the head table, so it's done first.
+  std::vector<uint8_t> transformed_glyf;
+  bool glyf_transformed = false;
+  if (options.output_format == OTC_OUTPUT_WOFF2)
+    glyf_transformed = otc_woff2_transform_glyf(header, &transformed_glyf);
+
+  // The tables of a WOFF file are in tag order, so the equivalent OpenType
+  // file (which the checksum adjustment is calculated for) is too.
+  std::vector<TableSource> sorted_sources(sources);
+  std::sort(sorted_sources.begin(), sorted_sources.end(), SortSourcesByTag);
+
+  std::vector<OTCSerialisedTable> tables(sorted_sources.size());
+  std::vector<OutputTable> out_tables;
+  size_t offset = 12 + 16 * sorted_sources.size();
+  std::vector<uint8_t> *head_data = NULL;
+
+  for (unsigned i = 0; i < sorted_sources.size(); ++i) {
+    OTCSerialisedTable &table = tables[i];
+    table.tag = sorted_sources[i].tag;
+    if (table.tag == tag("head"))
+      head_data = &table.data;
+
+    VectorStream stream(&table.data);
+    if (!WriteTable(&stream, header, sorted_sources[i]) ||
+        !stream.Flush()) {
       return failure();
     }
-    tables_chksum += out_tables[i].chksum;
+    const size_t length = table.data.size();
+
+    // The padding is only written to complete the checksum and is then
+    // dropped: otc_woff_write pads the stored tables itself.
+    stream.Pad((4 - (length & 3)) % 4);
+    table.chksum = stream.chksum();
+    table.data.resize(length);
+
+    OutputTable out;
+    out.tag = table.tag;
+    out.offset = offset;
+    out.length = length;
+    out.chksum = table.chksum;
+    out_tables.push_back(out);
+
+    offset += Round4(length);
   }
-  const uint32_t table_record_chksum = output->chksum();
 
-  // http://www.microsoft.com/typography/otspec/otff.htm
+  if (!head_data || head_data->size() < 12)
+    return failure();
+
+  // The checksum of the 'head' table was calculated with a zero checksum
+  // adjustment, which is what origChecksum should be, so it's patched into
+  // the serialised table afterwards.
+  CountingStream counter;
+  counter.ResetChecksum();
+  if (!WriteOffsetTable(&counter, out_tables.size()))
+    return failure();
+  const uint32_t offset_table_chksum = counter.chksum();
+  counter.ResetChecksum();
+  uint32_t tables_chksum;
+  if (!WriteTableRecords(&counter, out_tables, &tables_chksum))
+    return failure();
+  const uint32_t table_record_chksum = counter.chksum();
+
   const uint32_t file_chksum = offset_table_chksum + tables_chksum + table_record_chksum;
-  const uint32_t chksum_magic = static_cast<uint32_t>(0xb1b0afba) - file_chksum;
+  const uint32_t adjustment = htonl(ChecksumAdjustment(file_chksum));
+  memcpy(&(*head_data)[8], &adjustment, 4);
 
-  // seek into the 'head' table and write in the checksum magic value
-  assert(head_table_offset != 0);
-  output->Seek(head_table_offset + 8);
-  output->WriteU32(chksum_magic);
+  if (options.output_format == OTC_OUTPUT_WOFF2) {
+    return otc_woff2_write(output, tables,
+                           glyf_transformed ? &transformed_glyf : NULL);
+  }
+  return otc_woff_write(output, tables, options.num_threads);
+}
 
-  output->Seek(end_of_file);
+// Write |header| to |output| in the format which |options| asks for
+static bool
+Serialise(OTCStream *output, OpenTypeFile *header,
+          const std::vector<TableSource> &sources, const OTCOptions &options) {
+  if (options.output_format != OTC_OUTPUT_SFNT)
+    return SerialiseWOFF(output, header, sources, options);
+  if (options.forward_only)
+    return SerialiseForwardOnly(output, header, sources);
+  return SerialiseSeeking(output, header, sources);
+}
 
+static void
+FreeGeneric(OpenTypeFile *header) {
+  // Since the table pointers start out as NULL, this is safe even if we failed
+  // before reaching a given table.
   for (unsigned i = 0; ; ++i) {
     if (table_parsers[i].parse == NULL)
       break;
 
-    table_parsers[i].free(&header);
+    table_parsers[i].free(header);
+  }
+}
+
+// Drop the references to any memoised tables in |bypass_tables|
+static void
+ReleaseMemoTables(const std::vector<BypassTable> &bypass_tables,
+                  const OTCOptions &options) {
+  for (unsigned i = 0; i < bypass_tables.size(); ++i) {
+    if (bypass_tables[i].memo)
+      otc_cache_release(options.table_memo, bypass_tables[i].memo);
+  }
+}
+
+// Apply the size optimisations which |options| asks for to |file|
+static void
+CompactTables(OpenTypeFile *file, const OTCOptions &options) {
+  OTCCompactStats stats;
+  if (options.compact) {
+    stats.loca = otc_loca_compact(file);
+    stats.hmtx = otc_hmtx_compact(file);
+    stats.cmap = otc_cmap_compact(file);
+  }
+  if (options.drop_glyph_names)
+    stats.post = otc_post_compact(file);
+
+  if (options.compact_stats) {
+    options.compact_stats->loca += stats.loca;
+    options.compact_stats->hmtx += stats.hmtx;
+    options.compact_stats->post += stats.post;
+    options.compact_stats->cmap += stats.cmap;
+  }
+}
+
+// Parse |data| into |header| and, if |options| asks for a subset, build that
+// in |subset|. |*file| is set to whichever of the two should be written.
+static bool
+ParseWithOptions(OpenTypeFile *header, OpenTypeFile *subset,
+                 OpenTypeFile **file, const uint8_t *data, size_t length,
+                 std::vector<BypassTable> *bypass_tables,
+                 const OTCOptions &options) {
+  *file = header;
+  if (!ParseGeneric(header, data, length, bypass_tables, options))
+    return false;
+
+  if (options.subset) {
+    *file = subset;
+    subset->num_threads = options.num_threads;
+    OTCCMAPIndex *index = otc_cmap_build_index(header);
+    const bool result = otc_subset(subset, header, index, *options.subset);
+    otc_cmap_index_free(index);
+    if (!result)
+      return false;
+  }
+
+  CompactTables(*file, options);
+  return true;
+}
+
+bool
+otc_process(OTCStream *output, const uint8_t *data, size_t length,
+            const OTCOptions &options) {
+  OpenTypeFile header, subset;
+  OpenTypeFile *file;
+  std::vector<BypassTable> bypass_tables;
+  std::vector<TableSource> sources;
+
+  bool result = ParseWithOptions(&header, &subset, &file, data, length,
+                                 &bypass_tables, options);
+  if (result) {
+    GetTableSources(file, bypass_tables, &sources);
+    result = Serialise(output, file, sources, options);
+  }
+
+  if (result && options.cmap_index)
+    *options.cmap_index = otc_cmap_build_index(file);
+  if (result && options.coverage)
+    otc_cmap_coverage(file, options.coverage);
+
+  // Whether or not we succeeded, we free everything the table parsers might
+  // have allocated. (The subset may refer to data in |header|, so it's freed
+  // first.)
+  FreeGeneric(&subset);
+  FreeGeneric(&header);
+  ReleaseMemoTables(bypass_tables, options);
+
+  return result;
+}
+
+bool
+otc_process_slices(OTCStream *const *outputs, const uint8_t *data,
+                   size_t length,
+                   const std::vector<std::vector<uint32_t> > &slices,
+                   const OTCOptions &options) {
+  OpenTypeFile header;
+  std::vector<BypassTable> bypass_tables;
+
+  // The font is parsed and validated once. Each slice is then built from, and
+  // written from, the same parsed tables.
+  // The slices are built from the parsed tables, so none of them can be
+  // memoised.
+  OTCOptions parse_options;
+  parse_options.num_threads = options.num_threads;
+  bool result = ParseGeneric(&header, data, length, &bypass_tables,
+                             parse_options);
+  OTCCMAPIndex *index = NULL;
+  if (result)
+    index = otc_cmap_build_index(&header);
+
+  for (unsigned i = 0; result && i < slices.size(); ++i) {
+    OpenTypeFile subset;
+    std::vector<TableSource> sources;
+
+    subset.num_threads = options.num_threads;
+    result = otc_subset(&subset, &header, index, slices[i]);
+    if (result) {
+      CompactTables(&subset, options);
+      GetTableSources(&subset, bypass_tables, &sources);
+      result = Serialise(outputs[i], &subset, sources, options);
+    }
+
+    FreeGeneric(&subset);
+  }
+
+  if (index)
+    otc_cmap_index_free(index);
+  FreeGeneric(&header);
+
+  return result;
+}
+
+bool
+otc_process(OTCStream *output, const uint8_t *data, size_t length) {
+  return otc_process(output, data, length, OTCOptions());
+}
+
+bool
+otc_output_size(size_t *output_length, const uint8_t *data, size_t length,
+                const OTCOptions &options) {
+  OpenTypeFile header, subset;
+  OpenTypeFile *file;
+  std::vector<BypassTable> bypass_tables;
+  std::vector<TableSource> sources;
+  std::vector<OutputTable> out_tables;
+
+  bool result = ParseWithOptions(&header, &subset, &file, data, length,
+                                 &bypass_tables, options);
+  if (result) {
+    GetTableSources(file, bypass_tables, &sources);
+    if (options.output_format != OTC_OUTPUT_SFNT) {
+      // The size of a WOFF file depends on how well each table compresses,
+      // so there's nothing for it but to write it.
+      CountingStream counter;
+      result = SerialiseWOFF(&counter, file, sources, options);
+      *output_length = counter.Tell();
+    } else {
+      result = LayoutTables(file, sources, &out_tables, output_length);
+    }
   }
 
+  if (result && options.cmap_index)
+    *options.cmap_index = otc_cmap_build_index(file);
+  if (result && options.coverage)
+    otc_cmap_coverage(file, options.coverage);
+
+  FreeGeneric(&subset);
+  FreeGeneric(&header);
+  ReleaseMemoTables(bypass_tables, options);
+
+  return result;
+}
+
+bool
+otc_process_buffer(uint8_t *output, size_t output_length, size_t *written,
+                   const uint8_t *data, size_t length,
+                   const OTCOptions &options) {
+  MemoryStream stream(output, output_length);
+  if (!otc_process(&stream, data, length, options))
+    return false;
+
+  *written = stream.Tell();
   return true;
 }
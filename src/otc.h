@@ -4,10 +4,13 @@
 #include <stdint.h>
 #include <string.h>
 
-#include "opentype-condom.h"
+#include <map>
 
-#define OTC_DEBUG
+#include "opentype-condom.h"
+#include "array.h"
 
+// Define OTC_DEBUG to abort() as soon as a font is rejected, which makes it
+// easy to find out why in a debugger. Otherwise the failure is returned.
 #if defined(OTC_DEBUG)
 #include <stdlib.h>
 #endif
@@ -20,6 +23,19 @@ failure() {
   return false;
 }
 
+// Round a value up to the nearest multiple of 4. Note that this can overflow
+// and return zero.
+template<typename T>
+T Round4(T value) {
+  return (value + 3) & ~3;
+}
+
+// The version of the sanitiser's output. Increase it with any change which
+// could alter what otc_process writes for some input, or which inputs it
+// rejects: a persistent store (see otc_store_open) made by another version is
+// discarded.
+const uint32_t kOTCOutputVersion = 1;
+
 // -----------------------------------------------------------------------------
 // Buffer helper class
 //
@@ -87,16 +103,113 @@ class Buffer {
     return true;
   }
 
+  // The array readers below do a single bounds check for the whole array and
+  // validate the values in the same pass as converting them.
+
+  // Fails if any value is > |max_value|
+  bool ReadU16Array(uint16_t *values, size_t count,
+                    uint16_t max_value = 0xffff) {
+    if (!CheckArray(count, 2) ||
+        !otc_load_u16_array(values, buffer_ + offset_, count, max_value)) {
+      return failure();
+    }
+    offset_ += count * 2;
+    return true;
+  }
+
+  // Fails if any value is < |min_value|
+  bool ReadS16Array(int16_t *values, size_t count,
+                    int16_t min_value = -32768) {
+    if (!CheckArray(count, 2) ||
+        !otc_load_s16_array(values, buffer_ + offset_, count, min_value)) {
+      return failure();
+    }
+    offset_ += count * 2;
+    return true;
+  }
+
+  // Reads |count| pairs of (uint16_t, int16_t) into |values|, which must have
+  // space for 2 * |count| elements. Fails if the first value of any pair is
+  // > |max_first| or the second is < |min_second|.
+  bool ReadU16S16Array(uint16_t *values, size_t count, uint16_t max_first,
+                       int16_t min_second) {
+    if (!CheckArray(count, 4) ||
+        !otc_load_u16_s16_array(values, buffer_ + offset_, count, max_first,
+                                min_second)) {
+      return failure();
+    }
+    offset_ += count * 4;
+    return true;
+  }
+
+  // Reads 16-bit values into |values|, shifting each left by |shift|. Fails
+  // unless the values are monotonically increasing.
+  bool ReadMonotonicU16Array(uint32_t *values, size_t count, unsigned shift) {
+    if (!CheckArray(count, 2) ||
+        !otc_load_monotonic_u16_array(values, buffer_ + offset_, count, shift)) {
+      return failure();
+    }
+    offset_ += count * 2;
+    return true;
+  }
+
+  // Fails unless the values are monotonically increasing.
+  bool ReadMonotonicU32Array(uint32_t *values, size_t count) {
+    if (!CheckArray(count, 4) ||
+        !otc_load_monotonic_u32_array(values, buffer_ + offset_, count)) {
+      return failure();
+    }
+    offset_ += count * 4;
+    return true;
+  }
+
   size_t offset() const { return offset_; }
 
   void set_offset(size_t newoffset) { offset_ = newoffset; }
 
 private:
+  // Check that |count| elements of |element_size| bytes are available
+  bool CheckArray(size_t count, size_t element_size) const {
+    if (offset_ > length_ || count > (length_ - offset_) / element_size)
+      return false;
+    return true;
+  }
+
   const uint8_t *const buffer_;
   const size_t length_;
   size_t offset_;
 };
 
+// An OTCStream which writes into a growable buffer, owned by the caller.
+class VectorStream : public OTCStream {
+ public:
+  explicit VectorStream(std::vector<uint8_t> *buffer)
+      : buffer_(buffer),
+        position_(0) {
+  }
+
+  bool WriteRaw(const void *data, size_t length) {
+    if (buffer_->size() < position_ + length)
+      buffer_->resize(position_ + length);
+    if (length)
+      memcpy(&(*buffer_)[position_], data, length);
+    position_ += length;
+    return true;
+  }
+
+  void Seek(off_t position) {
+    position_ = position;
+  }
+
+  off_t Tell() const {
+    return position_;
+  }
+
+ private:
+  std::vector<uint8_t> *const buffer_;
+  size_t position_;
+};
+
 #define FOR_EACH_TABLE_TYPE \
   F(cmap, CMAP) \
   F(head, HEAD) \
@@ -113,9 +226,18 @@ private:
 FOR_EACH_TABLE_TYPE
 #undef F
 
+// A table of the input file, before it's parsed
+struct OpenTypeTableData {
+  uint32_t tag;
+  const uint8_t *data;
+  size_t length;
+  uint32_t chksum;  // as given by the table directory, and not yet verified
+};
+
 // http://www.microsoft.com/typography/otspec/otff.htm
 struct OpenTypeFile {
-  OpenTypeFile() {
+  OpenTypeFile()
+      : num_threads(1) {
 #define F(name, capname) name = NULL;
     FOR_EACH_TABLE_TYPE
 #undef F
@@ -126,9 +248,30 @@ struct OpenTypeFile {
   uint16_t entry_selector;
   uint16_t range_shift;
 
+  // The decompressed tables of a WOFF file. The parsed tables may point into
+  // these, just as they point into an OpenType input file.
+  std::vector<std::vector<uint8_t> > table_buffers;
+
+  // The checksums of the input tables, from the table directory, by tag. See
+  // otc_verify_checksum.
+  std::map<uint32_t, uint32_t> input_chksums;
+
+  // The number of threads which a single table may use to parse or serialise
+  // itself, as OTCOptions::num_threads.
+  unsigned num_threads;
+
 #define F(name, capname) OpenType##capname *name;
 FOR_EACH_TABLE_TYPE
 #undef F
 };
 
+// If the table directory's checksum for the input table |tag|, which is
+// |length| bytes at |data|, is right then set |*words_chksum| to the sum of
+// the table's whole words and return true. A table which is written as it
+// was found can then be written with OTCStream::WriteWithChecksum, without
+// summing it again however many times it's written.
+bool otc_verify_checksum(const OpenTypeFile *file, uint32_t tag,
+                         const uint8_t *data, size_t length,
+                         uint32_t *words_chksum);
+
 #endif  // OTC_H_
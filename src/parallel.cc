@@ -0,0 +1,176 @@
+#include <pthread.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "parallel.h"
+
+// The worker pool of otc_parallel_for needs no locking: each worker claims the
+// index of the next unprocessed item with an atomic increment and everything
+// else is owned by the caller's |work| function. otc_parallel_graph has to
+// track which items have finished, so its workers share a lock, but it's only
+// held between items.
+
+namespace {
+
+struct ParallelJob {
+  void (*work) (void *arg, size_t i);
+  void *arg;
+  size_t count;
+  size_t next;  // index of the next unclaimed item. Updated atomically.
+};
+
+void *
+ParallelWorker(void *arg) {
+  ParallelJob *job = static_cast<ParallelJob*>(arg);
+
+  for (;;) {
+    const size_t i = __sync_fetch_and_add(&job->next, 1);
+    if (i >= job->count)
+      break;
+
+    job->work(job->arg, i);
+  }
+
+  return NULL;
+}
+
+struct GraphJob {
+  bool (*work) (void *arg, size_t i);
+  void *arg;
+  size_t count;
+  const uint32_t *dependencies;
+
+  pthread_mutex_t lock;
+  pthread_cond_t finished;  // signalled whenever an item finishes
+  uint32_t started;  // bit i is set once item i has been claimed
+  uint32_t done;  // bit i is set once item i has returned true
+  unsigned running;
+  bool failed;
+};
+
+void *
+GraphWorker(void *arg) {
+  GraphJob *job = static_cast<GraphJob*>(arg);
+  const uint32_t all = job->count == 32 ? 0xffffffff : (1u << job->count) - 1;
+
+  pthread_mutex_lock(&job->lock);
+  while (!job->failed && job->started != all) {
+    size_t i;
+    for (i = 0; i < job->count; ++i) {
+      if (!(job->started & (1u << i)) &&
+          !(job->dependencies[i] & ~job->done)) {
+        break;
+      }
+    }
+
+    if (i == job->count) {
+      // Nothing is ready, so wait for one of the running items to finish.
+      // If nothing is running either, the dependencies have a cycle.
+      if (!job->running) {
+        job->failed = true;
+        break;
+      }
+      pthread_cond_wait(&job->finished, &job->lock);
+      continue;
+    }
+
+    job->started |= 1u << i;
+    job->running++;
+    pthread_mutex_unlock(&job->lock);
+
+    const bool ok = job->work(job->arg, i);
+
+    pthread_mutex_lock(&job->lock);
+    job->running--;
+    if (ok) {
+      job->done |= 1u << i;
+    } else {
+      job->failed = true;
+    }
+    pthread_cond_broadcast(&job->finished);
+  }
+  pthread_mutex_unlock(&job->lock);
+
+  return NULL;
+}
+
+}  // anonymous namespace
+
+void
+otc_parallel_for(size_t count, unsigned num_threads,
+                 void (*work) (void *arg, size_t i), void *arg) {
+  if (!num_threads) {
+    const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = num_cpus > 0 ? num_cpus : 1;
+  }
+  if (num_threads > count)
+    num_threads = count;
+
+  ParallelJob job;
+  job.work = work;
+  job.arg = arg;
+  job.count = count;
+  job.next = 0;
+
+  // The calling thread is one of the workers, so we only need to start
+  // |num_threads| - 1 extra threads. If we fail to create some of them, the
+  // ones which did start (and this thread) will pick up the slack.
+  std::vector<pthread_t> threads;
+  for (unsigned i = 1; i < num_threads; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, ParallelWorker, &job))
+      break;
+    threads.push_back(thread);
+  }
+
+  ParallelWorker(&job);
+
+  for (unsigned i = 0; i < threads.size(); ++i)
+    pthread_join(threads[i], NULL);
+}
+
+bool
+otc_parallel_graph(size_t count, const uint32_t *dependencies,
+                   unsigned num_threads,
+                   bool (*work) (void *arg, size_t i), void *arg) {
+  if (count > 32)
+    return false;
+  if (!num_threads) {
+    const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = num_cpus > 0 ? num_cpus : 1;
+  }
+  if (num_threads > count)
+    num_threads = count;
+
+  GraphJob job;
+  job.work = work;
+  job.arg = arg;
+  job.count = count;
+  job.dependencies = dependencies;
+  pthread_mutex_init(&job.lock, NULL);
+  pthread_cond_init(&job.finished, NULL);
+  job.started = job.done = 0;
+  job.running = 0;
+  job.failed = false;
+
+  // As with otc_parallel_for, the calling thread is one of the workers and
+  // any threads which fail to start are made up for by the others.
+  std::vector<pthread_t> threads;
+  for (unsigned i = 1; i < num_threads; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, GraphWorker, &job))
+      break;
+    threads.push_back(thread);
+  }
+
+  GraphWorker(&job);
+
+  for (unsigned i = 0; i < threads.size(); ++i)
+    pthread_join(threads[i], NULL);
+
+  pthread_cond_destroy(&job.finished);
+  pthread_mutex_destroy(&job.lock);
+
+  return !job.failed;
+}
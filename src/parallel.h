@@ -0,0 +1,27 @@
+#ifndef OTC_PARALLEL_H_
+#define OTC_PARALLEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Call |work|(|arg|, i) for every i in [0, |count|) on a pool of at most
+// |num_threads| threads, including the calling thread, and wait for them all
+// to finish. If |num_threads| is zero, one thread per online CPU is used. The
+// calls may happen in any order and at the same time, so |work| must only
+// touch state which belongs to item i.
+void otc_parallel_for(size_t count, unsigned num_threads,
+                      void (*work) (void *arg, size_t i), void *arg);
+
+// Call |work|(|arg|, i) for every i in [0, |count|), where |count| <= 32, but
+// only once every item j for which bit j of |dependencies|[i] is set has
+// finished. Items whose dependencies have finished run at the same time on a
+// pool of at most |num_threads| threads, including the calling thread (zero
+// meaning one per online CPU). With one thread, the items are run in order of
+// index whenever the dependencies allow it. If any call returns false, no
+// more items are started and false is returned once those already started
+// have finished. The dependencies must not form a cycle.
+bool otc_parallel_graph(size_t count, const uint32_t *dependencies,
+                        unsigned num_threads,
+                        bool (*work) (void *arg, size_t i), void *arg);
+
+#endif  // OTC_PARALLEL_H_
@@ -1,6 +1,8 @@
 #include "otc.h"
 #include "post.h"
 #include "maxp.h"
+#include "subset.h"
+#include "compact.h"
 
 bool
 otc_post_parse(OpenTypeFile *file, const uint8_t *data, size_t length) {
@@ -43,10 +45,8 @@ otc_post_parse(OpenTypeFile *file, const uint8_t *data, size_t length) {
     return failure();
 
   post->glyph_name_index.resize(num_glyphs);
-  for (unsigned i = 0; i < num_glyphs; ++i) {
-    if (!table.ReadU16(&post->glyph_name_index[i]))
-      return failure();
-    if (post->glyph_name_index[i] >= 32768)
+  if (num_glyphs) {
+    if (!table.ReadU16Array(&post->glyph_name_index[0], num_glyphs, 32767))
       return failure();
   }
 
@@ -132,3 +132,72 @@ void
 otc_post_free(OpenTypeFile *file) {
   delete file->post;
 }
+
+bool
+otc_post_subset(OpenTypeFile *subset, OpenTypeFile *file,
+                const OTCGlyphMap &map) {
+  const OpenTypePOST *post = file->post;
+  OpenTypePOST *subset_post = new OpenTypePOST(*post);
+  subset->post = subset_post;
+
+  if (post->version == 0x00030000)
+    return true;
+
+  subset_post->glyph_name_index.clear();
+  subset_post->names.clear();
+
+  // A version 1 table gives glyph i the i-th standard Macintosh name. Since
+  // the glyphs are renumbered, we have to list the names explicitly.
+  const bool standard_names = post->version == 0x00010000;
+  subset_post->version = 0x00020000;
+
+  // Only the names of kept glyphs are kept, so the name indexes change too.
+  std::map<unsigned, unsigned> name_map;
+  for (unsigned i = 0; i < map.new_to_old.size(); ++i) {
+    const unsigned old_glyph = map.new_to_old[i];
+    unsigned name_index;
+    if (standard_names) {
+      // There are 258 standard names, so glyphs past this have none.
+      name_index = old_glyph < 258 ? old_glyph : 0;
+    } else {
+      name_index = post->glyph_name_index[old_glyph];
+    }
+
+    if (name_index >= 258) {
+      const std::map<unsigned, unsigned>::const_iterator
+        it = name_map.find(name_index);
+      if (it != name_map.end()) {
+        name_index = it->second;
+      } else {
+        const unsigned new_name_index = 258 + subset_post->names.size();
+        subset_post->names.push_back(post->names[name_index - 258]);
+        name_map[name_index] = new_name_index;
+        name_index = new_name_index;
+      }
+    }
+    subset_post->glyph_name_index.push_back(name_index);
+  }
+
+  return true;
+}
+
+size_t
+otc_post_compact(OpenTypeFile *file) {
+  OpenTypePOST *post = file->post;
+  if (post->version == 0x00030000)
+    return 0;
+
+  // A version 1 table has no names stored in it, only implied.
+  size_t saved = 0;
+  if (post->version == 0x00020000) {
+    saved = 2 + post->glyph_name_index.size() * 2;
+    for (unsigned i = 0; i < post->names.size(); ++i)
+      saved += 1 + post->names[i].size();
+  }
+
+  post->version = 0x00030000;
+  post->glyph_name_index.clear();
+  post->names.clear();
+
+  return saved;
+}
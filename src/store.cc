@@ -0,0 +1,597 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#include "otc.h"
+#include "hash.h"
+
+// The data file is the authority: it starts with a header holding the hash
+// key, followed by records, each a RecordHeader and then the output padded to
+// a multiple of eight bytes. Records are only ever appended. The header also
+// holds the kOTCOutputVersion of the sanitiser which wrote the records, and if
+// that isn't the running one, the store is emptied when it's opened.
+//
+// The index file is a header followed by an open-addressed (linear probing)
+// hash table of slots, each pointing at a record. It can always be rebuilt by
+// scanning the data file, so it's only trusted as far as its checksums go.
+// Rebuilding it checks every record's output, but an intact index is used as
+// it is, so the output of a record is checked the first time it's looked up
+// after the store is opened instead.
+//
+// Appending a record writes it with pwrite, waits for it to reach the disk and
+// only then publishes it in the index, so a crash can at worst leave a record
+// which isn't indexed. The data_length in the index header says how much of
+// the data file is known to be good, and anything past it is cut off when the
+// store is opened.
+//
+// Readers don't take any locks. A slot is filled in before its state word is
+// set with a release store (and read after an acquire load), and the data
+// mapping covers the whole of |max_bytes| from the start, so nothing which a
+// reader can see ever moves.
+//
+// The files are in the byte order of the machine which wrote them, since
+// they're a cache and not an interchange format.
+
+namespace {
+
+const uint32_t kDataMagic = 0x4f544344;  // 'OTCD'
+const uint32_t kIndexMagic = 0x4f544349;  // 'OTCI'
+const uint32_t kRecordMagic = 0x4f544352;  // 'OTCR'
+const uint32_t kVersion = 2;
+
+const uint32_t kSlotUsed = 1;
+const uint32_t kSlotOK = 2;  // the input was sanitised, not rejected
+const uint32_t kRecordOK = 1;
+
+struct DataHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint8_t hash_key[16];
+  uint32_t output_version;  // the kOTCOutputVersion of the records
+  uint32_t reserved;
+};
+
+struct RecordHeader {
+  uint32_t magic;
+  uint32_t flags;
+  uint64_t key[2];
+  uint64_t output_length;
+  uint64_t payload_check;  // a hash of the output
+  uint64_t header_check;  // a hash of the fields above
+};
+
+struct IndexHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t num_slots;  // always a power of two
+  uint8_t hash_key[16];  // must match the data file
+  uint64_t data_length;  // the length of the data file which is valid
+  uint64_t num_entries;
+  uint64_t reserved;
+  uint64_t header_check;  // a hash of the fields above
+};
+
+struct Slot {
+  uint64_t key[2];
+  uint64_t offset;  // of the RecordHeader in the data file
+  uint64_t output_length;
+  uint32_t state;  // zero if the slot is empty
+  uint32_t check;  // a hash of the fields above
+};
+
+// Return the low bits of the hash of |length| bytes at |data|
+uint64_t
+Check(const uint8_t key[16], const void *data, size_t length) {
+  OTCHash hash;
+  otc_hash(&hash, key, static_cast<const uint8_t*>(data), length);
+  return hash.words[0];
+}
+
+bool
+WriteAll(int fd, const void *data, size_t length, off_t offset) {
+  const uint8_t *p = static_cast<const uint8_t*>(data);
+  while (length) {
+    const ssize_t n = pwrite(fd, p, length, offset);
+    if (n <= 0)
+      return false;
+    p += n;
+    length -= n;
+    offset += n;
+  }
+  return true;
+}
+
+bool
+ReadAll(int fd, void *data, size_t length, off_t offset) {
+  uint8_t *p = static_cast<uint8_t*>(data);
+  while (length) {
+    const ssize_t n = pread(fd, p, length, offset);
+    if (n <= 0)
+      return false;
+    p += n;
+    length -= n;
+    offset += n;
+  }
+  return true;
+}
+
+uint64_t
+Round8(uint64_t value) {
+  return (value + 7) & ~static_cast<uint64_t>(7);
+}
+
+}  // anonymous namespace
+
+struct OTCStore {
+  int data_fd;
+  int index_fd;
+  uint8_t hash_key[16];
+
+  const uint8_t *data;  // a mapping of |mapped_length| bytes of the data file
+  uint64_t mapped_length;
+  // The length of the data file which holds complete records. Only written
+  // with |lock| held, and read with an acquire load.
+  uint64_t data_length;
+
+  IndexHeader *index;  // a writable mapping of the index file
+  size_t index_length;
+  Slot *slots;
+  // For each slot, non-zero once the output of its record has been checked
+  // since the store was opened. Read and written with atomic operations.
+  std::vector<uint8_t> verified;
+
+  pthread_mutex_t lock;  // held while adding a record
+};
+
+namespace {
+
+uint32_t
+SlotCheck(const OTCStore *store, const Slot *slot) {
+  return Check(store->hash_key, slot, offsetof(Slot, check));
+}
+
+void
+UpdateIndexHeader(OTCStore *store) {
+  IndexHeader *header = store->index;
+  header->data_length = store->data_length;
+  header->header_check = Check(store->hash_key, header,
+                               offsetof(IndexHeader, header_check));
+}
+
+// Return the record which |slot| points to, or NULL if the slot is damaged or
+// doesn't match its record.
+const RecordHeader *
+GetRecord(const OTCStore *store, const Slot *slot, uint32_t state) {
+  Slot copy = *slot;
+  copy.state = state;
+  if (SlotCheck(store, &copy) != copy.check)
+    return NULL;
+
+  const uint64_t data_length =
+      __atomic_load_n(&store->data_length, __ATOMIC_ACQUIRE);
+  if (copy.offset < sizeof(DataHeader) ||
+      copy.offset > data_length ||
+      data_length - copy.offset < sizeof(RecordHeader) ||
+      data_length - copy.offset - sizeof(RecordHeader) < copy.output_length) {
+    return NULL;
+  }
+
+  const RecordHeader *record =
+      reinterpret_cast<const RecordHeader*>(store->data + copy.offset);
+  if (record->magic != kRecordMagic ||
+      record->key[0] != copy.key[0] || record->key[1] != copy.key[1] ||
+      record->output_length != copy.output_length ||
+      !(record->flags & kRecordOK) != !(state & kSlotOK) ||
+      Check(store->hash_key, record, offsetof(RecordHeader, header_check)) !=
+      record->header_check) {
+    return NULL;
+  }
+
+  return record;
+}
+
+// Returns true if the output of |record|, which |slot| points to, matches its
+// checksum. This is only checked the first time.
+bool
+PayloadIsValid(OTCStore *store, const Slot *slot, const RecordHeader *record) {
+  uint8_t *verified = &store->verified[slot - store->slots];
+  if (__atomic_load_n(verified, __ATOMIC_RELAXED))
+    return true;
+  if (record->output_length &&
+      Check(store->hash_key, record + 1, record->output_length) !=
+      record->payload_check) {
+    return false;
+  }
+  __atomic_store_n(verified, 1, __ATOMIC_RELAXED);
+  return true;
+}
+
+// Find the slot for |key|: either the one which holds it, in which case
+// |*found| is set to true, or the empty slot where it would go. Returns NULL
+// if the table is full.
+Slot *
+FindSlot(OTCStore *store, const OTCHash &key, bool *found) {
+  const uint64_t mask = store->index->num_slots - 1;
+  uint64_t i = key.words[0] & mask;
+  for (uint64_t n = 0; n <= mask; ++n, i = (i + 1) & mask) {
+    Slot *slot = &store->slots[i];
+    const uint32_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+    if (!state) {
+      *found = false;
+      return slot;
+    }
+    if (slot->key[0] == key.words[0] && slot->key[1] == key.words[1]) {
+      *found = true;
+      return slot;
+    }
+  }
+  return NULL;
+}
+
+bool
+Lookup(OTCStore *store, const OTCHash &key, bool *ok,
+       const uint8_t **output, size_t *output_length) {
+  bool found;
+  const Slot *slot = FindSlot(store, key, &found);
+  if (!slot || !found)
+    return false;
+  const uint32_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+  const RecordHeader *record = GetRecord(store, slot, state);
+  if (!record || !PayloadIsValid(store, slot, record))
+    return false;
+
+  *ok = record->flags & kRecordOK;
+  *output = reinterpret_cast<const uint8_t*>(record + 1);
+  *output_length = record->output_length;
+  return true;
+}
+
+// Add a record to the data file and the index. Must be called with the lock
+// held. Failing to add it is not an error, so this returns nothing.
+void
+Insert(OTCStore *store, const OTCHash &key, bool ok,
+       const std::vector<uint8_t> &output) {
+  const uint64_t record_length = Round8(sizeof(RecordHeader) + output.size());
+  if (store->data_length + record_length > store->mapped_length ||
+      store->index->num_entries >= store->index->num_slots / 2) {
+    return;
+  }
+
+  bool found;
+  Slot *slot = FindSlot(store, key, &found);
+  if (!slot)
+    return;
+  // A slot whose record didn't survive a crash, or was damaged since, is
+  // replaced. A reader may see it half rewritten, but then its check fails and
+  // the lookup just misses.
+  if (found) {
+    const RecordHeader *existing = GetRecord(store, slot, slot->state);
+    if (existing && PayloadIsValid(store, slot, existing))
+      return;
+  }
+
+  std::vector<uint8_t> record(record_length);
+  RecordHeader *header = reinterpret_cast<RecordHeader*>(&record[0]);
+  header->magic = kRecordMagic;
+  header->flags = ok ? kRecordOK : 0;
+  header->key[0] = key.words[0];
+  header->key[1] = key.words[1];
+  header->output_length = output.size();
+  header->payload_check = output.empty() ? 0 :
+      Check(store->hash_key, &output[0], output.size());
+  header->header_check = Check(store->hash_key, header,
+                               offsetof(RecordHeader, header_check));
+  if (!output.empty())
+    memcpy(&record[sizeof(RecordHeader)], &output[0], output.size());
+
+  const uint64_t offset = store->data_length;
+  if (!WriteAll(store->data_fd, &record[0], record_length, offset) ||
+      fdatasync(store->data_fd)) {
+    return;
+  }
+  __atomic_store_n(&store->data_length, offset + record_length,
+                   __ATOMIC_RELEASE);
+
+  Slot filled;
+  filled.key[0] = key.words[0];
+  filled.key[1] = key.words[1];
+  filled.offset = offset;
+  filled.output_length = output.size();
+  filled.state = kSlotUsed | (ok ? kSlotOK : 0);
+  filled.check = SlotCheck(store, &filled);
+
+  slot->key[0] = filled.key[0];
+  slot->key[1] = filled.key[1];
+  slot->offset = filled.offset;
+  slot->output_length = filled.output_length;
+  slot->check = filled.check;
+  __atomic_store_n(&slot->state, filled.state, __ATOMIC_RELEASE);
+  // Only marked once the slot points at the new record, so that a reader
+  // can't take the old one as checked.
+  __atomic_store_n(&store->verified[slot - store->slots], 1,
+                   __ATOMIC_RELAXED);
+
+  if (!found)
+    store->index->num_entries++;
+  UpdateIndexHeader(store);
+}
+
+// Returns true if the index file, of |length| bytes, is intact and describes
+// the data file, of |data_size| bytes.
+bool
+IndexIsValid(const OTCStore *store, uint64_t length, uint64_t data_size) {
+  if (length < sizeof(IndexHeader))
+    return false;
+  IndexHeader header;
+  if (!ReadAll(store->index_fd, &header, sizeof(header), 0))
+    return false;
+  return header.magic == kIndexMagic &&
+         header.version == kVersion &&
+         header.header_check == Check(store->hash_key, &header,
+                                      offsetof(IndexHeader, header_check)) &&
+         !memcmp(header.hash_key, store->hash_key, 16) &&
+         header.num_slots &&
+         !(header.num_slots & (header.num_slots - 1)) &&
+         header.num_slots <= (length - sizeof(IndexHeader)) / sizeof(Slot) &&
+         length == sizeof(IndexHeader) + header.num_slots * sizeof(Slot) &&
+         header.data_length >= sizeof(DataHeader) &&
+         header.data_length <= data_size;
+}
+
+// Create a new, empty index with room for |max_entries| and map it.
+bool
+CreateIndex(OTCStore *store, size_t max_entries) {
+  uint64_t num_slots = 16;
+  while (num_slots < 2 * static_cast<uint64_t>(max_entries))
+    num_slots *= 2;
+
+  store->index_length = sizeof(IndexHeader) + num_slots * sizeof(Slot);
+  if (ftruncate(store->index_fd, 0) ||
+      ftruncate(store->index_fd, store->index_length)) {
+    return false;
+  }
+  void *index = mmap(NULL, store->index_length, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, store->index_fd, 0);
+  if (index == MAP_FAILED)
+    return false;
+
+  store->index = static_cast<IndexHeader*>(index);
+  store->slots = reinterpret_cast<Slot*>(store->index + 1);
+  store->verified.assign(num_slots, 0);
+  store->index->magic = kIndexMagic;
+  store->index->version = kVersion;
+  store->index->num_slots = num_slots;
+  memcpy(store->index->hash_key, store->hash_key, 16);
+  store->index->num_entries = 0;
+  store->index->reserved = 0;
+  return true;
+}
+
+// Index the records of the data file, of |data_size| bytes, stopping at the
+// first which is damaged. This sets |store->data_length| to the end of the
+// last good record.
+void
+RebuildIndex(OTCStore *store, uint64_t data_size) {
+  uint64_t offset = sizeof(DataHeader);
+  std::vector<uint8_t> output;
+  for (;;) {
+    RecordHeader header;
+    if (data_size - offset < sizeof(header) ||
+        !ReadAll(store->data_fd, &header, sizeof(header), offset) ||
+        header.magic != kRecordMagic ||
+        header.header_check != Check(store->hash_key, &header,
+                                     offsetof(RecordHeader, header_check)) ||
+        header.output_length > data_size - offset - sizeof(header)) {
+      break;
+    }
+    output.resize(header.output_length);
+    if (!output.empty() &&
+        (!ReadAll(store->data_fd, &output[0], output.size(),
+                  offset + sizeof(header)) ||
+         Check(store->hash_key, &output[0], output.size()) !=
+         header.payload_check)) {
+      break;
+    }
+
+    const uint64_t record_length =
+        Round8(sizeof(RecordHeader) + header.output_length);
+    if (record_length > data_size - offset)
+      break;
+
+    OTCHash key;
+    key.words[0] = header.key[0];
+    key.words[1] = header.key[1];
+    bool found;
+    Slot *slot = FindSlot(store, key, &found);
+    if (slot && !found &&
+        store->index->num_entries < store->index->num_slots / 2) {
+      slot->key[0] = header.key[0];
+      slot->key[1] = header.key[1];
+      slot->offset = offset;
+      slot->output_length = header.output_length;
+      slot->state = kSlotUsed | (header.flags & kRecordOK ? kSlotOK : 0);
+      slot->check = SlotCheck(store, slot);
+      store->verified[slot - store->slots] = 1;
+      store->index->num_entries++;
+    }
+    offset += record_length;
+  }
+
+  store->data_length = offset;
+  UpdateIndexHeader(store);
+}
+
+}  // anonymous namespace
+
+OTCStore *
+otc_store_open(const char *path, uint64_t max_bytes, size_t max_entries) {
+  const std::string data_path = std::string(path) + ".data";
+  const std::string index_path = std::string(path) + ".index";
+
+  OTCStore *store = new OTCStore;
+  store->data = NULL;
+  store->index = NULL;
+  store->index_fd = -1;
+  store->data_fd = open(data_path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (store->data_fd < 0) {
+    delete store;
+    return NULL;
+  }
+  // The lock on the data file keeps other processes out until it's closed.
+  if (flock(store->data_fd, LOCK_EX | LOCK_NB)) {
+    otc_store_close(store);
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(store->data_fd, &st)) {
+    otc_store_close(store);
+    return NULL;
+  }
+  uint64_t data_size = st.st_size;
+
+  DataHeader data_header;
+  if (data_size >= sizeof(data_header) &&
+      (!ReadAll(store->data_fd, &data_header, sizeof(data_header), 0) ||
+       data_header.magic != kDataMagic)) {
+    // Not a store, so it's left alone.
+    otc_store_close(store);
+    return NULL;
+  }
+  if (data_size < sizeof(data_header) ||
+      data_header.version != kVersion ||
+      data_header.output_version != kOTCOutputVersion) {
+    // A new store, one which crashed while being created or one written by
+    // another version, whose results can't be trusted. The new hash key
+    // means that the old index is rebuilt too.
+    data_header.magic = kDataMagic;
+    data_header.version = kVersion;
+    data_header.output_version = kOTCOutputVersion;
+    data_header.reserved = 0;
+    if (!otc_hash_key(data_header.hash_key) ||
+        ftruncate(store->data_fd, 0) ||
+        !WriteAll(store->data_fd, &data_header, sizeof(data_header), 0) ||
+        fdatasync(store->data_fd)) {
+      otc_store_close(store);
+      return NULL;
+    }
+    data_size = sizeof(data_header);
+  }
+  memcpy(store->hash_key, data_header.hash_key, 16);
+
+  store->index_fd = open(index_path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (store->index_fd < 0 || fstat(store->index_fd, &st)) {
+    otc_store_close(store);
+    return NULL;
+  }
+
+  if (IndexIsValid(store, st.st_size, data_size)) {
+    store->index_length = st.st_size;
+    void *index = mmap(NULL, store->index_length, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, store->index_fd, 0);
+    if (index == MAP_FAILED) {
+      otc_store_close(store);
+      return NULL;
+    }
+    store->index = static_cast<IndexHeader*>(index);
+    store->slots = reinterpret_cast<Slot*>(store->index + 1);
+    store->verified.assign(store->index->num_slots, 0);
+    store->data_length = store->index->data_length;
+  } else {
+    if (!CreateIndex(store, max_entries)) {
+      otc_store_close(store);
+      return NULL;
+    }
+    RebuildIndex(store, data_size);
+  }
+
+  // Anything after the last good record was left by a crash.
+  if (data_size > store->data_length &&
+      ftruncate(store->data_fd, store->data_length)) {
+    otc_store_close(store);
+    return NULL;
+  }
+
+  store->mapped_length = std::max(max_bytes,
+                                  static_cast<uint64_t>(store->data_length));
+  void *data = mmap(NULL, store->mapped_length, PROT_READ, MAP_SHARED,
+                    store->data_fd, 0);
+  if (data == MAP_FAILED) {
+    otc_store_close(store);
+    return NULL;
+  }
+  store->data = static_cast<const uint8_t*>(data);
+
+  pthread_mutex_init(&store->lock, NULL);
+  return store;
+}
+
+void
+otc_store_close(OTCStore *store) {
+  if (store->data) {
+    munmap(const_cast<uint8_t*>(store->data), store->mapped_length);
+    pthread_mutex_destroy(&store->lock);
+  }
+  if (store->index) {
+    msync(store->index, store->index_length, MS_SYNC);
+    munmap(store->index, store->index_length);
+  }
+  if (store->index_fd >= 0)
+    close(store->index_fd);
+  close(store->data_fd);
+  delete store;
+}
+
+bool
+otc_store_lookup(OTCStore *store, bool *ok, const uint8_t **output,
+                 size_t *output_length, const uint8_t *data, size_t length,
+                 const OTCOptions &options) {
+  if (!otc_hash_cacheable(options))
+    return false;
+
+  OTCHash key;
+  otc_hash_request(&key, store->hash_key, data, length, options);
+  return Lookup(store, key, ok, output, output_length);
+}
+
+bool
+otc_process_stored(OTCStore *store, OTCStream *output, const uint8_t *data,
+                   size_t length, const OTCOptions &options) {
+  if (!otc_hash_cacheable(options))
+    return otc_process(output, data, length, options);
+
+  OTCHash key;
+  otc_hash_request(&key, store->hash_key, data, length, options);
+
+  bool ok;
+  const uint8_t *stored;
+  size_t stored_length;
+  if (Lookup(store, key, &ok, &stored, &stored_length)) {
+    return ok &&
+           (!stored_length || output->Write(stored, stored_length)) &&
+           output->Flush();
+  }
+
+  // As with OTCCache, the font is sanitised into memory so that a failure is
+  // certainly a rejection.
+  std::vector<uint8_t> sanitised;
+  VectorStream stream(&sanitised);
+  ok = otc_process(&stream, data, length, options);
+  if (!ok)
+    sanitised.clear();
+
+  pthread_mutex_lock(&store->lock);
+  Insert(store, key, ok, sanitised);
+  pthread_mutex_unlock(&store->lock);
+
+  return ok &&
+         (sanitised.empty() || output->Write(&sanitised[0], sanitised.size())) &&
+         output->Flush();
+}
@@ -0,0 +1,94 @@
+#include <algorithm>
+
+#include "otc.h"
+#include "cmap.h"
+#include "head.h"
+#include "hhea.h"
+#include "maxp.h"
+#include "os2.h"
+#include "subset.h"
+
+bool
+otc_subset(OpenTypeFile *subset, OpenTypeFile *file, const OTCCMAPIndex *index,
+           const std::vector<uint32_t> &code_points) {
+  const unsigned num_glyphs = file->maxp->num_glyphs;
+  if (!num_glyphs)
+    return failure();
+
+  std::vector<uint32_t> sorted_code_points(code_points);
+  std::sort(sorted_code_points.begin(), sorted_code_points.end());
+  sorted_code_points.erase(std::unique(sorted_code_points.begin(),
+                                       sorted_code_points.end()),
+                           sorted_code_points.end());
+
+  // Find the glyphs which the code-points map to. .notdef is always kept.
+  std::vector<bool> keep(num_glyphs);
+  std::vector<uint16_t> pending;
+  keep[0] = true;
+  pending.push_back(0);
+
+  std::vector<OTCCodePointMapping> mappings;
+  for (unsigned i = 0; i < sorted_code_points.size(); ++i) {
+    const uint16_t glyph = otc_cmap_lookup(index, sorted_code_points[i]);
+    if (!glyph)
+      continue;
+    mappings.push_back(std::make_pair(sorted_code_points[i], glyph));
+    if (!keep[glyph]) {
+      keep[glyph] = true;
+      pending.push_back(glyph);
+    }
+  }
+
+  // Add the components of any composite glyphs, and their components in turn.
+  std::vector<uint16_t> components;
+  while (pending.size()) {
+    const unsigned glyph = pending.back();
+    pending.pop_back();
+
+    components.clear();
+    if (!otc_glyf_components(file, glyph, &components))
+      return failure();
+    for (unsigned i = 0; i < components.size(); ++i) {
+      if (components[i] >= num_glyphs)
+        return failure();
+      if (!keep[components[i]]) {
+        keep[components[i]] = true;
+        pending.push_back(components[i]);
+      }
+    }
+  }
+
+  OTCGlyphMap map;
+  map.old_to_new.resize(num_glyphs, kGlyphDropped);
+  for (unsigned i = 0; i < num_glyphs; ++i) {
+    if (!keep[i])
+      continue;
+    map.old_to_new[i] = map.new_to_old.size();
+    map.new_to_old.push_back(i);
+  }
+
+  for (unsigned i = 0; i < mappings.size(); ++i)
+    mappings[i].second = map.old_to_new[mappings[i].second];
+
+  // The tables which don't refer to glyph ids (or only their number) are
+  // copied.
+  subset->version = file->version;
+  subset->num_tables = file->num_tables;
+  subset->search_range = file->search_range;
+  subset->entry_selector = file->entry_selector;
+  subset->range_shift = file->range_shift;
+  subset->head = new OpenTypeHEAD(*file->head);
+  subset->hhea = new OpenTypeHHEA(*file->hhea);
+  subset->maxp = new OpenTypeMAXP(*file->maxp);
+  subset->maxp->num_glyphs = map.new_to_old.size();
+  subset->os2 = new OpenTypeOS2(*file->os2);
+
+  if (!otc_glyf_subset(subset, file, map) ||
+      !otc_hmtx_subset(subset, file, map) ||
+      !otc_post_subset(subset, file, map) ||
+      !otc_cmap_subset(subset, file, mappings)) {
+    return failure();
+  }
+
+  return true;
+}
@@ -0,0 +1,52 @@
+#ifndef OTC_SUBSET_H_
+#define OTC_SUBSET_H_
+
+#include <vector>
+#include <utility>
+
+// Marks a glyph which isn't kept in OTCGlyphMap::old_to_new
+static const uint16_t kGlyphDropped = 0xffff;
+
+// The glyphs which are kept when subsetting a font. Kept glyphs retain their
+// relative order, so .notdef is always glyph zero.
+struct OTCGlyphMap {
+  // The id, in the original font, of each glyph in the subset font
+  std::vector<uint16_t> new_to_old;
+  // The id, in the subset font, of each glyph in the original font, or
+  // kGlyphDropped if the glyph isn't kept.
+  std::vector<uint16_t> old_to_new;
+};
+
+// A code-point and the glyph which it maps to
+typedef std::pair<uint32_t, uint16_t> OTCCodePointMapping;
+
+// Fill in the tables of |subset|, which must be empty, with a copy of the
+// successfully parsed |file| which only contains the glyphs needed to render
+// |code_points|. |index| is the index of |file|'s character map. |file| isn't
+// modified, so many subsets can be built from it.
+bool otc_subset(OpenTypeFile *subset, OpenTypeFile *file,
+                const OTCCMAPIndex *index,
+                const std::vector<uint32_t> &code_points);
+
+// Each of these builds the given table(s) of |subset| from those of |file|,
+// keeping only the glyphs in |map|.
+
+// Sets |subset->glyf| and |subset->loca|
+bool otc_glyf_subset(OpenTypeFile *subset, OpenTypeFile *file,
+                     const OTCGlyphMap &map);
+// Sets |subset->hmtx| and updates |subset->hhea|, which must be set.
+bool otc_hmtx_subset(OpenTypeFile *subset, OpenTypeFile *file,
+                     const OTCGlyphMap &map);
+bool otc_post_subset(OpenTypeFile *subset, OpenTypeFile *file,
+                     const OTCGlyphMap &map);
+// |mappings| is the list of code-points in the subset, in ascending order,
+// and the glyph in |subset| which each maps to.
+bool otc_cmap_subset(OpenTypeFile *subset, OpenTypeFile *file,
+                     const std::vector<OTCCodePointMapping> &mappings);
+
+// Append the glyphs which are used as components by |glyph| (which is empty
+// unless it's a composite glyph) to |components|.
+bool otc_glyf_components(OpenTypeFile *file, unsigned glyph,
+                         std::vector<uint16_t> *components);
+
+#endif  // OTC_SUBSET_H_
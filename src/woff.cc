@@ -0,0 +1,248 @@
+#include <zlib.h>
+
+#include <vector>
+
+#include "otc.h"
+#include "parallel.h"
+#include "woff.h"
+
+// WOFF 1.0: http://www.w3.org/TR/WOFF/
+
+namespace {
+
+const uint32_t kWOFFSignature = 0x774f4646;  // 'wOFF'
+const size_t kWOFFHeaderLength = 44;
+const size_t kWOFFTableEntryLength = 20;
+// The limit on the size of the decompressed font, as for OpenType input
+const uint32_t kMaxSFNTSize = 1024 * 1024 * 1024;
+
+struct WOFFTableEntry {
+  uint32_t tag;
+  uint32_t offset;
+  uint32_t comp_length;
+  uint32_t orig_length;
+  uint32_t orig_checksum;
+};
+
+struct CompressJob {
+  const std::vector<OTCSerialisedTable> *tables;
+  // compressed[i] is the zlib stream for tables[i], or empty if compressing
+  // didn't make it any smaller.
+  std::vector<std::vector<uint8_t> > *compressed;
+};
+
+void
+CompressTable(void *arg, size_t i) {
+  CompressJob *job = static_cast<CompressJob*>(arg);
+  const std::vector<uint8_t> &data = (*job->tables)[i].data;
+  std::vector<uint8_t> &out = (*job->compressed)[i];
+  if (data.empty())
+    return;
+
+  uLongf out_length = compressBound(data.size());
+  out.resize(out_length);
+  if (compress2(&out[0], &out_length, &data[0], data.size(),
+                Z_BEST_COMPRESSION) != Z_OK ||
+      out_length >= data.size()) {
+    // The table is stored uncompressed, which the reader recognises by the
+    // compressed and original lengths being equal.
+    out.clear();
+    return;
+  }
+  out.resize(out_length);
+}
+
+}  // anonymous namespace
+
+bool
+otc_woff_write(OTCStream *out, const std::vector<OTCSerialisedTable> &tables,
+               unsigned num_threads) {
+  const unsigned num_tables = tables.size();
+
+  std::vector<std::vector<uint8_t> > compressed(num_tables);
+  CompressJob job;
+  job.tables = &tables;
+  job.compressed = &compressed;
+  otc_parallel_for(num_tables, num_threads, CompressTable, &job);
+
+  // The size of the equivalent OpenType file, which lays the tables out in the
+  // same way as otc_process.
+  size_t sfnt_size = 12 + 16 * num_tables;
+  size_t offset = kWOFFHeaderLength + kWOFFTableEntryLength * num_tables;
+  std::vector<size_t> offsets(num_tables);
+  for (unsigned i = 0; i < num_tables; ++i) {
+    sfnt_size += Round4(tables[i].data.size());
+    offsets[i] = offset;
+    const size_t stored = compressed[i].size() ? compressed[i].size()
+                                               : tables[i].data.size();
+    offset += Round4(stored);
+  }
+  const size_t woff_size = offset;
+  if (woff_size > 0xffffffff || sfnt_size > 0xffffffff)
+    return failure();
+
+  if (!out->WriteU32(kWOFFSignature) ||
+      !out->WriteU32(0x00010000) ||  // flavor: TrueType outlines
+      !out->WriteU32(woff_size) ||
+      !out->WriteU16(num_tables) ||
+      !out->WriteU16(0) ||  // reserved
+      !out->WriteU32(sfnt_size) ||
+      !out->WriteU16(0) ||  // majorVersion
+      !out->WriteU16(0) ||  // minorVersion
+      !out->WriteU32(0) ||  // metaOffset
+      !out->WriteU32(0) ||  // metaLength
+      !out->WriteU32(0) ||  // metaOrigLength
+      !out->WriteU32(0) ||  // privOffset
+      !out->WriteU32(0)) {  // privLength
+    return failure();
+  }
+
+  for (unsigned i = 0; i < num_tables; ++i) {
+    const size_t length = tables[i].data.size();
+    const size_t stored = compressed[i].size() ? compressed[i].size() : length;
+    if (!out->WriteTag(tables[i].tag) ||
+        !out->WriteU32(offsets[i]) ||
+        !out->WriteU32(stored) ||
+        !out->WriteU32(length) ||
+        !out->WriteU32(tables[i].chksum)) {
+      return failure();
+    }
+  }
+
+  for (unsigned i = 0; i < num_tables; ++i) {
+    const std::vector<uint8_t> &data = compressed[i].size() ? compressed[i]
+                                                            : tables[i].data;
+    if (data.size() && !out->Write(&data[0], data.size()))
+      return failure();
+    out->Pad((4 - (data.size() & 3)) % 4);
+  }
+
+  if (!out->Flush())
+    return failure();
+
+  return true;
+}
+
+bool
+otc_woff_read_tables(OpenTypeFile *header, const uint8_t *data, size_t length,
+                     std::vector<OpenTypeTableData> *tables) {
+  Buffer file(data, length);
+
+  uint32_t signature, flavor, woff_length, total_sfnt_size;
+  uint16_t num_tables, reserved, major_version, minor_version;
+  uint32_t meta_offset, meta_length, meta_orig_length;
+  uint32_t priv_offset, priv_length;
+  if (!file.ReadU32(&signature) ||
+      !file.ReadU32(&flavor) ||
+      !file.ReadU32(&woff_length) ||
+      !file.ReadU16(&num_tables) ||
+      !file.ReadU16(&reserved) ||
+      !file.ReadU32(&total_sfnt_size) ||
+      !file.ReadU16(&major_version) ||
+      !file.ReadU16(&minor_version) ||
+      !file.ReadU32(&meta_offset) ||
+      !file.ReadU32(&meta_length) ||
+      !file.ReadU32(&meta_orig_length) ||
+      !file.ReadU32(&priv_offset) ||
+      !file.ReadU32(&priv_length)) {
+    return failure();
+  }
+
+  if (signature != kWOFFSignature)
+    return failure();
+  // As with OpenType input, only TrueType outlines are accepted.
+  if (flavor >> 16 != 1)
+    return failure();
+  if (woff_length != length)
+    return failure();
+  if (num_tables >= 4096 || num_tables < 1)
+    return failure();
+  if (reserved)
+    return failure();
+  if (total_sfnt_size > kMaxSFNTSize)
+    return failure();
+
+  std::vector<WOFFTableEntry> entries;
+  for (unsigned i = 0; i < num_tables; ++i) {
+    WOFFTableEntry entry;
+    if (!file.ReadTag(&entry.tag) ||
+        !file.ReadU32(&entry.offset) ||
+        !file.ReadU32(&entry.comp_length) ||
+        !file.ReadU32(&entry.orig_length) ||
+        !file.ReadU32(&entry.orig_checksum)) {
+      return failure();
+    }
+    entries.push_back(entry);
+  }
+
+  const size_t data_offset = file.offset();
+
+  // The decompressed size of the font is that of the equivalent OpenType
+  // file, which must agree with totalSfntSize. Everything is checked before
+  // anything is allocated.
+  uint64_t sfnt_size = 12 + 16 * num_tables;
+  for (unsigned i = 0; i < num_tables; ++i) {
+    // the tables must be sorted by tag, which also rules out duplicates.
+    if (i && ntohl(entries[i].tag) <= ntohl(entries[i - 1].tag))
+      return failure();
+    if (entries[i].offset & 3)
+      return failure();
+    if (entries[i].offset < data_offset || entries[i].offset > length ||
+        entries[i].comp_length > length - entries[i].offset)
+      return failure();
+    // compLength == origLength means that the table is stored uncompressed.
+    if (entries[i].comp_length > entries[i].orig_length)
+      return failure();
+    if (entries[i].orig_length > kMaxSFNTSize)
+      return failure();
+    sfnt_size += Round4(static_cast<uint64_t>(entries[i].orig_length));
+  }
+  if (sfnt_size != total_sfnt_size)
+    return failure();
+
+  // The extended metadata and private data are dropped, but they must still be
+  // within the file.
+  if ((meta_length && (meta_offset < data_offset || meta_offset > length ||
+                       meta_length > length - meta_offset)) ||
+      (priv_length && (priv_offset < data_offset || priv_offset > length ||
+                       priv_length > length - priv_offset))) {
+    return failure();
+  }
+
+  header->version = flavor;
+  header->num_tables = num_tables;
+  unsigned max_pow2 = 0;
+  while (1u << (max_pow2 + 1) < num_tables)
+    max_pow2++;
+  header->search_range = (1u << max_pow2) << 4;
+  header->entry_selector = max_pow2;
+  header->range_shift = 16 * num_tables - header->search_range;
+
+  // |table_buffers| is sized up front so that it's never reallocated, which
+  // would move the buffers which the parsed tables point into.
+  header->table_buffers.resize(num_tables);
+  for (unsigned i = 0; i < num_tables; ++i) {
+    OpenTypeTableData table;
+    table.tag = entries[i].tag;
+    table.length = entries[i].orig_length;
+    table.chksum = entries[i].orig_checksum;
+
+    if (entries[i].comp_length == entries[i].orig_length) {
+      table.data = data + entries[i].offset;
+    } else {
+      std::vector<uint8_t> &buffer = header->table_buffers[i];
+      buffer.resize(entries[i].orig_length);
+      uLongf out_length = entries[i].orig_length;
+      if (uncompress(&buffer[0], &out_length, data + entries[i].offset,
+                     entries[i].comp_length) != Z_OK ||
+          out_length != entries[i].orig_length) {
+        return failure();
+      }
+      table.data = &buffer[0];
+    }
+
+    tables->push_back(table);
+  }
+
+  return true;
+}
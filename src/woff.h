@@ -0,0 +1,49 @@
+#ifndef OTC_WOFF_H_
+#define OTC_WOFF_H_
+
+#include <vector>
+
+// A table which has been serialised into memory, ready to be written into a
+// WOFF file.
+struct OTCSerialisedTable {
+  uint32_t tag;
+  // The checksum of the table, as it would appear in an OpenType file
+  uint32_t chksum;
+  // The table, without any padding
+  std::vector<uint8_t> data;
+};
+
+// Write |tables|, which must be sorted by tag, to |out| as a WOFF 1.0 file.
+// Each table is compressed with zlib, unless that doesn't make it any smaller
+// in which case it's stored as is. The tables are compressed in parallel, on
+// up to |num_threads| threads (see otc_parallel_for).
+bool otc_woff_write(OTCStream *out,
+                    const std::vector<OTCSerialisedTable> &tables,
+                    unsigned num_threads);
+
+// Split the glyf table of |file| into the streams of the WOFF 2.0 glyf
+// transform, which are written to |out|. This also sets the lossless transform
+// bit in |file->head|, and switches it to the long loca format if a decoder's
+// rebuilt glyf table might not fit the short format. Returns false, changing
+// nothing, if some glyph can't be represented, in which case glyf and loca
+// should be written untransformed.
+bool otc_woff2_transform_glyf(OpenTypeFile *file, std::vector<uint8_t> *out);
+
+// Write |tables|, which must be sorted by tag, to |out| as a WOFF 2.0 file,
+// compressed with Brotli. If |transformed_glyf| isn't NULL it's written in
+// place of glyf, from otc_woff2_transform_glyf, and loca is left for the
+// decoder to rebuild.
+bool otc_woff2_write(OTCStream *out,
+                     const std::vector<OTCSerialisedTable> &tables,
+                     const std::vector<uint8_t> *transformed_glyf);
+
+// Read the table directory of the WOFF file |data| into |header| and
+// |tables|. Compressed tables are decompressed into |header->table_buffers|
+// and the rest are left in |data|. No more than the decompressed size which
+// the file declares is allocated, and each table must decompress to exactly
+// its declared length.
+bool otc_woff_read_tables(OpenTypeFile *header, const uint8_t *data,
+                          size_t length,
+                          std::vector<OpenTypeTableData> *tables);
+
+#endif  // OTC_WOFF_H_
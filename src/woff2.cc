@@ -0,0 +1,532 @@
+#include <brotli/encode.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "otc.h"
+#include "glyf.h"
+#include "head.h"
+#include "maxp.h"
+#include "woff.h"
+
+// WOFF 2.0: http://www.w3.org/TR/WOFF2/
+
+namespace {
+
+const uint32_t kWOFF2Signature = 0x774f4632;  // 'wOF2'
+const size_t kWOFF2HeaderLength = 48;
+
+// The tags which the table directory can refer to by index
+const char kKnownTags[63][5] = {
+  "cmap", "head", "hhea", "hmtx", "maxp", "name", "OS/2", "post", "cvt ",
+  "fpgm", "glyf", "loca", "prep", "CFF ", "VORG", "EBDT", "EBLC", "gasp",
+  "hdmx", "kern", "LTSH", "PCLT", "VDMX", "vhea", "vmtx", "BASE", "GDEF",
+  "GPOS", "GSUB", "EBSC", "JSTF", "MATH", "CBDT", "CBLC", "COLR", "CPAL",
+  "SVG ", "sbix", "acnt", "avar", "bdat", "bloc", "bsln", "cvar", "fdsc",
+  "feat", "fmtx", "fvar", "gvar", "hsty", "just", "lcar", "mort", "morx",
+  "opbd", "prop", "trak", "Zapf", "Silf", "Glat", "Gloc", "Feat", "Sill",
+};
+const uint8_t kArbitraryTag = 63;
+
+// Transform versions, which are stored in the top two bits of the flags
+// byte of a table directory entry. Version 0 is the transform for glyf and
+// loca, but no transform for every other table.
+const uint8_t kTransformed = 0 << 6;
+const uint8_t kNullTransformGlyfLoca = 3 << 6;
+
+// Simple glyph flags
+const uint8_t kOnCurve = 1 << 0;
+const uint8_t kXShort = 1 << 1;
+const uint8_t kYShort = 1 << 2;
+const uint8_t kRepeat = 1 << 3;
+const uint8_t kXSameOrPositive = 1 << 4;
+const uint8_t kYSameOrPositive = 1 << 5;
+const uint8_t kOverlapSimple = 1 << 6;
+
+// Composite glyph flags
+const uint16_t kArg1And2AreWords = 1 << 0;
+const uint16_t kWeHaveAScale = 1 << 3;
+const uint16_t kMoreComponents = 1 << 5;
+const uint16_t kWeHaveAnXAndYScale = 1 << 6;
+const uint16_t kWeHaveATwoByTwo = 1 << 7;
+const uint16_t kWeHaveInstructions = 1 << 8;
+
+// Transformed glyf optionFlags
+const uint16_t kHasOverlapSimpleBitmap = 1 << 0;
+
+// head flags bit 11: the font has been through a lossless transform which
+// may have changed its binary representation.
+const uint16_t kHeadFlagLosslessTransform = 1 << 11;
+
+void
+PutU16(std::vector<uint8_t> *out, unsigned value) {
+  out->push_back(value >> 8);
+  out->push_back(value);
+}
+
+void
+PutU32(std::vector<uint8_t> *out, uint32_t value) {
+  PutU16(out, value >> 16);
+  PutU16(out, value);
+}
+
+void
+Put255UShort(std::vector<uint8_t> *out, unsigned value) {
+  if (value < 253) {
+    out->push_back(value);
+  } else if (value < 506) {
+    out->push_back(255);
+    out->push_back(value - 253);
+  } else if (value < 762) {
+    out->push_back(254);
+    out->push_back(value - 506);
+  } else {
+    out->push_back(253);
+    PutU16(out, value);
+  }
+}
+
+void
+PutUIntBase128(std::vector<uint8_t> *out, uint32_t value) {
+  unsigned length = 1;
+  while (length < 5 && value >> (7 * length))
+    length++;
+  for (unsigned i = length; i--; )
+    out->push_back(((value >> (7 * i)) & 0x7f) | (i ? 0x80 : 0));
+}
+
+int
+Abs(int value) {
+  return value < 0 ? -value : value;
+}
+
+// A reader for glyph data. Unlike Buffer, running off the end isn't a
+// failure: the sanitiser doesn't check the points of simple glyphs, so a glyph
+// which can't be read just means that glyf is written untransformed.
+class GlyphReader {
+ public:
+  GlyphReader(const uint8_t *data, size_t length)
+      : data_(data),
+        length_(length),
+        offset_(0) {
+  }
+
+  bool Skip(size_t n_bytes) {
+    if (n_bytes > length_ - offset_)
+      return false;
+    offset_ += n_bytes;
+    return true;
+  }
+
+  bool ReadU8(uint8_t *value) {
+    if (offset_ + 1 > length_)
+      return false;
+    *value = data_[offset_++];
+    return true;
+  }
+
+  bool ReadU16(uint16_t *value) {
+    if (offset_ + 2 > length_)
+      return false;
+    *value = data_[offset_] << 8 | data_[offset_ + 1];
+    offset_ += 2;
+    return true;
+  }
+
+  bool ReadS16(int16_t *value) {
+    uint16_t v;
+    if (!ReadU16(&v))
+      return false;
+    *value = v;
+    return true;
+  }
+
+  size_t offset() const { return offset_; }
+
+ private:
+  const uint8_t *const data_;
+  const size_t length_;
+  size_t offset_;
+};
+
+// The glyf table split into the streams of the WOFF2 transform
+struct GlyfStreams {
+  std::vector<uint8_t> n_contours;
+  std::vector<uint8_t> n_points;
+  std::vector<uint8_t> flags;
+  std::vector<uint8_t> glyphs;
+  std::vector<uint8_t> composites;
+  std::vector<uint8_t> bbox_bitmap;
+  std::vector<uint8_t> bboxes;
+  std::vector<uint8_t> instructions;
+  std::vector<uint8_t> overlap_bitmap;
+  bool has_overlap;
+  // An upper bound on the length of the glyf table which a decoder rebuilds
+  // from the streams.
+  uint64_t rebuilt_length;
+};
+
+// Add a point to the flags and glyph streams as a delta from the previous
+// one, using the smallest of the triplet encodings.
+void
+PutTriplet(GlyfStreams *s, bool on_curve, int dx, int dy) {
+  const unsigned abs_x = Abs(dx);
+  const unsigned abs_y = Abs(dy);
+  const uint8_t on_curve_bit = on_curve ? 0 : 128;
+  const uint8_t x_sign = dx < 0 ? 0 : 1;
+  const uint8_t y_sign = dy < 0 ? 0 : 1;
+  const uint8_t xy_signs = x_sign + 2 * y_sign;
+
+  if (dx == 0 && abs_y < 1280) {
+    s->flags.push_back(on_curve_bit + ((abs_y & 0xf00) >> 7) + y_sign);
+    s->glyphs.push_back(abs_y);
+  } else if (dy == 0 && abs_x < 1280) {
+    s->flags.push_back(on_curve_bit + 10 + ((abs_x & 0xf00) >> 7) + x_sign);
+    s->glyphs.push_back(abs_x);
+  } else if (abs_x < 65 && abs_y < 65) {
+    s->flags.push_back(on_curve_bit + 20 + ((abs_x - 1) & 0x30) +
+                       (((abs_y - 1) & 0x30) >> 2) + xy_signs);
+    s->glyphs.push_back(((abs_x - 1) & 0xf) << 4 | ((abs_y - 1) & 0xf));
+  } else if (abs_x < 769 && abs_y < 769) {
+    s->flags.push_back(on_curve_bit + 84 + 12 * (((abs_x - 1) & 0x300) >> 8) +
+                       (((abs_y - 1) & 0x300) >> 6) + xy_signs);
+    s->glyphs.push_back(abs_x - 1);
+    s->glyphs.push_back(abs_y - 1);
+  } else if (abs_x < 4096 && abs_y < 4096) {
+    s->flags.push_back(on_curve_bit + 120 + xy_signs);
+    s->glyphs.push_back(abs_x >> 4);
+    s->glyphs.push_back((abs_x & 0xf) << 4 | abs_y >> 8);
+    s->glyphs.push_back(abs_y);
+  } else {
+    s->flags.push_back(on_curve_bit + 124 + xy_signs);
+    PutU16(&s->glyphs, abs_x);
+    PutU16(&s->glyphs, abs_y);
+  }
+}
+
+// Read the |num_points| coordinates along one axis of a simple glyph from
+// |reader|, as deltas from the previous point.
+bool
+ReadCoordinates(GlyphReader *reader, const std::vector<uint8_t> &flags,
+                uint8_t short_flag, uint8_t same_flag, std::vector<int> *deltas) {
+  for (unsigned i = 0; i < flags.size(); ++i) {
+    if (flags[i] & short_flag) {
+      uint8_t delta;
+      if (!reader->ReadU8(&delta))
+        return false;
+      (*deltas)[i] = flags[i] & same_flag ? delta : -delta;
+    } else if (flags[i] & same_flag) {
+      (*deltas)[i] = 0;
+    } else {
+      int16_t delta;
+      if (!reader->ReadS16(&delta))
+        return false;
+      (*deltas)[i] = delta;
+    }
+  }
+  return true;
+}
+
+// Add the simple glyph |data| to |s|. Returns false if it can't be
+// represented, for example because its points are truncated.
+bool
+TransformSimpleGlyph(GlyfStreams *s, unsigned glyph, const uint8_t *data,
+                     size_t length, unsigned num_contours) {
+  GlyphReader reader(data, length);
+  int16_t xmin, ymin, xmax, ymax;
+  if (!reader.Skip(2) ||
+      !reader.ReadS16(&xmin) ||
+      !reader.ReadS16(&ymin) ||
+      !reader.ReadS16(&xmax) ||
+      !reader.ReadS16(&ymax)) {
+    return false;
+  }
+
+  PutU16(&s->n_contours, num_contours);
+  int last_end = -1;
+  for (unsigned i = 0; i < num_contours; ++i) {
+    uint16_t end;
+    if (!reader.ReadU16(&end) || end < last_end)
+      return false;
+    Put255UShort(&s->n_points, end - last_end);
+    last_end = end;
+  }
+  const unsigned num_points = last_end + 1;
+
+  uint16_t instructions_length;
+  if (!reader.ReadU16(&instructions_length) ||
+      reader.offset() + instructions_length > length) {
+    return false;
+  }
+  const uint8_t *instructions = data + reader.offset();
+  reader.Skip(instructions_length);
+
+  std::vector<uint8_t> flags(num_points);
+  for (unsigned i = 0; i < num_points; ) {
+    uint8_t flag, repeats = 0;
+    if (!reader.ReadU8(&flag) ||
+        ((flag & kRepeat) && !reader.ReadU8(&repeats)) ||
+        i + 1 + repeats > num_points) {
+      return false;
+    }
+    for (unsigned j = 0; j <= repeats; ++j)
+      flags[i++] = flag;
+  }
+
+  std::vector<int> dxs(num_points), dys(num_points);
+  if (!ReadCoordinates(&reader, flags, kXShort, kXSameOrPositive, &dxs) ||
+      !ReadCoordinates(&reader, flags, kYShort, kYSameOrPositive, &dys)) {
+    return false;
+  }
+
+  // A decoder calculates the bounding box from the points, so it's only
+  // stored if it differs.
+  int x = 0, y = 0;
+  int bbox_xmin = 0, bbox_ymin = 0, bbox_xmax = 0, bbox_ymax = 0;
+  for (unsigned i = 0; i < num_points; ++i) {
+    x += dxs[i];
+    y += dys[i];
+    if (i == 0) {
+      bbox_xmin = bbox_xmax = x;
+      bbox_ymin = bbox_ymax = y;
+    } else {
+      bbox_xmin = std::min(bbox_xmin, x);
+      bbox_xmax = std::max(bbox_xmax, x);
+      bbox_ymin = std::min(bbox_ymin, y);
+      bbox_ymax = std::max(bbox_ymax, y);
+    }
+    PutTriplet(s, flags[i] & kOnCurve, dxs[i], dys[i]);
+  }
+
+  // The instructions follow the points in the glyph stream.
+  Put255UShort(&s->glyphs, instructions_length);
+  s->instructions.insert(s->instructions.end(), instructions,
+                         instructions + instructions_length);
+
+  if (bbox_xmin != xmin || bbox_ymin != ymin ||
+      bbox_xmax != xmax || bbox_ymax != ymax) {
+    s->bbox_bitmap[glyph >> 3] |= 0x80 >> (glyph & 7);
+    PutU16(&s->bboxes, xmin);
+    PutU16(&s->bboxes, ymin);
+    PutU16(&s->bboxes, xmax);
+    PutU16(&s->bboxes, ymax);
+  }
+
+  if (num_points && (flags[0] & kOverlapSimple)) {
+    s->overlap_bitmap[glyph >> 3] |= 0x80 >> (glyph & 7);
+    s->has_overlap = true;
+  }
+
+  // A decoder chooses its own encoding of the flags and coordinates, which
+  // takes at most a flag byte and two words for each point.
+  s->rebuilt_length += Round4(static_cast<uint64_t>(
+      10 + 2 * num_contours + 2 + instructions_length + 5 * num_points));
+  return true;
+}
+
+// Add the composite glyph |data| to |s|. Returns false if it can't be
+// represented.
+bool
+TransformCompositeGlyph(GlyfStreams *s, unsigned glyph, const uint8_t *data,
+                        size_t length) {
+  GlyphReader reader(data, length);
+  if (!reader.Skip(10))
+    return false;
+
+  uint16_t flags;
+  bool have_instructions = false;
+  do {
+    if (!reader.ReadU16(&flags) || !reader.Skip(2))
+      return false;
+    have_instructions |= flags & kWeHaveInstructions;
+
+    unsigned args_length = flags & kArg1And2AreWords ? 4 : 2;
+    if (flags & kWeHaveAScale) {
+      args_length += 2;
+    } else if (flags & kWeHaveAnXAndYScale) {
+      args_length += 4;
+    } else if (flags & kWeHaveATwoByTwo) {
+      args_length += 8;
+    }
+    if (!reader.Skip(args_length))
+      return false;
+  } while (flags & kMoreComponents);
+  const size_t components_end = reader.offset();
+
+  uint16_t instructions_length = 0;
+  if (have_instructions) {
+    if (!reader.ReadU16(&instructions_length) ||
+        reader.offset() + instructions_length > length) {
+      return false;
+    }
+    Put255UShort(&s->glyphs, instructions_length);
+    s->instructions.insert(s->instructions.end(), data + reader.offset(),
+                           data + reader.offset() + instructions_length);
+  }
+
+  PutU16(&s->n_contours, 0xffff);
+  s->composites.insert(s->composites.end(), data + 10, data + components_end);
+  // The bounding box of a composite glyph is always stored.
+  s->bbox_bitmap[glyph >> 3] |= 0x80 >> (glyph & 7);
+  s->bboxes.insert(s->bboxes.end(), data + 2, data + 10);
+
+  s->rebuilt_length += Round4(static_cast<uint64_t>(
+      components_end + (have_instructions ? 2 + instructions_length : 0)));
+  return true;
+}
+
+}  // anonymous namespace
+
+bool
+otc_woff2_transform_glyf(OpenTypeFile *file, std::vector<uint8_t> *out) {
+  const OpenTypeGLYF *glyf = file->glyf;
+  const unsigned num_glyphs = file->maxp->num_glyphs;
+
+  GlyfStreams s;
+  s.has_overlap = false;
+  s.rebuilt_length = 0;
+  s.bbox_bitmap.resize(4 * ((num_glyphs + 31) / 32));
+  s.overlap_bitmap.resize((num_glyphs + 7) / 8);
+
+  std::vector<uint8_t> glyph_data;
+  for (unsigned i = 0; i < num_glyphs; ++i) {
+    if (!glyf->glyphs[i].length) {
+      PutU16(&s.n_contours, 0);  // an empty glyph
+      continue;
+    }
+
+    otc_glyf_get_glyph(glyf, i, &glyph_data);
+
+    const int16_t num_contours = glyph_data[0] << 8 | glyph_data[1];
+    if (num_contours > 0) {
+      if (!TransformSimpleGlyph(&s, i, &glyph_data[0], glyph_data.size(),
+                                num_contours)) {
+        return false;
+      }
+    } else if (num_contours < 0) {
+      if (!TransformCompositeGlyph(&s, i, &glyph_data[0], glyph_data.size()))
+        return false;
+    } else {
+      // A glyph with no contours but some data can't be represented.
+      return false;
+    }
+  }
+
+  // The decoder's glyphs may be larger than ours, so the short loca format
+  // might not be able to address them.
+  int16_t index_format = file->head->index_to_loc_format;
+  if (index_format == 0 && s.rebuilt_length > 0x1fffe)
+    index_format = 1;
+
+  out->clear();
+  PutU16(out, 0);  // reserved
+  PutU16(out, s.has_overlap ? kHasOverlapSimpleBitmap : 0);
+  PutU16(out, num_glyphs);
+  PutU16(out, index_format);
+  PutU32(out, s.n_contours.size());
+  PutU32(out, s.n_points.size());
+  PutU32(out, s.flags.size());
+  PutU32(out, s.glyphs.size());
+  PutU32(out, s.composites.size());
+  PutU32(out, s.bbox_bitmap.size() + s.bboxes.size());
+  PutU32(out, s.instructions.size());
+  out->insert(out->end(), s.n_contours.begin(), s.n_contours.end());
+  out->insert(out->end(), s.n_points.begin(), s.n_points.end());
+  out->insert(out->end(), s.flags.begin(), s.flags.end());
+  out->insert(out->end(), s.glyphs.begin(), s.glyphs.end());
+  out->insert(out->end(), s.composites.begin(), s.composites.end());
+  out->insert(out->end(), s.bbox_bitmap.begin(), s.bbox_bitmap.end());
+  out->insert(out->end(), s.bboxes.begin(), s.bboxes.end());
+  out->insert(out->end(), s.instructions.begin(), s.instructions.end());
+  if (s.has_overlap)
+    out->insert(out->end(), s.overlap_bitmap.begin(), s.overlap_bitmap.end());
+
+  file->head->index_to_loc_format = index_format;
+  file->head->flags |= kHeadFlagLosslessTransform;
+  return true;
+}
+
+bool
+otc_woff2_write(OTCStream *out, const std::vector<OTCSerialisedTable> &tables,
+                const std::vector<uint8_t> *transformed_glyf) {
+  const unsigned num_tables = tables.size();
+
+  std::vector<uint8_t> directory;
+  std::vector<uint8_t> font_data;
+  size_t sfnt_size = 12 + 16 * num_tables;
+  for (unsigned i = 0; i < num_tables; ++i) {
+    const OTCSerialisedTable &table = tables[i];
+    sfnt_size += Round4(table.data.size());
+
+    uint8_t flags = kArbitraryTag;
+    for (unsigned j = 0; j < kArbitraryTag; ++j) {
+      if (!memcmp(&table.tag, kKnownTags[j], 4)) {
+        flags = j;
+        break;
+      }
+    }
+
+    const bool is_glyf = !memcmp(&table.tag, "glyf", 4);
+    const bool is_loca = !memcmp(&table.tag, "loca", 4);
+    if (is_glyf || is_loca)
+      flags |= transformed_glyf ? kTransformed : kNullTransformGlyfLoca;
+
+    directory.push_back(flags);
+    if ((flags & 0x3f) == kArbitraryTag)
+      directory.insert(directory.end(), reinterpret_cast<const uint8_t*>(&table.tag),
+                       reinterpret_cast<const uint8_t*>(&table.tag) + 4);
+    PutUIntBase128(&directory, table.data.size());
+
+    if (transformed_glyf && is_glyf) {
+      PutUIntBase128(&directory, transformed_glyf->size());
+      font_data.insert(font_data.end(), transformed_glyf->begin(),
+                       transformed_glyf->end());
+    } else if (transformed_glyf && is_loca) {
+      // The decoder rebuilds loca from the transformed glyf table.
+      PutUIntBase128(&directory, 0);
+    } else {
+      font_data.insert(font_data.end(), table.data.begin(), table.data.end());
+    }
+  }
+
+  size_t compressed_length = BrotliEncoderMaxCompressedSize(font_data.size());
+  if (!compressed_length)
+    return failure();
+  std::vector<uint8_t> compressed(compressed_length);
+  if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW,
+                             BROTLI_MODE_FONT, font_data.size(),
+                             font_data.empty() ? NULL : &font_data[0],
+                             &compressed_length, &compressed[0])) {
+    return failure();
+  }
+
+  const size_t woff_size = kWOFF2HeaderLength + directory.size() +
+                           Round4(compressed_length);
+  if (woff_size > 0xffffffff || sfnt_size > 0xffffffff)
+    return failure();
+
+  if (!out->WriteU32(kWOFF2Signature) ||
+      !out->WriteU32(0x00010000) ||  // flavor: TrueType outlines
+      !out->WriteU32(woff_size) ||
+      !out->WriteU16(num_tables) ||
+      !out->WriteU16(0) ||  // reserved
+      !out->WriteU32(sfnt_size) ||
+      !out->WriteU32(compressed_length) ||
+      !out->WriteU16(0) ||  // majorVersion
+      !out->WriteU16(0) ||  // minorVersion
+      !out->WriteU32(0) ||  // metaOffset
+      !out->WriteU32(0) ||  // metaLength
+      !out->WriteU32(0) ||  // metaOrigLength
+      !out->WriteU32(0) ||  // privOffset
+      !out->WriteU32(0) ||  // privLength
+      !out->Write(&directory[0], directory.size()) ||
+      !out->Write(&compressed[0], compressed_length)) {
+    return failure();
+  }
+  out->Pad((4 - (compressed_length & 3)) % 4);
+
+  if (!out->Flush())
+    return failure();
+
+  return true;
+}
@@ -0,0 +1,115 @@
+// Sanitises a number of files with otc_process_batch and checks that the
+// results are identical to those from calling otc_process serially. It also
+// reports the time taken by each so that the scaling can be measured.
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opentype-condom.h"
+#include "file-stream.h"
+
+static int
+usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s <num threads> <repeats> <ttf file>...\n", argv0);
+  return 1;
+}
+
+static double
+now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+int
+main(int argc, char **argv) {
+  if (argc < 4)
+    return usage(argv[0]);
+
+  const unsigned num_threads = atoi(argv[1]);
+  const unsigned repeats = atoi(argv[2]);
+  const unsigned num_files = argc - 3;
+  const unsigned count = num_files * repeats;
+  if (!count)
+    return usage(argv[0]);
+
+  uint8_t **files = new uint8_t*[num_files];
+  size_t *file_lengths = new size_t[num_files];
+  for (unsigned i = 0; i < num_files; ++i) {
+    const int fd = open(argv[3 + i], O_RDONLY);
+    if (fd < 0) {
+      perror("open");
+      return 1;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+
+    files[i] = (uint8_t *) malloc(st.st_size);
+    read(fd, files[i], st.st_size);
+    close(fd);
+    file_lengths[i] = st.st_size;
+  }
+
+  // Each file is repeated |repeats| times so that there's enough work to time.
+  const uint8_t **inputs = new const uint8_t*[count];
+  size_t *lengths = new size_t[count];
+  for (unsigned i = 0; i < count; ++i) {
+    inputs[i] = files[i % num_files];
+    lengths[i] = file_lengths[i % num_files];
+  }
+
+  char **serial = new char*[count];
+  size_t *serial_lengths = new size_t[count];
+  bool *serial_results = new bool[count];
+  double start = now();
+  for (unsigned i = 0; i < count; ++i) {
+    FILE *memstream = open_memstream(&serial[i], &serial_lengths[i]);
+    FILEStream output(memstream);
+    serial_results[i] = otc_process(&output, inputs[i], lengths[i]);
+    fclose(memstream);
+  }
+  const double serial_time = now() - start;
+
+  char **batch = new char*[count];
+  size_t *batch_lengths = new size_t[count];
+  bool *batch_results = new bool[count];
+  FILE **memstreams = new FILE*[count];
+  OTCStream **outputs = new OTCStream*[count];
+  for (unsigned i = 0; i < count; ++i) {
+    memstreams[i] = open_memstream(&batch[i], &batch_lengths[i]);
+    outputs[i] = new FILEStream(memstreams[i]);
+  }
+  start = now();
+  otc_process_batch(outputs, inputs, lengths, batch_results, count,
+                    num_threads);
+  const double batch_time = now() - start;
+
+  int ret = 0;
+  for (unsigned i = 0; i < count; ++i) {
+    delete outputs[i];
+    fclose(memstreams[i]);
+
+    if (batch_results[i] != serial_results[i]) {
+      fprintf(stderr, "Results differ for %s\n", argv[3 + i % num_files]);
+      ret = 1;
+    } else if (batch_lengths[i] != serial_lengths[i] ||
+               memcmp(batch[i], serial[i], serial_lengths[i])) {
+      fprintf(stderr, "Outputs differ for %s\n", argv[3 + i % num_files]);
+      ret = 1;
+    }
+
+    free(batch[i]);
+    free(serial[i]);
+  }
+
+  fprintf(stderr, "%u fonts: serial %.3fs, batch %.3fs (%.2fx)\n", count,
+          serial_time, batch_time, serial_time / batch_time);
+
+  return ret;
+}
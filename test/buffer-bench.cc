@@ -0,0 +1,200 @@
+// Checks the bulk array readers in Buffer against reading one element at a
+// time and measures both on maximum sized tables: loca, hmtx and the post
+// glyph name indexes for 65535 glyphs.
+
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "otc.h"
+
+static double
+now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static const unsigned kNumGlyphs = 65535;
+static const unsigned kIterations = 1000;
+
+static void
+Report(const char *name, double element_time, double array_time,
+       size_t bytes) {
+  printf("%-12s per-element %7.1f us, array %7.1f us (%5.2f GB/s, %.1fx)\n",
+         name, element_time * 1e6 / kIterations, array_time * 1e6 / kIterations,
+         bytes * kIterations / array_time / 1e9, element_time / array_time);
+}
+
+static bool
+BenchLocaShort(const std::vector<uint8_t> &table) {
+  std::vector<uint32_t> expected(kNumGlyphs + 1), offsets(kNumGlyphs + 1);
+
+  double start = now();
+  for (unsigned n = 0; n < kIterations; ++n) {
+    Buffer buffer(&table[0], table.size());
+    unsigned last_offset = 0;
+    for (unsigned i = 0; i <= kNumGlyphs; ++i) {
+      uint16_t offset;
+      if (!buffer.ReadU16(&offset) || offset < last_offset)
+        return false;
+      last_offset = offset;
+      expected[i] = offset * 2;
+    }
+  }
+  const double element_time = now() - start;
+
+  start = now();
+  for (unsigned n = 0; n < kIterations; ++n) {
+    Buffer buffer(&table[0], table.size());
+    if (!buffer.ReadMonotonicU16Array(&offsets[0], kNumGlyphs + 1, 1))
+      return false;
+  }
+  const double array_time = now() - start;
+
+  Report("loca short", element_time, array_time, table.size());
+  return offsets == expected;
+}
+
+static bool
+BenchLocaLong(const std::vector<uint8_t> &table) {
+  std::vector<uint32_t> expected(kNumGlyphs + 1), offsets(kNumGlyphs + 1);
+
+  double start = now();
+  for (unsigned n = 0; n < kIterations; ++n) {
+    Buffer buffer(&table[0], table.size());
+    unsigned last_offset = 0;
+    for (unsigned i = 0; i <= kNumGlyphs; ++i) {
+      uint32_t offset;
+      if (!buffer.ReadU32(&offset) || offset < last_offset)
+        return false;
+      last_offset = offset;
+      expected[i] = offset;
+    }
+  }
+  const double element_time = now() - start;
+
+  start = now();
+  for (unsigned n = 0; n < kIterations; ++n) {
+    Buffer buffer(&table[0], table.size());
+    if (!buffer.ReadMonotonicU32Array(&offsets[0], kNumGlyphs + 1))
+      return false;
+  }
+  const double array_time = now() - start;
+
+  Report("loca long", element_time, array_time, table.size());
+  return offsets == expected;
+}
+
+static bool
+BenchHmtx(const std::vector<uint8_t> &table, uint16_t adv_width_max,
+          int16_t min_lsb) {
+  std::vector<std::pair<uint16_t, int16_t> > expected, metrics(kNumGlyphs);
+
+  double start = now();
+  for (unsigned n = 0; n < kIterations; ++n) {
+    Buffer buffer(&table[0], table.size());
+    expected.clear();
+    for (unsigned i = 0; i < kNumGlyphs; ++i) {
+      uint16_t adv;
+      int16_t lsb;
+      if (!buffer.ReadU16(&adv) || !buffer.ReadS16(&lsb))
+        return false;
+      if (adv > adv_width_max || lsb < min_lsb)
+        return false;
+      expected.push_back(std::make_pair(adv, lsb));
+    }
+  }
+  const double element_time = now() - start;
+
+  start = now();
+  for (unsigned n = 0; n < kIterations; ++n) {
+    Buffer buffer(&table[0], table.size());
+    if (!buffer.ReadU16S16Array(reinterpret_cast<uint16_t*>(&metrics[0]),
+                                kNumGlyphs, adv_width_max, min_lsb)) {
+      return false;
+    }
+  }
+  const double array_time = now() - start;
+
+  Report("hmtx", element_time, array_time, table.size());
+  return metrics == expected;
+}
+
+static bool
+BenchPost(const std::vector<uint8_t> &table) {
+  std::vector<uint16_t> expected(kNumGlyphs), indexes(kNumGlyphs);
+
+  double start = now();
+  for (unsigned n = 0; n < kIterations; ++n) {
+    Buffer buffer(&table[0], table.size());
+    for (unsigned i = 0; i < kNumGlyphs; ++i) {
+      if (!buffer.ReadU16(&expected[i]) || expected[i] >= 32768)
+        return false;
+    }
+  }
+  const double element_time = now() - start;
+
+  start = now();
+  for (unsigned n = 0; n < kIterations; ++n) {
+    Buffer buffer(&table[0], table.size());
+    if (!buffer.ReadU16Array(&indexes[0], kNumGlyphs, 32767))
+      return false;
+  }
+  const double array_time = now() - start;
+
+  Report("post", element_time, array_time, table.size());
+  return indexes == expected;
+}
+
+int
+main() {
+  srand(1);
+
+  std::vector<uint8_t> loca_short, loca_long, hmtx, post;
+  uint32_t offset = 0;
+  for (unsigned i = 0; i <= kNumGlyphs; ++i) {
+    loca_short.push_back(offset >> 9);
+    loca_short.push_back(offset >> 1);
+    loca_long.push_back(offset >> 24);
+    loca_long.push_back(offset >> 16);
+    loca_long.push_back(offset >> 8);
+    loca_long.push_back(offset);
+    offset += (rand() % 2) * 2;
+  }
+
+  for (unsigned i = 0; i < kNumGlyphs; ++i) {
+    const uint16_t adv = rand() % 2000;
+    const int16_t lsb = rand() % 2000 - 1000;
+    hmtx.push_back(adv >> 8);
+    hmtx.push_back(adv);
+    hmtx.push_back(lsb >> 8);
+    hmtx.push_back(lsb);
+
+    const uint16_t index = rand() % 32768;
+    post.push_back(index >> 8);
+    post.push_back(index);
+  }
+
+  bool ok = true;
+  if (!BenchLocaShort(loca_short)) {
+    fprintf(stderr, "loca short: results differ\n");
+    ok = false;
+  }
+  if (!BenchLocaLong(loca_long)) {
+    fprintf(stderr, "loca long: results differ\n");
+    ok = false;
+  }
+  if (!BenchHmtx(hmtx, 2000, -1000)) {
+    fprintf(stderr, "hmtx: results differ\n");
+    ok = false;
+  }
+  if (!BenchPost(post)) {
+    fprintf(stderr, "post: results differ\n");
+    ok = false;
+  }
+
+  return !ok;
+}
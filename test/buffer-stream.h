@@ -0,0 +1,38 @@
+#ifndef OTC_BUFFER_STREAM_H_
+#define OTC_BUFFER_STREAM_H_
+
+#include <algorithm>
+#include <vector>
+
+// An OTCStream which keeps the output in memory.
+class BufferStream : public OTCStream {
+ public:
+  BufferStream()
+      : position_(0) {
+  }
+
+  bool WriteRaw(const void *data, size_t length) {
+    const uint8_t *bytes = static_cast<const uint8_t*>(data);
+    if (data_.size() < position_ + length)
+      data_.resize(position_ + length);
+    std::copy(bytes, bytes + length, data_.begin() + position_);
+    position_ += length;
+    return true;
+  }
+
+  void Seek(off_t position) {
+    position_ = position;
+  }
+
+  off_t Tell() const {
+    return position_;
+  }
+
+  const std::vector<uint8_t> &data() const { return data_; }
+
+ private:
+  std::vector<uint8_t> data_;
+  size_t position_;
+};
+
+#endif  // OTC_BUFFER_STREAM_H_
@@ -0,0 +1,117 @@
+// Checks the vectorised checksum kernels against the scalar one and measures
+// their throughput, both directly and through OTCStream::Write.
+
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "opentype-condom.h"
+#include "checksum.h"
+
+// A stream which discards everything, so that we only time the checksum.
+class NullStream : public OTCStream {
+ public:
+  bool WriteRaw(const void *data, size_t length) {
+    return true;
+  }
+
+  void Seek(off_t position) {
+  }
+
+  off_t Tell() const {
+    return 0;
+  }
+};
+
+static double
+now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static const size_t kBufferSize = 16 * 1024 * 1024;
+static const unsigned kIterations = 32;
+
+typedef uint32_t (*ChecksumKernel) (const uint8_t *data, size_t num_words);
+
+static bool
+TestKernel(const char *name, ChecksumKernel kernel, const uint8_t *buffer) {
+  // Check every alignment and a spread of lengths, including those which
+  // leave a tail for the scalar code.
+  for (unsigned align = 0; align < 4; ++align) {
+    for (size_t num_words = 0; num_words < 300; ++num_words) {
+      if (kernel(buffer + align, num_words) !=
+          otc_checksum_words_scalar(buffer + align, num_words)) {
+        fprintf(stderr, "%s: wrong result for %zu words at alignment %u\n",
+                name, num_words, align);
+        return false;
+      }
+    }
+  }
+
+  const size_t num_words = kBufferSize / 4 - 1;
+  if (kernel(buffer + 1, num_words) !=
+      otc_checksum_words_scalar(buffer + 1, num_words)) {
+    fprintf(stderr, "%s: wrong result for the whole buffer\n", name);
+    return false;
+  }
+
+  uint32_t sink = 0;
+  const double start = now();
+  for (unsigned i = 0; i < kIterations; ++i)
+    sink += kernel(buffer, kBufferSize / 4);
+  const double elapsed = now() - start;
+
+  printf("%-8s %8.2f GB/s (%08x)\n", name,
+         kBufferSize * kIterations / elapsed / 1e9, sink);
+  return true;
+}
+
+static bool
+TestStream(size_t chunk_size, const uint8_t *buffer) {
+  const uint32_t expected = otc_checksum_words_scalar(buffer, kBufferSize / 4);
+
+  NullStream stream;
+  const double start = now();
+  for (unsigned i = 0; i < kIterations; ++i) {
+    stream.ResetChecksum();
+    for (size_t offset = 0; offset < kBufferSize; offset += chunk_size)
+      stream.Write(buffer + offset, std::min(chunk_size, kBufferSize - offset));
+    if (stream.chksum() != expected) {
+      fprintf(stderr, "OTCStream: wrong result with %zu byte writes\n",
+              chunk_size);
+      return false;
+    }
+  }
+  const double elapsed = now() - start;
+
+  printf("OTCStream::Write, %6zu byte writes %8.2f GB/s\n", chunk_size,
+         kBufferSize * kIterations / elapsed / 1e9);
+  return true;
+}
+
+int
+main() {
+  uint8_t *buffer = (uint8_t *) malloc(kBufferSize + 3);
+  srand(1);
+  for (size_t i = 0; i < kBufferSize + 3; ++i)
+    buffer[i] = rand();
+
+  bool ok = TestKernel("scalar", otc_checksum_words_scalar, buffer);
+#if defined(OTC_CHECKSUM_X86)
+  if (otc_cpu_has_sse2())
+    ok &= TestKernel("sse2", otc_checksum_words_sse2, buffer);
+  if (otc_cpu_has_avx2())
+    ok &= TestKernel("avx2", otc_checksum_words_avx2, buffer);
+#endif
+  ok &= TestKernel("dispatch", otc_checksum_words, buffer);
+
+  // Odd sizes exercise the carry buffer between writes.
+  static const size_t chunk_sizes[] = { 2, 7, 64, 1021, 65536 };
+  for (unsigned i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); ++i)
+    ok &= TestStream(chunk_sizes[i], buffer);
+
+  free(buffer);
+  return !ok;
+}
@@ -0,0 +1,233 @@
+// Measures the validation of format 4 cmap subtables on adversarial tables
+// which map every code-point in the BMP, comparing otc_cmap_parse against a
+// lookup of each code-point in turn.
+
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "otc.h"
+#include "cmap.h"
+#include "maxp.h"
+
+bool otc_cmap_parse(OpenTypeFile *file, const uint8_t *data, size_t length);
+void otc_cmap_free(OpenTypeFile *file);
+
+static double
+now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static const unsigned kNumGlyphs = 65535;
+static const unsigned kIterations = 200;
+
+struct Segment {
+  uint16_t start;
+  uint16_t end;
+  int16_t delta;
+  // If true, the segment maps through the glyph id array to glyph
+  // (code-point % kNumGlyphs)
+  bool use_array;
+};
+
+static void
+PutU16(std::vector<uint8_t> *out, unsigned value) {
+  out->push_back(value >> 8);
+  out->push_back(value);
+}
+
+static void
+SetU16(std::vector<uint8_t> *out, size_t offset, unsigned value) {
+  (*out)[offset] = value >> 8;
+  (*out)[offset + 1] = value;
+}
+
+// Builds a cmap table with a single 3.1.4 subtable containing |segments|.
+static std::vector<uint8_t>
+BuildCMAP(const std::vector<Segment> &segments) {
+  std::vector<uint8_t> table;
+  const unsigned segcount = segments.size();
+  unsigned log2segcount = 0;
+  while (1u << (log2segcount + 1) <= segcount)
+    log2segcount++;
+
+  PutU16(&table, 0);  // version
+  PutU16(&table, 1);  // numTables
+  PutU16(&table, 3);
+  PutU16(&table, 1);
+  PutU16(&table, 0);  // offset
+  PutU16(&table, 12);
+
+  const size_t subtable = table.size();
+  PutU16(&table, 4);  // format
+  PutU16(&table, 0);  // length, filled in below
+  PutU16(&table, 0);  // language
+  PutU16(&table, segcount * 2);
+  PutU16(&table, 2 << log2segcount);
+  PutU16(&table, log2segcount);
+  PutU16(&table, segcount * 2 - (2 << log2segcount));
+  for (unsigned i = 0; i < segcount; ++i)
+    PutU16(&table, segments[i].end);
+  PutU16(&table, 0);
+  for (unsigned i = 0; i < segcount; ++i)
+    PutU16(&table, segments[i].start);
+  for (unsigned i = 0; i < segcount; ++i)
+    PutU16(&table, segments[i].delta);
+
+  const size_t id_range_offsets = table.size();
+  for (unsigned i = 0; i < segcount; ++i)
+    PutU16(&table, 0);
+  for (unsigned i = 0; i < segcount; ++i) {
+    if (!segments[i].use_array)
+      continue;
+    SetU16(&table, id_range_offsets + i * 2,
+           table.size() - (id_range_offsets + i * 2));
+    for (unsigned cp = segments[i].start; cp <= segments[i].end; ++cp)
+      PutU16(&table, cp % kNumGlyphs);
+  }
+
+  if (table.size() - subtable > 0xffff) {
+    fprintf(stderr, "subtable too large\n");
+    abort();
+  }
+  SetU16(&table, subtable + 2, table.size() - subtable);
+  return table;
+}
+
+// The previous validation of format 4 subtables, which simulates a lookup of
+// each code-point.
+static bool
+SimulateLookups(const uint8_t *data, size_t length) {
+  data += 12;
+  length -= 12;
+  const unsigned segcount = (data[6] << 8 | data[7]) / 2;
+  const uint8_t *end_codes = data + 14;
+  const uint8_t *start_codes = end_codes + segcount * 2 + 2;
+  const uint8_t *id_deltas = start_codes + segcount * 2;
+  const uint8_t *id_range_offsets = id_deltas + segcount * 2;
+
+  for (unsigned i = 0; i < segcount; ++i) {
+    const uint16_t start = start_codes[i * 2] << 8 | start_codes[i * 2 + 1];
+    const uint16_t end = end_codes[i * 2] << 8 | end_codes[i * 2 + 1];
+    const uint16_t delta = id_deltas[i * 2] << 8 | id_deltas[i * 2 + 1];
+    const uint16_t id_range_offset =
+        id_range_offsets[i * 2] << 8 | id_range_offsets[i * 2 + 1];
+    const uint32_t id_range_offset_offset =
+        id_range_offsets + i * 2 - data;
+
+    for (unsigned cp = start; cp <= end; ++cp) {
+      const uint16_t code_point = cp;
+      if (id_range_offset == 0) {
+        const uint16_t glyph = code_point + delta;
+        if (glyph >= kNumGlyphs)
+          return false;
+      } else {
+        const uint16_t range_delta = code_point - start;
+        const uint32_t glyph_id_offset = id_range_offset_offset +
+                                         id_range_offset +
+                                         range_delta * 2;
+        if (glyph_id_offset + 1 >= length)
+          return false;
+        const uint16_t glyph =
+            data[glyph_id_offset] << 8 | data[glyph_id_offset + 1];
+        if (glyph >= kNumGlyphs)
+          return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+static bool
+Bench(const char *name, const std::vector<Segment> &segments) {
+  const std::vector<uint8_t> table = BuildCMAP(segments);
+
+  OpenTypeMAXP maxp;
+  memset(&maxp, 0, sizeof(maxp));
+  maxp.num_glyphs = kNumGlyphs;
+
+  double start = now();
+  for (unsigned n = 0; n < kIterations; ++n) {
+    if (!SimulateLookups(&table[0], table.size()))
+      return false;
+  }
+  const double simulate_time = now() - start;
+
+  start = now();
+  for (unsigned n = 0; n < kIterations; ++n) {
+    OpenTypeFile file;
+    file.maxp = &maxp;
+    if (!otc_cmap_parse(&file, &table[0], table.size()))
+      return false;
+    const bool ok = file.cmap->subtable_314_data == &table[12];
+    otc_cmap_free(&file);
+    if (!ok)
+      return false;
+  }
+  const double parse_time = now() - start;
+
+  printf("%-14s %5u segments: per-code-point %8.1f us, "
+         "per-segment %7.1f us (%.1fx)\n",
+         name, static_cast<unsigned>(segments.size()),
+         simulate_time * 1e6 / kIterations, parse_time * 1e6 / kIterations,
+         simulate_time / parse_time);
+  return true;
+}
+
+static Segment
+MakeSegment(unsigned start, unsigned end, int delta, bool use_array) {
+  Segment segment;
+  segment.start = start;
+  segment.end = end;
+  segment.delta = delta;
+  segment.use_array = use_array;
+  return segment;
+}
+
+int
+main() {
+  std::vector<Segment> segments;
+  bool ok = true;
+
+  // A single segment mapping every code-point (except the final 0xffff) by
+  // delta.
+  segments.push_back(MakeSegment(0, 0xfffe, 0, false));
+  segments.push_back(MakeSegment(0xffff, 0xffff, 1, false));
+  ok &= Bench("delta", segments);
+
+  // As many segments as fit in a subtable, each of eight code-points.
+  segments.clear();
+  for (unsigned i = 0; i < 7000; ++i)
+    segments.push_back(MakeSegment(i * 8, i * 8 + 7, 1000, false));
+  segments.push_back(MakeSegment(7000 * 8, 0xfffe, 0, false));
+  segments.push_back(MakeSegment(0xffff, 0xffff, 1, false));
+  ok &= Bench("many deltas", segments);
+
+  // The largest glyph id array which fits in a subtable, with the rest of the
+  // BMP mapped by delta.
+  segments.clear();
+  segments.push_back(MakeSegment(0, 0x7ef0, 0, true));
+  segments.push_back(MakeSegment(0x7ef1, 0xfffe, -0x7ef1, false));
+  segments.push_back(MakeSegment(0xffff, 0xffff, 1, false));
+  ok &= Bench("glyph array", segments);
+
+  // Many small segments using the glyph id array.
+  segments.clear();
+  for (unsigned i = 0; i < 2000; ++i)
+    segments.push_back(MakeSegment(i * 16, i * 16 + 11, 0, true));
+  segments.push_back(MakeSegment(2000 * 16, 0xfffe, 0, false));
+  segments.push_back(MakeSegment(0xffff, 0xffff, 1, false));
+  ok &= Bench("many arrays", segments);
+
+  if (!ok) {
+    fprintf(stderr, "FAILED\n");
+    return 1;
+  }
+  return 0;
+}
@@ -8,6 +8,113 @@
 #include "opentype-condom.h"
 #include "file-stream.h"
 
+// Check that two character map indexes agree on every code-point, and that
+// batched lookups agree with single ones.
+static bool
+CompareCMAPIndexes(const OTCCMAPIndex *a, const OTCCMAPIndex *b) {
+  static const uint32_t kNumCodePoints = 0x110000 + 16;
+  std::vector<uint32_t> code_points(kNumCodePoints);
+  for (uint32_t i = 0; i < kNumCodePoints; ++i)
+    code_points[i] = i;
+  std::vector<uint16_t> glyphs(kNumCodePoints);
+  otc_cmap_lookup_batch(&glyphs[0], b, &code_points[0], kNumCodePoints);
+
+  for (uint32_t i = 0; i < kNumCodePoints; ++i) {
+    if (otc_cmap_lookup(a, i) != glyphs[i])
+      return false;
+  }
+  return true;
+}
+
+// Check that |coverage| contains exactly the code-points which |index| maps
+// to a glyph.
+static bool
+CheckCoverage(const OTCCMAPIndex *index, const OTCCoverage &coverage) {
+  static const uint32_t kNumCodePoints = 0x110000;
+  if (coverage.bitmap.size() != kNumCodePoints / 8)
+    return false;
+
+  std::vector<bool> covered(kNumCodePoints);
+  for (unsigned i = 0; i < coverage.ranges.size(); ++i) {
+    const OTCCodePointRange &range = coverage.ranges[i];
+    if (range.start > range.end || range.end >= kNumCodePoints)
+      return false;
+    if (i && range.start <= coverage.ranges[i - 1].end + 1)
+      return false;
+    for (uint32_t cp = range.start; cp <= range.end; ++cp)
+      covered[cp] = true;
+  }
+
+  for (uint32_t cp = 0; cp < kNumCodePoints; ++cp) {
+    const bool mapped = otc_cmap_lookup(index, cp);
+    const bool in_bitmap = (coverage.bitmap[cp >> 3] >> (cp & 7)) & 1;
+    if (mapped != covered[cp] || mapped != in_bitmap)
+      return false;
+  }
+  return true;
+}
+
+// A stream which can't seek, like a pipe or a socket.
+class ForwardOnlyStream : public FILEStream {
+ public:
+  ForwardOnlyStream(FILE *stream)
+      : FILEStream(stream) {
+  }
+
+  void Seek(off_t position) {
+    fprintf(stderr, "Seek called on a forward only stream\n");
+    abort();
+  }
+
+  off_t Tell() const {
+    fprintf(stderr, "Tell called on a forward only stream\n");
+    abort();
+  }
+};
+
+// Check that compacting the output of |data| makes it no larger than
+// |result_len|, leaves the character map as in |cmap_index| and that
+// sanitising the compacted output changes nothing.
+static bool
+CheckCompact(const uint8_t *data, size_t length, size_t result_len,
+             const OTCCMAPIndex *cmap_index) {
+  OTCOptions options;
+  options.compact = true;
+  options.drop_glyph_names = true;
+  OTCCompactStats stats;
+  options.compact_stats = &stats;
+
+  size_t compact_len;
+  if (!otc_output_size(&compact_len, data, length, options) ||
+      compact_len > result_len) {
+    return false;
+  }
+
+  std::vector<uint8_t> compact(compact_len), resanitised(compact_len);
+  size_t written;
+  OTCCMAPIndex *compact_cmap_index = NULL;
+  options.cmap_index = &compact_cmap_index;
+  if (!otc_process_buffer(&compact[0], compact_len, &written, data, length,
+                          options) ||
+      written != compact_len) {
+    return false;
+  }
+  const bool cmap_indexes_match =
+      CompareCMAPIndexes(cmap_index, compact_cmap_index);
+  otc_cmap_index_free(compact_cmap_index);
+  if (!cmap_indexes_match)
+    return false;
+
+  if (!otc_process_buffer(&resanitised[0], compact_len, &written, &compact[0],
+                          compact_len) ||
+      written != compact_len ||
+      compact != resanitised) {
+    return false;
+  }
+
+  return true;
+}
+
 static int
 usage(const char *argv0) {
   fprintf(stderr, "Usage: %s <ttf file>\n", argv0);
@@ -43,21 +150,140 @@ main(int argc, char **argv) {
     fprintf(stderr, "Failed to sanitise file!\n");
     return 1;
   }
+
+  char *result_fwd;
+  size_t result_fwd_len;
+  memstream = open_memstream(&result_fwd, &result_fwd_len);
+  ForwardOnlyStream output_fwd(memstream);
+  OTCOptions options;
+  options.forward_only = true;
+  // The tables are parsed in parallel too, which mustn't change anything.
+  options.num_threads = 0;
+  OTCCMAPIndex *cmap_index = NULL;
+  options.cmap_index = &cmap_index;
+  OTCCoverage coverage;
+  coverage.want_bitmap = true;
+  options.coverage = &coverage;
+  r = otc_process(&output_fwd, data, st.st_size, options);
+  options.cmap_index = NULL;
+  options.coverage = NULL;
+  fclose(memstream);
+  if (!r) {
+    free(result);
+    free(result_fwd);
+    fprintf(stderr, "Failed to sanitise file in forward only mode!\n");
+    return 1;
+  }
+
+  if (!CheckCoverage(cmap_index, coverage)) {
+    free(result);
+    otc_cmap_index_free(cmap_index);
+    free(result_fwd);
+    fprintf(stderr, "Coverage doesn't match the character map\n");
+    return 1;
+  }
+
+  if (result_fwd_len != result_len ||
+      memcmp(result_fwd, result, result_len)) {
+    free(result);
+    otc_cmap_index_free(cmap_index);
+    free(result_fwd);
+    fprintf(stderr, "Forward only output differs\n");
+    return 1;
+  }
+  free(result_fwd);
+
+  // The segments from an OTCIOVecStream should add up to the same output.
+  OTCIOVecStream output_iov(data, st.st_size);
+  r = otc_process(&output_iov, data, st.st_size, options);
+  if (!r) {
+    free(result);
+    otc_cmap_index_free(cmap_index);
+    fprintf(stderr, "Failed to sanitise file to an iovec!\n");
+    return 1;
+  }
+
+  std::vector<struct iovec> iov;
+  output_iov.GetIOVec(&iov);
+  size_t iov_offset = 0;
+  for (unsigned i = 0; i < iov.size(); ++i) {
+    if (iov_offset + iov[i].iov_len > result_len ||
+        memcmp(result + iov_offset, iov[i].iov_base, iov[i].iov_len)) {
+      free(result);
+      otc_cmap_index_free(cmap_index);
+      fprintf(stderr, "iovec output differs\n");
+      return 1;
+    }
+    iov_offset += iov[i].iov_len;
+  }
+  if (iov_offset != result_len) {
+    free(result);
+    otc_cmap_index_free(cmap_index);
+    fprintf(stderr, "iovec output differs in length\n");
+    return 1;
+  }
+
+  // Without forward_only, the layout can't be written to an OTCIOVecStream.
+  OTCIOVecStream seeking_iov(data, st.st_size);
+  if (otc_process(&seeking_iov, data, st.st_size)) {
+    free(result);
+    otc_cmap_index_free(cmap_index);
+    fprintf(stderr, "Seeking in an iovec didn't fail!\n");
+    return 1;
+  }
+
+  if (!CheckCompact(data, st.st_size, result_len, cmap_index)) {
+    free(result);
+    otc_cmap_index_free(cmap_index);
+    fprintf(stderr, "Compact output is larger or not idempotent\n");
+    return 1;
+  }
   free(data);
 
-  char *result2;
+  // The second time around we find the size of the output first and write it
+  // into a single, exactly sized buffer.
+  size_t result2_size;
+  if (!otc_output_size(&result2_size, (const uint8_t *) result, result_len)) {
+    free(result);
+    otc_cmap_index_free(cmap_index);
+    fprintf(stderr, "Failed to size sanitised previous output!\n");
+    return 1;
+  }
+
+  char *result2 = (char *) malloc(result2_size);
   size_t result2_len;
-  memstream = open_memstream(&result2, &result2_len);
-  FILEStream output2(memstream);
-  r = otc_process(&output2, (const uint8_t *) result, result_len);
-  fclose(memstream);
+  OTCCMAPIndex *cmap_index2 = NULL;
+  OTCOptions options2;
+  options2.cmap_index = &cmap_index2;
+  r = otc_process_buffer((uint8_t *) result2, result2_size, &result2_len,
+                         (const uint8_t *) result, result_len, options2);
   if (!r) {
     free(result);
     free(result2);
+    otc_cmap_index_free(cmap_index);
     fprintf(stderr, "Failed to sanitise previous output!");
     return 1;
   }
 
+  // The character map should be unchanged by sanitising.
+  const bool cmap_indexes_match = CompareCMAPIndexes(cmap_index, cmap_index2);
+  otc_cmap_index_free(cmap_index);
+  otc_cmap_index_free(cmap_index2);
+  if (!cmap_indexes_match) {
+    free(result);
+    free(result2);
+    fprintf(stderr, "Character map indexes differ\n");
+    return 1;
+  }
+
+  if (result2_len != result2_size) {
+    fprintf(stderr, "Output size was %zu, but %zu was predicted\n",
+            result2_len, result2_size);
+    free(result);
+    free(result2);
+    return 1;
+  }
+
   bool dump_results = false;
   if (result2_len != result_len) {
     fprintf(stderr, "Outputs differ in length\n");
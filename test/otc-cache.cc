@@ -0,0 +1,162 @@
+// Sanitises the given files through an OTCCache and checks that every result,
+// whether it comes from the cache or not, is the same as from otc_process. A
+// copy of each file with a bad version number checks that rejections are
+// cached too. The cache is then used from several threads at once, with a
+// size limit small enough that entries are evicted while others use them.
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "opentype-condom.h"
+#include "buffer-stream.h"
+
+static int
+usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s <ttf file>...\n", argv0);
+  return 1;
+}
+
+struct Input {
+  std::vector<uint8_t> data;
+  bool ok;  // the result of otc_process
+  std::vector<uint8_t> expected;  // the output of otc_process
+};
+
+static std::vector<Input> inputs;
+
+// Returns true if sanitising input |i| through |cache| gives the same result
+// as otc_process.
+static bool
+Check(OTCCache *cache, unsigned i,
+      const OTCOptions &options = OTCOptions()) {
+  BufferStream output;
+  const Input &input = inputs[i];
+  const bool ok = otc_process_cached(cache, &output, &input.data[0],
+                                     input.data.size(), options);
+  return ok == input.ok && (!ok || output.data() == input.expected);
+}
+
+static unsigned failures = 0;
+
+static void *
+Worker(void *arg) {
+  OTCCache *cache = static_cast<OTCCache*>(arg);
+  for (unsigned round = 0; round < 20; ++round) {
+    for (unsigned i = 0; i < inputs.size(); ++i) {
+      if (!Check(cache, i))
+        __sync_fetch_and_add(&failures, 1);
+    }
+  }
+  return NULL;
+}
+
+int
+main(int argc, char **argv) {
+  if (argc < 2)
+    return usage(argv[0]);
+
+  size_t total_bytes = 0;
+  for (int i = 1; i < argc; ++i) {
+    const int fd = open(argv[i], O_RDONLY);
+    if (fd < 0) {
+      perror("open");
+      return 1;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+
+    Input input;
+    input.data.resize(st.st_size);
+    read(fd, &input.data[0], st.st_size);
+    close(fd);
+
+    BufferStream output;
+    input.ok = otc_process(&output, &input.data[0], input.data.size());
+    input.expected = output.data();
+    total_bytes += input.expected.size();
+    inputs.push_back(input);
+
+    // A copy which must be rejected
+    input.data[0] = 0xde;
+    input.ok = false;
+    input.expected.clear();
+    inputs.push_back(input);
+  }
+  const unsigned count = inputs.size();
+  unsigned num_rejected = 0;
+  for (unsigned i = 0; i < count; ++i) {
+    if (!inputs[i].ok)
+      num_rejected++;
+  }
+
+  OTCCache *cache = otc_cache_new(64 * 1024 * 1024);
+  for (unsigned round = 0; round < 2; ++round) {
+    for (unsigned i = 0; i < count; ++i) {
+      if (!Check(cache, i)) {
+        fprintf(stderr, "Input %u gave the wrong result!\n", i);
+        return 1;
+      }
+    }
+  }
+
+  OTCCacheStats stats;
+  otc_cache_stats(cache, &stats);
+  if (stats.misses != count || stats.hits != count ||
+      stats.negative_hits != num_rejected || stats.entries != count ||
+      stats.evictions != 0) {
+    fprintf(stderr, "Unexpected cache counters!\n");
+    return 1;
+  }
+
+  // The options are part of the key.
+  OTCOptions options;
+  options.output_format = OTC_OUTPUT_WOFF;
+  BufferStream woff, cached_woff;
+  otc_process(&woff, &inputs[0].data[0], inputs[0].data.size(), options);
+  otc_process_cached(cache, &cached_woff, &inputs[0].data[0],
+                     inputs[0].data.size(), options);
+  otc_cache_stats(cache, &stats);
+  if (woff.data() != cached_woff.data() || stats.misses != count + 1) {
+    fprintf(stderr, "The output format wasn't part of the key!\n");
+    return 1;
+  }
+  otc_cache_free(cache);
+
+  // A cache with room for about half of the fonts
+  const size_t max_bytes = total_bytes / 2;
+  cache = otc_cache_new(max_bytes);
+  std::vector<pthread_t> threads(8);
+  for (unsigned i = 0; i < threads.size(); ++i)
+    pthread_create(&threads[i], NULL, Worker, cache);
+  for (unsigned i = 0; i < threads.size(); ++i)
+    pthread_join(threads[i], NULL);
+
+  otc_cache_stats(cache, &stats);
+  fprintf(stderr, "hits: %llu (negative: %llu), misses: %llu, "
+          "evictions: %llu, %zu entries, %zu bytes\n",
+          (unsigned long long) stats.hits,
+          (unsigned long long) stats.negative_hits,
+          (unsigned long long) stats.misses,
+          (unsigned long long) stats.evictions, stats.entries, stats.bytes);
+  otc_cache_free(cache);
+
+  if (failures) {
+    fprintf(stderr, "%u results were wrong!\n", failures);
+    return 1;
+  }
+  if (stats.bytes > max_bytes ||
+      stats.hits + stats.misses != 20 * threads.size() * count) {
+    fprintf(stderr, "Unexpected cache counters!\n");
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,154 @@
+// Sanitises the given files, twice each, with OTCOptions::table_memo set and
+// checks that the output is always the same as without it: for each output
+// format, with the tables parsed in parallel and with the options which turn
+// memoisation off for some tables. The second time around every memoised table
+// must be a hit. A copy of the first file with a broken cmap table checks that
+// rejected tables are memoised too.
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "opentype-condom.h"
+#include "buffer-stream.h"
+
+static int
+usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s <ttf file>...\n", argv0);
+  return 1;
+}
+
+// Returns true if sanitising |input| with |options| gives the same result
+// with |memo| as without it.
+static bool
+Check(OTCCache *memo, const std::vector<uint8_t> &input,
+      const OTCOptions &options) {
+  BufferStream expected, output;
+  const bool expected_ok = otc_process(&expected, &input[0], input.size(),
+                                       options);
+
+  OTCOptions memo_options(options);
+  memo_options.table_memo = memo;
+  const bool ok = otc_process(&output, &input[0], input.size(), memo_options);
+  if (ok != expected_ok || (ok && output.data() != expected.data()))
+    return false;
+
+  size_t output_length;
+  if (otc_output_size(&output_length, &input[0], input.size(),
+                      memo_options) != ok ||
+      (ok && output_length != output.data().size())) {
+    return false;
+  }
+
+  return true;
+}
+
+// Returns the offset of the table |tag| in the OpenType file |data|, or 0 if
+// there isn't one.
+static size_t
+FindTable(const std::vector<uint8_t> &data, const char *tag) {
+  const unsigned num_tables = data[4] << 8 | data[5];
+  for (unsigned i = 0; i < num_tables; ++i) {
+    const uint8_t *record = &data[12 + 16 * i];
+    if (!memcmp(record, tag, 4))
+      return record[8] << 24 | record[9] << 16 | record[10] << 8 | record[11];
+  }
+  return 0;
+}
+
+int
+main(int argc, char **argv) {
+  if (argc < 2)
+    return usage(argv[0]);
+
+  std::vector<std::vector<uint8_t> > inputs;
+  for (int i = 1; i < argc; ++i) {
+    const int fd = open(argv[i], O_RDONLY);
+    if (fd < 0) {
+      perror("open");
+      return 1;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+
+    std::vector<uint8_t> input(st.st_size);
+    read(fd, &input[0], st.st_size);
+    close(fd);
+    inputs.push_back(input);
+  }
+
+  std::vector<OTCOptions> option_sets(8);
+  option_sets[1].forward_only = true;
+  option_sets[2].output_format = OTC_OUTPUT_WOFF;
+  option_sets[3].output_format = OTC_OUTPUT_WOFF2;
+  option_sets[4].compact = true;
+  option_sets[5].drop_glyph_names = true;
+  std::vector<uint32_t> subset;
+  subset.push_back('a');
+  option_sets[6].subset = &subset;
+  option_sets[7].num_threads = 0;
+
+  OTCCache *memo = otc_cache_new(64 * 1024 * 1024);
+  for (unsigned i = 0; i < option_sets.size(); ++i) {
+    for (unsigned round = 0; round < 2; ++round) {
+      OTCCacheStats before;
+      otc_cache_stats(memo, &before);
+
+      for (unsigned j = 0; j < inputs.size(); ++j) {
+        if (!Check(memo, inputs[j], option_sets[i])) {
+          fprintf(stderr, "%s gave a different result with options %u!\n",
+                  argv[j + 1], i);
+          return 1;
+        }
+      }
+
+      // The second time around, nothing new is added.
+      OTCCacheStats after;
+      otc_cache_stats(memo, &after);
+      if (round == 1 && after.misses != before.misses) {
+        fprintf(stderr, "Tables were memoised twice with options %u!\n", i);
+        return 1;
+      }
+    }
+  }
+
+  OTCCacheStats stats;
+  otc_cache_stats(memo, &stats);
+  fprintf(stderr, "hits: %llu, misses: %llu, %zu entries, %zu bytes\n",
+          (unsigned long long) stats.hits,
+          (unsigned long long) stats.misses, stats.entries, stats.bytes);
+  if (!stats.hits || stats.negative_hits) {
+    fprintf(stderr, "Unexpected memo counters!\n");
+    return 1;
+  }
+
+  // A cmap table which claims far more subtables than it has
+  std::vector<uint8_t> broken(inputs[0]);
+  const size_t cmap_offset = FindTable(broken, "cmap");
+  if (!cmap_offset) {
+    fprintf(stderr, "%s has no cmap table!\n", argv[1]);
+    return 1;
+  }
+  broken[cmap_offset + 2] = 0xff;
+  broken[cmap_offset + 3] = 0xff;
+  for (unsigned round = 0; round < 2; ++round) {
+    if (!Check(memo, broken, OTCOptions())) {
+      fprintf(stderr, "The broken cmap gave a different result!\n");
+      return 1;
+    }
+  }
+  otc_cache_stats(memo, &stats);
+  if (stats.negative_hits != 3) {
+    fprintf(stderr, "The broken cmap wasn't memoised!\n");
+    return 1;
+  }
+  otc_cache_free(memo);
+
+  return 0;
+}
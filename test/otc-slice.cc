@@ -0,0 +1,131 @@
+// A driver program which splits the file given as argv[1] into slices, one for
+// each of the following arguments (a comma separated list of hex code-points
+// and ranges, like "20-7e,a0,2014"). Slice i is written to
+// <output prefix>.<i>.ttf.
+//
+// Each slice is checked against subsetting the file to the same code-points
+// with otc_process.
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "opentype-condom.h"
+#include "file-stream.h"
+
+static int
+usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s <ttf file> <output prefix> <code-points>...\n",
+          argv0);
+  return 1;
+}
+
+static bool
+ParseCodePoints(std::vector<uint32_t> *code_points, const char *spec) {
+  for (;;) {
+    char *end;
+    const unsigned long start = strtoul(spec, &end, 16);
+    if (end == spec)
+      return false;
+    unsigned long last = start;
+    if (*end == '-') {
+      spec = end + 1;
+      last = strtoul(spec, &end, 16);
+      if (end == spec || last < start)
+        return false;
+    }
+    if (last >= 0x110000)
+      return false;
+    for (unsigned long cp = start; cp <= last; ++cp)
+      code_points->push_back(cp);
+
+    if (!*end)
+      return true;
+    if (*end != ',')
+      return false;
+    spec = end + 1;
+  }
+}
+
+int
+main(int argc, char **argv) {
+  if (argc < 4)
+    return usage(argv[0]);
+
+  const unsigned num_slices = argc - 3;
+  std::vector<std::vector<uint32_t> > slices(num_slices);
+  for (unsigned i = 0; i < num_slices; ++i) {
+    if (!ParseCodePoints(&slices[i], argv[3 + i]))
+      return usage(argv[0]);
+  }
+
+  const int fd = open(argv[1], O_RDONLY);
+  if (fd < 0) {
+    perror("open");
+    return 1;
+  }
+
+  struct stat st;
+  fstat(fd, &st);
+
+  uint8_t *data = (uint8_t *) malloc(st.st_size);
+  read(fd, data, st.st_size);
+  close(fd);
+
+  std::vector<char *> results(num_slices);
+  std::vector<size_t> result_lens(num_slices);
+  std::vector<FILE *> memstreams(num_slices);
+  std::vector<OTCStream *> streams(num_slices);
+  for (unsigned i = 0; i < num_slices; ++i) {
+    memstreams[i] = open_memstream(&results[i], &result_lens[i]);
+    streams[i] = new FILEStream(memstreams[i]);
+  }
+
+  const bool r = otc_process_slices(&streams[0], data, st.st_size, slices);
+  for (unsigned i = 0; i < num_slices; ++i) {
+    fclose(memstreams[i]);
+    delete streams[i];
+  }
+  if (!r) {
+    fprintf(stderr, "Failed to slice file!\n");
+    return 1;
+  }
+
+  int ret = 0;
+  for (unsigned i = 0; i < num_slices; ++i) {
+    OTCOptions options;
+    options.subset = &slices[i];
+    size_t expected_len;
+    if (!otc_output_size(&expected_len, data, st.st_size, options)) {
+      fprintf(stderr, "Failed to subset file!\n");
+      return 1;
+    }
+    uint8_t *expected = (uint8_t *) malloc(expected_len);
+    size_t written;
+    if (!otc_process_buffer(expected, expected_len, &written, data, st.st_size,
+                            options) ||
+        written != result_lens[i] ||
+        memcmp(expected, results[i], written)) {
+      fprintf(stderr, "Slice %u differs from the subset\n", i);
+      ret = 1;
+    }
+    free(expected);
+
+    char filename[1024];
+    snprintf(filename, sizeof(filename), "%s.%u.ttf", argv[2], i);
+    FILE *out = fopen(filename, "wb");
+    if (!out || fwrite(results[i], result_lens[i], 1, out) != 1 ||
+        fclose(out)) {
+      perror("writing output");
+      ret = 1;
+    }
+    free(results[i]);
+  }
+  free(data);
+
+  return ret;
+}
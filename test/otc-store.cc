@@ -0,0 +1,254 @@
+// Sanitises the given files through an OTCStore, at the path given as argv[1],
+// and checks that every result is the same as from otc_process, both from the
+// store which added it and after the store has been closed and opened again.
+// It then damages the store in the ways a crash might (a half written record,
+// a broken index, a broken record and a broken output with an intact index)
+// and checks that the store recovers, and that a store written by another
+// version of the sanitiser is emptied.
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "opentype-condom.h"
+#include "buffer-stream.h"
+
+static int
+usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s <store path> <ttf file>...\n", argv0);
+  return 1;
+}
+
+struct Input {
+  std::vector<uint8_t> data;
+  bool ok;  // the result of otc_process
+  std::vector<uint8_t> expected;  // the output of otc_process
+};
+
+static std::vector<Input> inputs;
+static const uint64_t kMaxBytes = 256 * 1024 * 1024;
+
+// Returns true if sanitising input |i| through |store| gives the same result
+// as otc_process.
+static bool
+Process(OTCStore *store, unsigned i) {
+  BufferStream output;
+  const Input &input = inputs[i];
+  const bool ok = otc_process_stored(store, &output, &input.data[0],
+                                     input.data.size());
+  return ok == input.ok && (!ok || output.data() == input.expected);
+}
+
+// Returns the number of inputs which are in |store|, or -1 if any of them
+// has the wrong result.
+static int
+CountStored(OTCStore *store) {
+  int count = 0;
+  for (unsigned i = 0; i < inputs.size(); ++i) {
+    bool ok;
+    const uint8_t *output;
+    size_t output_length;
+    if (!otc_store_lookup(store, &ok, &output, &output_length,
+                          &inputs[i].data[0], inputs[i].data.size())) {
+      continue;
+    }
+    if (ok != inputs[i].ok ||
+        (ok && std::vector<uint8_t>(output, output + output_length) !=
+               inputs[i].expected)) {
+      return -1;
+    }
+    count++;
+  }
+  return count;
+}
+
+static off_t
+FileSize(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) ? -1 : st.st_size;
+}
+
+static unsigned failures = 0;
+
+static void *
+Worker(void *arg) {
+  OTCStore *store = static_cast<OTCStore*>(arg);
+  for (unsigned round = 0; round < 10; ++round) {
+    for (unsigned i = 0; i < inputs.size(); ++i) {
+      if (!Process(store, i))
+        __sync_fetch_and_add(&failures, 1);
+    }
+  }
+  return NULL;
+}
+
+int
+main(int argc, char **argv) {
+  if (argc < 3)
+    return usage(argv[0]);
+
+  const char *path = argv[1];
+  const std::string data_path = std::string(path) + ".data";
+  const std::string index_path = std::string(path) + ".index";
+
+  for (int i = 2; i < argc; ++i) {
+    const int fd = open(argv[i], O_RDONLY);
+    if (fd < 0) {
+      perror("open");
+      return 1;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+
+    Input input;
+    input.data.resize(st.st_size);
+    read(fd, &input.data[0], st.st_size);
+    close(fd);
+
+    BufferStream output;
+    input.ok = otc_process(&output, &input.data[0], input.data.size());
+    input.expected = output.data();
+    inputs.push_back(input);
+
+    // A copy which must be rejected
+    input.data[0] = 0xde;
+    input.ok = false;
+    input.expected.clear();
+    inputs.push_back(input);
+  }
+  const int count = inputs.size();
+
+  unlink(data_path.c_str());
+  unlink(index_path.c_str());
+  OTCStore *store = otc_store_open(path, kMaxBytes, 1000);
+  if (!store) {
+    fprintf(stderr, "Failed to create the store!\n");
+    return 1;
+  }
+  if (otc_store_open(path, kMaxBytes, 1000)) {
+    fprintf(stderr, "The store was opened twice!\n");
+    return 1;
+  }
+  for (int i = 0; i < count; ++i) {
+    if (!Process(store, i)) {
+      fprintf(stderr, "Input %d gave the wrong result!\n", i);
+      return 1;
+    }
+  }
+  if (CountStored(store) != count) {
+    fprintf(stderr, "The results weren't stored!\n");
+    return 1;
+  }
+  otc_store_close(store);
+  const off_t data_size = FileSize(data_path);
+
+  // A warm start
+  store = otc_store_open(path, kMaxBytes, 1000);
+  if (!store || CountStored(store) != count) {
+    fprintf(stderr, "The results didn't survive reopening the store!\n");
+    return 1;
+  }
+  otc_store_close(store);
+
+  // A record which was half written when the process died
+  FILE *file = fopen(data_path.c_str(), "ab");
+  fwrite("OTCR and then nothing much", 26, 1, file);
+  fclose(file);
+  store = otc_store_open(path, kMaxBytes, 1000);
+  if (!store || CountStored(store) != count ||
+      FileSize(data_path) != data_size) {
+    fprintf(stderr, "The store didn't recover from a partial record!\n");
+    return 1;
+  }
+  otc_store_close(store);
+
+  // A broken index is rebuilt from the data file.
+  file = fopen(index_path.c_str(), "r+b");
+  fwrite("junk", 4, 1, file);
+  fclose(file);
+  store = otc_store_open(path, kMaxBytes, 1000);
+  if (!store || CountStored(store) != count) {
+    fprintf(stderr, "The store didn't recover from a broken index!\n");
+    return 1;
+  }
+  otc_store_close(store);
+
+  // A broken record (the last, which is a rejection) is dropped when the
+  // index is rebuilt, and added again when the input is next seen.
+  file = fopen(data_path.c_str(), "r+b");
+  fseek(file, data_size - 40, SEEK_SET);
+  fwrite("junk", 4, 1, file);
+  fclose(file);
+  unlink(index_path.c_str());
+  store = otc_store_open(path, kMaxBytes, 1000);
+  if (!store || CountStored(store) != count - 1 || !Process(store, count - 1) ||
+      CountStored(store) != count) {
+    fprintf(stderr, "The store didn't recover from a broken record!\n");
+    return 1;
+  }
+  otc_store_close(store);
+
+  // A broken output, behind an intact index, misses and is added again.
+  std::vector<uint8_t> data_file(FileSize(data_path));
+  file = fopen(data_path.c_str(), "r+b");
+  fread(&data_file[0], data_file.size(), 1, file);
+  const std::vector<uint8_t>::iterator output =
+      std::search(data_file.begin(), data_file.end(),
+                  inputs[0].expected.begin(), inputs[0].expected.end());
+  if (!inputs[0].ok || output == data_file.end()) {
+    fprintf(stderr, "The first output isn't in the data file!\n");
+    return 1;
+  }
+  fseek(file, output - data_file.begin() + inputs[0].expected.size() / 2,
+        SEEK_SET);
+  fwrite("junk", 4, 1, file);
+  fclose(file);
+  store = otc_store_open(path, kMaxBytes, 1000);
+  if (!store || CountStored(store) != count - 1 || !Process(store, 0) ||
+      CountStored(store) != count) {
+    fprintf(stderr, "The store didn't recover from a broken output!\n");
+    return 1;
+  }
+  otc_store_close(store);
+
+  // A store from another version of the sanitiser. Its output version follows
+  // the magic, the version and the hash key in the data file.
+  file = fopen(data_path.c_str(), "r+b");
+  fseek(file, 24, SEEK_SET);
+  fwrite("junk", 4, 1, file);
+  fclose(file);
+  store = otc_store_open(path, kMaxBytes, 1000);
+  if (!store || CountStored(store) != 0) {
+    fprintf(stderr, "The store wasn't emptied for a new version!\n");
+    return 1;
+  }
+  otc_store_close(store);
+
+  // Many threads at once, starting from an empty store
+  unlink(data_path.c_str());
+  unlink(index_path.c_str());
+  store = otc_store_open(path, kMaxBytes, 1000);
+  std::vector<pthread_t> threads(8);
+  for (unsigned i = 0; i < threads.size(); ++i)
+    pthread_create(&threads[i], NULL, Worker, store);
+  for (unsigned i = 0; i < threads.size(); ++i)
+    pthread_join(threads[i], NULL);
+  if (failures || CountStored(store) != count) {
+    fprintf(stderr, "%u results were wrong!\n", failures);
+    return 1;
+  }
+  otc_store_close(store);
+
+  unlink(data_path.c_str());
+  unlink(index_path.c_str());
+  return 0;
+}
@@ -0,0 +1,149 @@
+// A driver program which subsets the file given as argv[1] to the code-points
+// given as argv[2] (a comma separated list of hex code-points and ranges, like
+// "20-7e,a0,2014") and writes the subset font to argv[3].
+//
+// The subset font is checked: sanitising it again must give the same output,
+// and it must map exactly the requested code-points which the original font
+// maps.
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "opentype-condom.h"
+
+static int
+usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s <ttf file> <code-points> <output file>\n", argv0);
+  return 1;
+}
+
+static bool
+ParseCodePoints(std::vector<uint32_t> *code_points, const char *spec) {
+  for (;;) {
+    char *end;
+    const unsigned long start = strtoul(spec, &end, 16);
+    if (end == spec)
+      return false;
+    unsigned long last = start;
+    if (*end == '-') {
+      spec = end + 1;
+      last = strtoul(spec, &end, 16);
+      if (end == spec || last < start)
+        return false;
+    }
+    if (last >= 0x110000)
+      return false;
+    for (unsigned long cp = start; cp <= last; ++cp)
+      code_points->push_back(cp);
+
+    if (!*end)
+      return true;
+    if (*end != ',')
+      return false;
+    spec = end + 1;
+  }
+}
+
+// Return true if |cp| is in |coverage|
+static bool
+Covers(const OTCCoverage &coverage, uint32_t cp) {
+  return (coverage.bitmap[cp >> 3] >> (cp & 7)) & 1;
+}
+
+int
+main(int argc, char **argv) {
+  if (argc != 4)
+    return usage(argv[0]);
+
+  std::vector<uint32_t> code_points;
+  if (!ParseCodePoints(&code_points, argv[2]))
+    return usage(argv[0]);
+
+  const int fd = open(argv[1], O_RDONLY);
+  if (fd < 0) {
+    perror("open");
+    return 1;
+  }
+
+  struct stat st;
+  fstat(fd, &st);
+
+  uint8_t *data = (uint8_t *) malloc(st.st_size);
+  read(fd, data, st.st_size);
+  close(fd);
+
+  OTCCoverage coverage;
+  coverage.want_bitmap = true;
+  OTCOptions options;
+  options.coverage = &coverage;
+  size_t output_length;
+  if (!otc_output_size(&output_length, data, st.st_size, options)) {
+    fprintf(stderr, "Failed to sanitise file!\n");
+    return 1;
+  }
+
+  // Find the size of the subset font and then write it.
+  OTCCoverage subset_coverage;
+  subset_coverage.want_bitmap = true;
+  options.coverage = &subset_coverage;
+  options.subset = &code_points;
+  size_t subset_length;
+  if (!otc_output_size(&subset_length, data, st.st_size, options)) {
+    fprintf(stderr, "Failed to subset file!\n");
+    return 1;
+  }
+
+  uint8_t *subset = (uint8_t *) malloc(subset_length);
+  size_t written;
+  if (!otc_process_buffer(subset, subset_length, &written, data, st.st_size,
+                          options) ||
+      written != subset_length) {
+    fprintf(stderr, "Failed to write subset file!\n");
+    return 1;
+  }
+  free(data);
+
+  // The coverage of the subset should be the requested code-points which the
+  // original font covers.
+  std::vector<bool> requested(0x110000);
+  for (unsigned i = 0; i < code_points.size(); ++i)
+    requested[code_points[i]] = true;
+  unsigned num_covered = 0;
+  for (uint32_t cp = 0; cp < 0x110000; ++cp) {
+    const bool expected = requested[cp] && Covers(coverage, cp);
+    if (Covers(subset_coverage, cp) != expected) {
+      fprintf(stderr, "Subset coverage differs at U+%04X\n", cp);
+      return 1;
+    }
+    num_covered += expected;
+  }
+
+  // Sanitising the subset should change nothing.
+  uint8_t *resanitised = (uint8_t *) malloc(subset_length);
+  if (!otc_process_buffer(resanitised, subset_length, &written, subset,
+                          subset_length) ||
+      written != subset_length ||
+      memcmp(resanitised, subset, subset_length)) {
+    fprintf(stderr, "Sanitising the subset changed it!\n");
+    return 1;
+  }
+  free(resanitised);
+
+  FILE *out = fopen(argv[3], "wb");
+  if (!out || fwrite(subset, subset_length, 1, out) != 1 || fclose(out)) {
+    perror("writing output");
+    return 1;
+  }
+  free(subset);
+
+  fprintf(stderr, "%u code-points covered, %zu -> %zu bytes (%.1f%%)\n",
+          num_covered, output_length, subset_length,
+          100.0 * subset_length / output_length);
+
+  return 0;
+}
@@ -0,0 +1,286 @@
+// A driver program which converts the file given as argv[1] to a sanitised
+// WOFF file, written to argv[2].
+//
+// The WOFF file is checked by decoding it here: every table must decompress
+// to the same bytes that the sanitised OpenType output contains, with the
+// recorded checksums, and the OpenType file rebuilt from the tables must have
+// a valid checksum adjustment and sanitise to the same output. The WOFF file
+// is also given back to otc_process, which must decode it to the same
+// sanitised output (and, asked for WOFF output, the same WOFF file).
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <zlib.h>
+
+#include <vector>
+
+#include "opentype-condom.h"
+
+static int
+usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s <ttf file> <woff file>\n", argv0);
+  return 1;
+}
+
+static uint32_t
+GetU32(const uint8_t *data) {
+  return data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+static uint16_t
+GetU16(const uint8_t *data) {
+  return data[0] << 8 | data[1];
+}
+
+static void
+PutU32(std::vector<uint8_t> *out, uint32_t value) {
+  out->push_back(value >> 24);
+  out->push_back(value >> 16);
+  out->push_back(value >> 8);
+  out->push_back(value);
+}
+
+static void
+PutU16(std::vector<uint8_t> *out, uint16_t value) {
+  out->push_back(value >> 8);
+  out->push_back(value);
+}
+
+static uint32_t
+Checksum(const std::vector<uint8_t> &data) {
+  std::vector<uint8_t> padded(data);
+  padded.resize((padded.size() + 3) & ~3);
+  return padded.empty() ? 0 : otc_checksum_words(&padded[0],
+                                                 padded.size() / 4);
+}
+
+// Return true if |data| is a sanitised WOFF file, in which case |sfnt| is
+// set to the OpenType file rebuilt from it (with the tables in tag order).
+// |sanitised| is the output of otc_process for the same input, which each
+// table is compared against.
+static bool
+DecodeWOFF(std::vector<uint8_t> *sfnt, const uint8_t *data, size_t length,
+           const uint8_t *sanitised, size_t sanitised_length) {
+  if (length < 44 || GetU32(data) != 0x774f4646 ||
+      GetU32(data + 4) != 0x00010000 || GetU32(data + 8) != length) {
+    fprintf(stderr, "Bad WOFF header\n");
+    return false;
+  }
+  const unsigned num_tables = GetU16(data + 12);
+  const uint32_t total_sfnt_size = GetU32(data + 16);
+  if (44 + 20 * num_tables > length ||
+      num_tables != GetU16(sanitised + 4)) {
+    fprintf(stderr, "Bad table count\n");
+    return false;
+  }
+
+  std::vector<std::vector<uint8_t> > tables(num_tables);
+  std::vector<uint32_t> tags(num_tables), chksums(num_tables);
+  for (unsigned i = 0; i < num_tables; ++i) {
+    const uint8_t *entry = data + 44 + 20 * i;
+    const uint32_t offset = GetU32(entry + 4);
+    const uint32_t comp_length = GetU32(entry + 8);
+    const uint32_t orig_length = GetU32(entry + 12);
+    tags[i] = GetU32(entry);
+    chksums[i] = GetU32(entry + 16);
+
+    if (i && tags[i] <= tags[i - 1]) {
+      fprintf(stderr, "Tables aren't sorted by tag\n");
+      return false;
+    }
+    if ((offset & 3) || offset > length || comp_length > length - offset ||
+        comp_length > orig_length) {
+      fprintf(stderr, "Bad table entry %u\n", i);
+      return false;
+    }
+
+    std::vector<uint8_t> &table = tables[i];
+    table.resize(orig_length);
+    if (comp_length == orig_length) {
+      if (orig_length)
+        memcpy(&table[0], data + offset, orig_length);
+    } else {
+      uLongf out_length = orig_length;
+      if (uncompress(&table[0], &out_length, data + offset, comp_length) !=
+          Z_OK || out_length != orig_length) {
+        fprintf(stderr, "Failed to decompress table %u\n", i);
+        return false;
+      }
+    }
+
+    // The head table's checksum is calculated with a zero checksum
+    // adjustment, as in an OpenType file.
+    std::vector<uint8_t> zeroed(table);
+    const bool is_head = tags[i] == 0x68656164;
+    if (is_head)
+      memset(&zeroed[8], 0, 4);
+    if (Checksum(zeroed) != chksums[i]) {
+      fprintf(stderr, "Bad checksum for table %u\n", i);
+      return false;
+    }
+
+    // Compare with the same table in the sanitised output.
+    const uint8_t *record = NULL;
+    for (unsigned j = 0; j < num_tables; ++j) {
+      if (GetU32(sanitised + 12 + 16 * j) == tags[i])
+        record = sanitised + 12 + 16 * j;
+    }
+    if (!record || GetU32(record + 4) != chksums[i] ||
+        GetU32(record + 12) != orig_length ||
+        GetU32(record + 8) + orig_length > sanitised_length) {
+      fprintf(stderr, "Table %u doesn't match the sanitised output\n", i);
+      return false;
+    }
+    const uint8_t *expected = sanitised + GetU32(record + 8);
+    if (memcmp(&table[0], expected, is_head ? 8 : orig_length) ||
+        (is_head && memcmp(&table[12], expected + 12, orig_length - 12))) {
+      fprintf(stderr, "Table %u doesn't match the sanitised output\n", i);
+      return false;
+    }
+  }
+
+  unsigned max_pow2 = 0;
+  while (1u << (max_pow2 + 1) < num_tables)
+    max_pow2++;
+  PutU32(sfnt, 0x00010000);
+  PutU16(sfnt, num_tables);
+  PutU16(sfnt, (1u << max_pow2) << 4);
+  PutU16(sfnt, max_pow2);
+  PutU16(sfnt, (num_tables << 4) - ((1u << max_pow2) << 4));
+  uint32_t offset = 12 + 16 * num_tables;
+  for (unsigned i = 0; i < num_tables; ++i) {
+    PutU32(sfnt, tags[i]);
+    PutU32(sfnt, chksums[i]);
+    PutU32(sfnt, offset);
+    PutU32(sfnt, tables[i].size());
+    offset += (tables[i].size() + 3) & ~3;
+  }
+  for (unsigned i = 0; i < num_tables; ++i) {
+    sfnt->insert(sfnt->end(), tables[i].begin(), tables[i].end());
+    sfnt->resize((sfnt->size() + 3) & ~3);
+  }
+
+  if (sfnt->size() != total_sfnt_size) {
+    fprintf(stderr, "totalSfntSize is %u, not %u\n", total_sfnt_size,
+            static_cast<unsigned>(sfnt->size()));
+    return false;
+  }
+  if (Checksum(*sfnt) != 0xb1b0afba) {
+    fprintf(stderr, "Bad checksum adjustment\n");
+    return false;
+  }
+
+  return true;
+}
+
+int
+main(int argc, char **argv) {
+  if (argc != 3)
+    return usage(argv[0]);
+
+  const int fd = open(argv[1], O_RDONLY);
+  if (fd < 0) {
+    perror("open");
+    return 1;
+  }
+
+  struct stat st;
+  fstat(fd, &st);
+
+  uint8_t *data = (uint8_t *) malloc(st.st_size);
+  read(fd, data, st.st_size);
+  close(fd);
+
+  size_t sanitised_length;
+  if (!otc_output_size(&sanitised_length, data, st.st_size)) {
+    fprintf(stderr, "Failed to sanitise file!\n");
+    return 1;
+  }
+  uint8_t *sanitised = (uint8_t *) malloc(sanitised_length);
+  size_t written;
+  if (!otc_process_buffer(sanitised, sanitised_length, &written, data,
+                          st.st_size)) {
+    fprintf(stderr, "Failed to sanitise file!\n");
+    return 1;
+  }
+
+  OTCOptions options;
+  options.output_format = OTC_OUTPUT_WOFF;
+  options.num_threads = 0;
+  size_t woff_length;
+  if (!otc_output_size(&woff_length, data, st.st_size, options)) {
+    fprintf(stderr, "Failed to find the WOFF size!\n");
+    return 1;
+  }
+  uint8_t *woff = (uint8_t *) malloc(woff_length);
+  if (!otc_process_buffer(woff, woff_length, &written, data, st.st_size,
+                          options) ||
+      written != woff_length) {
+    fprintf(stderr, "Failed to write WOFF file!\n");
+    return 1;
+  }
+
+  // Compressing on a single thread must give the same output.
+  options.num_threads = 1;
+  uint8_t *serial_woff = (uint8_t *) malloc(woff_length);
+  if (!otc_process_buffer(serial_woff, woff_length, &written, data,
+                          st.st_size, options) ||
+      written != woff_length || memcmp(woff, serial_woff, woff_length)) {
+    fprintf(stderr, "Compressing on one thread gave a different result!\n");
+    return 1;
+  }
+  free(serial_woff);
+  free(data);
+
+  std::vector<uint8_t> sfnt;
+  if (!DecodeWOFF(&sfnt, woff, woff_length, sanitised, sanitised_length))
+    return 1;
+
+  // The rebuilt file only differs from the sanitised output in the order of
+  // the tables, and sanitising it puts them back.
+  uint8_t *resanitised = (uint8_t *) malloc(sanitised_length);
+  if (!otc_process_buffer(resanitised, sanitised_length, &written, &sfnt[0],
+                          sfnt.size()) ||
+      written != sanitised_length ||
+      memcmp(resanitised, sanitised, sanitised_length)) {
+    fprintf(stderr, "The decoded WOFF file sanitises differently!\n");
+    return 1;
+  }
+  free(resanitised);
+
+  // otc_process accepts WOFF input directly.
+  uint8_t *from_woff = (uint8_t *) malloc(sanitised_length);
+  if (!otc_process_buffer(from_woff, sanitised_length, &written, woff,
+                          woff_length) ||
+      written != sanitised_length ||
+      memcmp(from_woff, sanitised, sanitised_length)) {
+    fprintf(stderr, "Sanitising the WOFF file gave a different result!\n");
+    return 1;
+  }
+  free(from_woff);
+
+  uint8_t *rewoffed = (uint8_t *) malloc(woff_length);
+  if (!otc_process_buffer(rewoffed, woff_length, &written, woff, woff_length,
+                          options) ||
+      written != woff_length || memcmp(rewoffed, woff, woff_length)) {
+    fprintf(stderr, "Sanitising the WOFF file to WOFF changed it!\n");
+    return 1;
+  }
+  free(rewoffed);
+
+  FILE *out = fopen(argv[2], "wb");
+  if (!out || fwrite(woff, woff_length, 1, out) != 1 || fclose(out)) {
+    perror("writing output");
+    return 1;
+  }
+
+  fprintf(stderr, "%zu -> %zu bytes (%.1f%%)\n", sanitised_length,
+          woff_length, 100.0 * woff_length / sanitised_length);
+  free(woff);
+  free(sanitised);
+
+  return 0;
+}
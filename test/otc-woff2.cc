@@ -0,0 +1,723 @@
+// A driver program which converts the file given as argv[1] to a sanitised
+// WOFF 2.0 file, written to argv[2].
+//
+// The WOFF2 file is checked by decoding it here, including rebuilding glyf
+// and loca from the transformed glyf table. Every other table must be the same
+// as in the sanitised OpenType output, every glyph must have the same outline,
+// bounding box and instructions, and the rebuilt OpenType file must sanitise.
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <brotli/decode.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "opentype-condom.h"
+
+static int
+usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s <ttf file> <woff2 file>\n", argv0);
+  return 1;
+}
+
+static uint32_t
+GetU32(const uint8_t *data) {
+  return data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+static uint16_t
+GetU16(const uint8_t *data) {
+  return data[0] << 8 | data[1];
+}
+
+static void
+PutU32(std::vector<uint8_t> *out, uint32_t value) {
+  out->push_back(value >> 24);
+  out->push_back(value >> 16);
+  out->push_back(value >> 8);
+  out->push_back(value);
+}
+
+static void
+PutU16(std::vector<uint8_t> *out, uint16_t value) {
+  out->push_back(value >> 8);
+  out->push_back(value);
+}
+
+static uint32_t
+Tag(const char *tag) {
+  return GetU32(reinterpret_cast<const uint8_t*>(tag));
+}
+
+static const char kKnownTags[63][5] = {
+  "cmap", "head", "hhea", "hmtx", "maxp", "name", "OS/2", "post", "cvt ",
+  "fpgm", "glyf", "loca", "prep", "CFF ", "VORG", "EBDT", "EBLC", "gasp",
+  "hdmx", "kern", "LTSH", "PCLT", "VDMX", "vhea", "vmtx", "BASE", "GDEF",
+  "GPOS", "GSUB", "EBSC", "JSTF", "MATH", "CBDT", "CBLC", "COLR", "CPAL",
+  "SVG ", "sbix", "acnt", "avar", "bdat", "bloc", "bsln", "cvar", "fdsc",
+  "feat", "fmtx", "fvar", "gvar", "hsty", "just", "lcar", "mort", "morx",
+  "opbd", "prop", "trak", "Zapf", "Silf", "Glat", "Gloc", "Feat", "Sill",
+};
+
+// A bounds checked reader. Any read past the end sets |ok| to false and
+// returns zeros.
+struct Reader {
+  Reader(const uint8_t *data, size_t length)
+      : data(data), length(length), offset(0), ok(true) {
+  }
+
+  const uint8_t *Skip(size_t n) {
+    if (n > length - offset) {
+      ok = false;
+      offset = length;
+      return NULL;
+    }
+    offset += n;
+    return data + offset - n;
+  }
+
+  unsigned U8() {
+    const uint8_t *p = Skip(1);
+    return p ? p[0] : 0;
+  }
+
+  unsigned U16() {
+    const uint8_t *p = Skip(2);
+    return p ? GetU16(p) : 0;
+  }
+
+  uint32_t U32() {
+    const uint8_t *p = Skip(4);
+    return p ? GetU32(p) : 0;
+  }
+
+  unsigned U255Short() {
+    const unsigned code = U8();
+    if (code == 253)
+      return U16();
+    if (code == 255)
+      return U8() + 253;
+    if (code == 254)
+      return U8() + 506;
+    return code;
+  }
+
+  uint32_t UIntBase128() {
+    uint32_t value = 0;
+    for (unsigned i = 0; i < 5; ++i) {
+      const unsigned byte = U8();
+      if ((i == 0 && byte == 0x80) || value >> 25)
+        ok = false;
+      value = value << 7 | (byte & 0x7f);
+      if (!(byte & 0x80))
+        return value;
+    }
+    ok = false;
+    return 0;
+  }
+
+  bool done() const { return ok && offset == length; }
+
+  const uint8_t *data;
+  size_t length;
+  size_t offset;
+  bool ok;
+};
+
+static int
+WithSign(unsigned flag, int value) {
+  return flag & 1 ? value : -value;
+}
+
+// Decode a point from the flag and glyph streams of the transformed glyf
+// table.
+static void
+DecodeTriplet(Reader *glyphs, unsigned flag, int *dx, int *dy) {
+  flag &= 0x7f;
+  if (flag < 10) {
+    *dx = 0;
+    *dy = WithSign(flag, ((flag & 14) << 7) + glyphs->U8());
+  } else if (flag < 20) {
+    *dx = WithSign(flag, (((flag - 10) & 14) << 7) + glyphs->U8());
+    *dy = 0;
+  } else if (flag < 84) {
+    const unsigned b0 = flag - 20;
+    const unsigned b1 = glyphs->U8();
+    *dx = WithSign(flag, 1 + (b0 & 0x30) + (b1 >> 4));
+    *dy = WithSign(flag >> 1, 1 + ((b0 & 0x0c) << 2) + (b1 & 0x0f));
+  } else if (flag < 120) {
+    const unsigned b0 = flag - 84;
+    *dx = WithSign(flag, 1 + ((b0 / 12) << 8) + glyphs->U8());
+    *dy = WithSign(flag >> 1, 1 + (((b0 % 12) >> 2) << 8) + glyphs->U8());
+  } else if (flag < 124) {
+    const unsigned b0 = glyphs->U8();
+    const unsigned b1 = glyphs->U8();
+    const unsigned b2 = glyphs->U8();
+    *dx = WithSign(flag, (b0 << 4) + (b1 >> 4));
+    *dy = WithSign(flag >> 1, ((b1 & 0x0f) << 8) + b2);
+  } else {
+    const unsigned x = glyphs->U16();
+    const unsigned y = glyphs->U16();
+    *dx = WithSign(flag, x);
+    *dy = WithSign(flag >> 1, y);
+  }
+}
+
+// Append the coordinate |delta| to |out|, setting the short and same flags in
+// |flag|.
+static void
+PutCoordinate(std::vector<uint8_t> *out, int delta, uint8_t short_flag,
+              uint8_t same_flag, uint8_t *flag) {
+  if (delta == 0) {
+    *flag |= same_flag;
+  } else if (delta > -256 && delta < 256) {
+    *flag |= short_flag | (delta > 0 ? same_flag : 0);
+    out->push_back(delta > 0 ? delta : -delta);
+  } else {
+    PutU16(out, delta);
+  }
+}
+
+// Rebuild the glyf and loca tables from the transformed glyf table |data|.
+static bool
+RebuildGlyf(std::vector<uint8_t> *glyf, std::vector<uint8_t> *loca,
+            unsigned *index_format, const uint8_t *data, size_t length) {
+  Reader header(data, length);
+  header.U16();  // reserved
+  const unsigned option_flags = header.U16();
+  const unsigned num_glyphs = header.U16();
+  *index_format = header.U16();
+  uint32_t sizes[7];
+  for (unsigned i = 0; i < 7; ++i)
+    sizes[i] = header.U32();
+  if (!header.ok)
+    return false;
+
+  std::vector<Reader> streams;
+  size_t offset = header.offset;
+  for (unsigned i = 0; i < 7; ++i) {
+    if (sizes[i] > length - offset)
+      return false;
+    streams.push_back(Reader(data + offset, sizes[i]));
+    offset += sizes[i];
+  }
+  Reader &n_contours = streams[0], &n_points = streams[1];
+  Reader &flags = streams[2], &glyphs = streams[3], &composites = streams[4];
+  Reader &bboxes = streams[5], &instructions = streams[6];
+
+  const size_t bitmap_length = 4 * ((num_glyphs + 31) / 32);
+  const uint8_t *bbox_bitmap = bboxes.Skip(bitmap_length);
+  const uint8_t *overlap_bitmap = NULL;
+  if (option_flags & 1) {
+    if ((num_glyphs + 7) / 8 > length - offset)
+      return false;
+    overlap_bitmap = data + offset;
+    offset += (num_glyphs + 7) / 8;
+  }
+  if (!bbox_bitmap || offset != length)
+    return false;
+
+  std::vector<uint32_t> offsets;
+  for (unsigned i = 0; i < num_glyphs; ++i) {
+    offsets.push_back(glyf->size());
+    const int16_t num_contours = n_contours.U16();
+    const bool has_bbox = (bbox_bitmap[i >> 3] << (i & 7)) & 0x80;
+    if (num_contours == 0) {
+      if (has_bbox)
+        return false;
+      continue;
+    }
+
+    std::vector<uint8_t> glyph;
+    PutU16(&glyph, num_contours);
+    glyph.resize(10);  // the bounding box is filled in below
+
+    int xmin = 0, ymin = 0, xmax = 0, ymax = 0;
+    if (num_contours > 0) {
+      unsigned num_points = 0;
+      for (int j = 0; j < num_contours; ++j) {
+        num_points += n_points.U255Short();
+        PutU16(&glyph, num_points - 1);
+      }
+      std::vector<uint8_t> point_flags, xs, ys;
+      int x = 0, y = 0;
+      for (unsigned j = 0; j < num_points; ++j) {
+        const unsigned flag = flags.U8();
+        int dx, dy;
+        DecodeTriplet(&glyphs, flag, &dx, &dy);
+        x += dx;
+        y += dy;
+        if (j == 0) {
+          xmin = xmax = x;
+          ymin = ymax = y;
+        } else {
+          xmin = std::min(xmin, x);
+          xmax = std::max(xmax, x);
+          ymin = std::min(ymin, y);
+          ymax = std::max(ymax, y);
+        }
+        uint8_t point_flag = flag & 0x80 ? 0 : 1;
+        if (j == 0 && overlap_bitmap &&
+            ((overlap_bitmap[i >> 3] << (i & 7)) & 0x80)) {
+          point_flag |= 0x40;
+        }
+        PutCoordinate(&xs, dx, 0x02, 0x10, &point_flag);
+        PutCoordinate(&ys, dy, 0x04, 0x20, &point_flag);
+        point_flags.push_back(point_flag);
+      }
+      const unsigned instructions_length = glyphs.U255Short();
+      PutU16(&glyph, instructions_length);
+      const uint8_t *code = instructions.Skip(instructions_length);
+      if (code)
+        glyph.insert(glyph.end(), code, code + instructions_length);
+      glyph.insert(glyph.end(), point_flags.begin(), point_flags.end());
+      glyph.insert(glyph.end(), xs.begin(), xs.end());
+      glyph.insert(glyph.end(), ys.begin(), ys.end());
+    } else {
+      if (!has_bbox)
+        return false;
+      unsigned flag;
+      bool have_instructions = false;
+      do {
+        flag = composites.U16();
+        have_instructions |= flag & 0x100;
+        unsigned length = 2 + (flag & 1 ? 4 : 2);
+        if (flag & 0x08) {
+          length += 2;
+        } else if (flag & 0x40) {
+          length += 4;
+        } else if (flag & 0x80) {
+          length += 8;
+        }
+        PutU16(&glyph, flag);
+        const uint8_t *component = composites.Skip(length);
+        if (component)
+          glyph.insert(glyph.end(), component, component + length);
+      } while (composites.ok && (flag & 0x20));
+      if (have_instructions) {
+        const unsigned instructions_length = glyphs.U255Short();
+        PutU16(&glyph, instructions_length);
+        const uint8_t *code = instructions.Skip(instructions_length);
+        if (code)
+          glyph.insert(glyph.end(), code, code + instructions_length);
+      }
+    }
+
+    if (has_bbox) {
+      xmin = static_cast<int16_t>(bboxes.U16());
+      ymin = static_cast<int16_t>(bboxes.U16());
+      xmax = static_cast<int16_t>(bboxes.U16());
+      ymax = static_cast<int16_t>(bboxes.U16());
+    }
+    glyph[2] = xmin >> 8; glyph[3] = xmin;
+    glyph[4] = ymin >> 8; glyph[5] = ymin;
+    glyph[6] = xmax >> 8; glyph[7] = xmax;
+    glyph[8] = ymax >> 8; glyph[9] = ymax;
+
+    glyph.resize((glyph.size() + 3) & ~3);
+    glyf->insert(glyf->end(), glyph.begin(), glyph.end());
+  }
+  offsets.push_back(glyf->size());
+
+  for (unsigned i = 0; i < 7; ++i) {
+    if (!streams[i].done()) {
+      fprintf(stderr, "Stream %u of the transformed glyf table is bad\n", i);
+      return false;
+    }
+  }
+
+  for (unsigned i = 0; i < offsets.size(); ++i) {
+    if (*index_format) {
+      PutU32(loca, offsets[i]);
+    } else {
+      if (offsets[i] > 0x1fffe)
+        return false;
+      PutU16(loca, offsets[i] >> 1);
+    }
+  }
+  return true;
+}
+
+// The parts of a glyph which must survive the transform
+struct Outline {
+  std::vector<int> values;
+};
+
+// Set |outline| to the bounding box, contours, instructions and points of the
+// simple glyph |data|, or the bytes of the composite glyph |data| up to the
+// padding.
+static bool
+GetOutline(Outline *outline, const uint8_t *data, size_t length) {
+  Reader glyph(data, length);
+  const int16_t num_contours = glyph.U16();
+  for (unsigned i = 0; i < 4; ++i)
+    outline->values.push_back(static_cast<int16_t>(glyph.U16()));
+  outline->values.push_back(num_contours);
+  if (num_contours < 0) {
+    // The composite is rebuilt byte for byte, apart from the padding.
+    size_t end = length;
+    while (end > 10 && !data[end - 1])
+      end--;
+    outline->values.insert(outline->values.end(), data, data + end);
+    return glyph.ok;
+  }
+
+  unsigned num_points = 0;
+  for (int i = 0; i < num_contours; ++i) {
+    num_points = glyph.U16() + 1;
+    outline->values.push_back(num_points);
+  }
+  const unsigned instructions_length = glyph.U16();
+  const uint8_t *code = glyph.Skip(instructions_length);
+  if (code)
+    outline->values.insert(outline->values.end(), code,
+                           code + instructions_length);
+
+  std::vector<uint8_t> flags;
+  while (glyph.ok && flags.size() < num_points) {
+    const uint8_t flag = glyph.U8();
+    const unsigned repeats = flag & 0x08 ? glyph.U8() : 0;
+    for (unsigned i = 0; i <= repeats; ++i)
+      flags.push_back(flag);
+  }
+  if (flags.size() != num_points)
+    return false;
+
+  int x = 0;
+  for (unsigned i = 0; i < num_points; ++i) {
+    if (flags[i] & 0x02) {
+      x += flags[i] & 0x10 ? glyph.U8() : -static_cast<int>(glyph.U8());
+    } else if (!(flags[i] & 0x10)) {
+      x += static_cast<int16_t>(glyph.U16());
+    }
+    outline->values.push_back(x);
+  }
+  int y = 0;
+  for (unsigned i = 0; i < num_points; ++i) {
+    if (flags[i] & 0x04) {
+      y += flags[i] & 0x20 ? glyph.U8() : -static_cast<int>(glyph.U8());
+    } else if (!(flags[i] & 0x20)) {
+      y += static_cast<int16_t>(glyph.U16());
+    }
+    outline->values.push_back(y);
+    outline->values.push_back(flags[i] & (i == 0 ? 0x41 : 0x01));
+  }
+
+  return glyph.ok;
+}
+
+// Find the table |tag| in the OpenType file |font|
+static bool
+FindTable(const uint8_t *font, size_t length, uint32_t tag,
+          const uint8_t **data, size_t *table_length) {
+  const unsigned num_tables = GetU16(font + 4);
+  for (unsigned i = 0; i < num_tables; ++i) {
+    const uint8_t *record = font + 12 + 16 * i;
+    if (GetU32(record) != tag)
+      continue;
+    const uint32_t offset = GetU32(record + 8);
+    *table_length = GetU32(record + 12);
+    if (offset > length || *table_length > length - offset)
+      return false;
+    *data = font + offset;
+    return true;
+  }
+  return false;
+}
+
+// Check that every glyph of |glyf| and |loca| (with the given loca format)
+// has the same outline as in the sanitised font |sanitised|.
+static bool
+CompareGlyphs(const std::vector<uint8_t> &glyf,
+              const std::vector<uint8_t> &loca, unsigned index_format,
+              const uint8_t *sanitised, size_t sanitised_length) {
+  const uint8_t *head, *expected_glyf, *expected_loca;
+  size_t head_length, expected_glyf_length, expected_loca_length;
+  if (!FindTable(sanitised, sanitised_length, Tag("head"), &head,
+                 &head_length) ||
+      !FindTable(sanitised, sanitised_length, Tag("glyf"), &expected_glyf,
+                 &expected_glyf_length) ||
+      !FindTable(sanitised, sanitised_length, Tag("loca"), &expected_loca,
+                 &expected_loca_length)) {
+    return false;
+  }
+  const unsigned expected_format = GetU16(head + 50);
+  const unsigned num_glyphs =
+      expected_loca_length / (expected_format ? 4 : 2) - 1;
+  if (loca.size() != (num_glyphs + 1) * (index_format ? 4 : 2)) {
+    fprintf(stderr, "The rebuilt loca table has the wrong length\n");
+    return false;
+  }
+
+  for (unsigned i = 0; i < num_glyphs; ++i) {
+    uint32_t start, end, expected_start, expected_end;
+    if (index_format) {
+      start = GetU32(&loca[i * 4]);
+      end = GetU32(&loca[i * 4 + 4]);
+    } else {
+      start = GetU16(&loca[i * 2]) * 2;
+      end = GetU16(&loca[i * 2 + 2]) * 2;
+    }
+    if (expected_format) {
+      expected_start = GetU32(expected_loca + i * 4);
+      expected_end = GetU32(expected_loca + i * 4 + 4);
+    } else {
+      expected_start = GetU16(expected_loca + i * 2) * 2;
+      expected_end = GetU16(expected_loca + i * 2 + 2) * 2;
+    }
+
+    if ((start == end) != (expected_start == expected_end)) {
+      fprintf(stderr, "Glyph %u is empty in only one font\n", i);
+      return false;
+    }
+    if (start == end)
+      continue;
+
+    Outline outline, expected;
+    if (!GetOutline(&outline, &glyf[start], end - start) ||
+        !GetOutline(&expected, expected_glyf + expected_start,
+                    expected_end - expected_start) ||
+        outline.values != expected.values) {
+      fprintf(stderr, "Glyph %u has changed\n", i);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Decode the WOFF2 file |data| and compare it with |sanitised|, the output of
+// otc_process for the same input. |sfnt| is set to the rebuilt OpenType file.
+static bool
+DecodeWOFF2(std::vector<uint8_t> *sfnt, const uint8_t *data, size_t length,
+            const uint8_t *sanitised, size_t sanitised_length) {
+  Reader header(data, length);
+  const uint32_t signature = header.U32();
+  const uint32_t flavor = header.U32();
+  const uint32_t woff_length = header.U32();
+  const unsigned num_tables = header.U16();
+  header.U16();  // reserved
+  const uint32_t total_sfnt_size = header.U32();
+  const uint32_t compressed_length = header.U32();
+  header.Skip(4 + 20);  // versions, metadata and private data
+  if (!header.ok || signature != 0x774f4632 || flavor != 0x00010000 ||
+      woff_length != length || num_tables != GetU16(sanitised + 4)) {
+    fprintf(stderr, "Bad WOFF2 header\n");
+    return false;
+  }
+
+  std::vector<uint32_t> tags(num_tables), lengths(num_tables);
+  std::vector<uint32_t> transform_lengths(num_tables);
+  std::vector<bool> transformed(num_tables);
+  size_t uncompressed_length = 0;
+  for (unsigned i = 0; i < num_tables; ++i) {
+    const unsigned flags = header.U8();
+    if ((flags & 0x3f) == 63) {
+      tags[i] = header.U32();
+    } else {
+      tags[i] = Tag(kKnownTags[flags & 0x3f]);
+    }
+    lengths[i] = header.UIntBase128();
+    const unsigned version = flags >> 6;
+    const bool is_glyf_or_loca = tags[i] == Tag("glyf") ||
+                                 tags[i] == Tag("loca");
+    transformed[i] = is_glyf_or_loca ? version == 0 : version != 0;
+    transform_lengths[i] = transformed[i] ? header.UIntBase128() : lengths[i];
+    if (tags[i] == Tag("loca") && transformed[i] && transform_lengths[i]) {
+      fprintf(stderr, "The transformed loca table isn't empty\n");
+      return false;
+    }
+    uncompressed_length += transform_lengths[i];
+  }
+  if (!header.ok ||
+      compressed_length > length - header.offset ||
+      header.offset + ((compressed_length + 3) & ~3) != length) {
+    fprintf(stderr, "Bad WOFF2 table directory\n");
+    return false;
+  }
+
+  std::vector<uint8_t> font_data(uncompressed_length);
+  size_t decoded_length = uncompressed_length;
+  if (BrotliDecoderDecompress(compressed_length, data + header.offset,
+                              &decoded_length, &font_data[0]) !=
+      BROTLI_DECODER_RESULT_SUCCESS ||
+      decoded_length != uncompressed_length) {
+    fprintf(stderr, "Failed to decompress the font data\n");
+    return false;
+  }
+
+  std::vector<std::vector<uint8_t> > tables(num_tables);
+  size_t offset = 0;
+  unsigned glyf_index = num_tables, loca_index = num_tables;
+  for (unsigned i = 0; i < num_tables; ++i) {
+    tables[i].assign(font_data.begin() + offset,
+                     font_data.begin() + offset + transform_lengths[i]);
+    offset += transform_lengths[i];
+    if (tags[i] == Tag("glyf"))
+      glyf_index = i;
+    if (tags[i] == Tag("loca"))
+      loca_index = i;
+  }
+  if (glyf_index == num_tables || loca_index == num_tables ||
+      transformed[glyf_index] != transformed[loca_index]) {
+    fprintf(stderr, "Bad glyf and loca tables\n");
+    return false;
+  }
+
+  const bool glyf_transformed = transformed[glyf_index];
+  if (glyf_transformed) {
+    unsigned index_format;
+    std::vector<uint8_t> glyf, loca;
+    if (!RebuildGlyf(&glyf, &loca, &index_format, &tables[glyf_index][0],
+                     tables[glyf_index].size())) {
+      fprintf(stderr, "Failed to rebuild the glyf table\n");
+      return false;
+    }
+    if (loca.size() != lengths[loca_index] ||
+        !CompareGlyphs(glyf, loca, index_format, sanitised,
+                       sanitised_length)) {
+      return false;
+    }
+    tables[glyf_index] = glyf;
+    tables[loca_index] = loca;
+  }
+
+  for (unsigned i = 0; i < num_tables; ++i) {
+    if (glyf_transformed && (i == glyf_index || i == loca_index))
+      continue;
+    const uint8_t *expected;
+    size_t expected_length;
+    if (!FindTable(sanitised, sanitised_length, tags[i], &expected,
+                   &expected_length)) {
+      fprintf(stderr, "Table %u isn't in the sanitised output\n", i);
+      return false;
+    }
+    std::vector<uint8_t> table(tables[i]);
+    std::vector<uint8_t> expected_table(expected, expected + expected_length);
+    if (tags[i] == Tag("head") && table.size() >= 54 &&
+        expected_table.size() >= 54) {
+      // The checksum adjustment may differ, and the lossless transform
+      // flag is set if glyf is transformed. So may the loca format, if the
+      // rebuilt glyf table is too large for short offsets.
+      if (!!(table[16] & 0x08) != glyf_transformed) {
+        fprintf(stderr, "The lossless transform flag is wrong\n");
+        return false;
+      }
+      memset(&table[8], 0, 4);
+      memset(&expected_table[8], 0, 4);
+      expected_table[16] |= table[16] & 0x08;
+      if (glyf_transformed) {
+        table[51] = 0;
+        expected_table[51] = 0;
+      }
+    }
+    if (table != expected_table) {
+      fprintf(stderr, "Table %u differs from the sanitised output\n", i);
+      return false;
+    }
+  }
+
+  // Build the OpenType file, with the tables in tag order.
+  unsigned max_pow2 = 0;
+  while (1u << (max_pow2 + 1) < num_tables)
+    max_pow2++;
+  PutU32(sfnt, 0x00010000);
+  PutU16(sfnt, num_tables);
+  PutU16(sfnt, (1u << max_pow2) << 4);
+  PutU16(sfnt, max_pow2);
+  PutU16(sfnt, (num_tables << 4) - ((1u << max_pow2) << 4));
+  uint32_t table_offset = 12 + 16 * num_tables;
+  for (unsigned i = 0; i < num_tables; ++i) {
+    PutU32(sfnt, tags[i]);
+    PutU32(sfnt, 0);  // the sanitiser doesn't check the checksums
+    PutU32(sfnt, table_offset);
+    PutU32(sfnt, tables[i].size());
+    table_offset += (tables[i].size() + 3) & ~3;
+  }
+  for (unsigned i = 0; i < num_tables; ++i) {
+    sfnt->insert(sfnt->end(), tables[i].begin(), tables[i].end());
+    sfnt->resize((sfnt->size() + 3) & ~3);
+  }
+
+  if (!glyf_transformed && sfnt->size() != total_sfnt_size) {
+    fprintf(stderr, "Bad totalSfntSize\n");
+    return false;
+  }
+
+  return true;
+}
+
+int
+main(int argc, char **argv) {
+  if (argc != 3)
+    return usage(argv[0]);
+
+  const int fd = open(argv[1], O_RDONLY);
+  if (fd < 0) {
+    perror("open");
+    return 1;
+  }
+
+  struct stat st;
+  fstat(fd, &st);
+
+  uint8_t *data = (uint8_t *) malloc(st.st_size);
+  read(fd, data, st.st_size);
+  close(fd);
+
+  size_t sanitised_length;
+  if (!otc_output_size(&sanitised_length, data, st.st_size)) {
+    fprintf(stderr, "Failed to sanitise file!\n");
+    return 1;
+  }
+  uint8_t *sanitised = (uint8_t *) malloc(sanitised_length);
+  size_t written;
+  if (!otc_process_buffer(sanitised, sanitised_length, &written, data,
+                          st.st_size)) {
+    fprintf(stderr, "Failed to sanitise file!\n");
+    return 1;
+  }
+
+  OTCOptions options;
+  options.output_format = OTC_OUTPUT_WOFF2;
+  size_t woff2_length;
+  if (!otc_output_size(&woff2_length, data, st.st_size, options)) {
+    fprintf(stderr, "Failed to find the WOFF2 size!\n");
+    return 1;
+  }
+  uint8_t *woff2 = (uint8_t *) malloc(woff2_length);
+  if (!otc_process_buffer(woff2, woff2_length, &written, data, st.st_size,
+                          options) ||
+      written != woff2_length) {
+    fprintf(stderr, "Failed to write WOFF2 file!\n");
+    return 1;
+  }
+  free(data);
+
+  std::vector<uint8_t> sfnt;
+  if (!DecodeWOFF2(&sfnt, woff2, woff2_length, sanitised, sanitised_length))
+    return 1;
+
+  size_t resanitised_length;
+  if (!otc_output_size(&resanitised_length, &sfnt[0], sfnt.size())) {
+    fprintf(stderr, "The decoded WOFF2 file was rejected!\n");
+    return 1;
+  }
+
+  FILE *out = fopen(argv[2], "wb");
+  if (!out || fwrite(woff2, woff2_length, 1, out) != 1 || fclose(out)) {
+    perror("writing output");
+    return 1;
+  }
+
+  fprintf(stderr, "%zu -> %zu bytes (%.1f%%)\n", sanitised_length,
+          woff2_length, 100.0 * woff2_length / sanitised_length);
+  free(woff2);
+  free(sanitised);
+
+  return 0;
+}